@@ -1,10 +1,16 @@
 #include "agent.h"
+#include "audio.h"
+#include "media.h"
 #include "peer.h"
 #include "utils.h"
 #include <cjson/cJSON.h>
 #include <curl/curl.h>
+#include <nng/nng.h>
+#include <nng/protocol/pubsub0/pub.h>
+#include <nng/protocol/pubsub0/sub.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +22,19 @@ PeerConnection *g_pc = NULL;
 PeerConnectionState g_state;
 
 #define OPENAI_API_URL "https://api.openai.com/v1/realtime/calls"
+// Mic audio this old is not worth sending, the agent would answer late
+#define AGENT_AUDIO_LATE_US 200000
+#define AGENT_AUDIO_RECV_MS 20
+#define AGENT_RESPONSE_SAMPLES 256
+
+static nng_socket g_agent_audio_pub_sock = {.id = -1};
+static uint32_t g_agent_audio_seq = 0;
+// When the local VAD last heard the user stop talking, 0 once the agent
+// has started to answer or the user talks again
+static atomic_uint_fast64_t g_speech_end_us;
+// End of speech to the agent's first audio packet, peer connection thread
+static uint64_t g_response_us[AGENT_RESPONSE_SAMPLES];
+static size_t g_responses = 0;
 
 struct MemoryStruct {
   char *memory;
@@ -106,6 +125,126 @@ static void onmessage(char *msg, size_t len, void *user_data, uint16_t sid) {
   printf("on message: %d %.*s", sid, (int)len, msg);
 }
 
+// The agent's voice goes to the speaker on a track of its own; the first
+// packet after the user stopped talking closes a response latency sample
+static void onaudiotrack(uint8_t *data, size_t size, void *userdata) {
+  (void)userdata;
+  uint64_t now = media_now_us();
+  nng_msg *msg;
+
+  uint64_t speech_end_us = atomic_exchange(&g_speech_end_us, 0);
+  if (speech_end_us) {
+    g_response_us[g_responses++ % AGENT_RESPONSE_SAMPLES] =
+        now - speech_end_us;
+    LOGI("agent: answered %llu ms after the end of speech",
+         (unsigned long long)(now - speech_end_us) / 1000);
+  }
+
+  if (nng_socket_id(g_agent_audio_pub_sock) == -1 ||
+      nng_msg_alloc(&msg, sizeof(media_frame_hdr_t) + size) != 0) {
+    return;
+  }
+  media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+  hdr->flags = (uint32_t)AUDIO_TRACK_AGENT << MEDIA_FRAME_TRACK_SHIFT;
+  hdr->seq = g_agent_audio_seq++;
+  hdr->pts_us = now;
+  memcpy(hdr + 1, data, size);
+  if (nng_sendmsg(g_agent_audio_pub_sock, msg, NNG_FLAG_NONBLOCK) != 0) {
+    nng_msg_free(msg);
+  }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Percentiles over the most recent responses
+static void agent_report_latency(void) {
+  uint64_t sorted[AGENT_RESPONSE_SAMPLES];
+  size_t n = g_responses < AGENT_RESPONSE_SAMPLES ? g_responses
+                                                   : AGENT_RESPONSE_SAMPLES;
+  if (n == 0) {
+    return;
+  }
+  memcpy(sorted, g_response_us, n * sizeof(uint64_t));
+  qsort(sorted, n, sizeof(uint64_t), cmp_u64);
+  LOGI("agent: %zu responses, end of speech to first audio p50 %llu ms, "
+       "p90 %llu ms, max %llu ms",
+       g_responses, (unsigned long long)sorted[n / 2] / 1000,
+       (unsigned long long)sorted[n * 90 / 100] / 1000,
+       (unsigned long long)sorted[n - 1] / 1000);
+}
+
+static int agent_dial(nng_socket *sock, const char *topic, int timeout_ms) {
+  int rv;
+  if ((rv = nng_sub0_open(sock)) != 0) {
+    LOGE("agent: nng_sub0_open: %s", nng_strerror(rv));
+    return -1;
+  }
+  nng_socket_set(*sock, NNG_OPT_SUB_SUBSCRIBE, "", 0);
+  nng_socket_set_ms(*sock, NNG_OPT_RECVTIMEO, timeout_ms);
+  if ((rv = nng_dial(*sock, topic, NULL, NNG_FLAG_NONBLOCK)) != 0) {
+    LOGE("agent: nng_dial %s: %s", topic, nng_strerror(rv));
+    nng_close(*sock);
+    return -1;
+  }
+  return 0;
+}
+
+// Mic frames go from the capture's encoder straight into the peer
+// connection, the nng message is the only copy; the VAD marks where the
+// user stopped talking for the response latency
+static void *agent_audio_task(void *data) {
+  (void)data;
+  nng_socket audio_sock;
+  nng_socket vad_sock;
+  bool speaking = false;
+
+  if (agent_dial(&audio_sock, TOPIC_AUDIO_COMPRESSED, AGENT_AUDIO_RECV_MS) <
+      0) {
+    return NULL;
+  }
+  if (agent_dial(&vad_sock, TOPIC_AUDIO_VAD, 0) < 0) {
+    nng_close(audio_sock);
+    return NULL;
+  }
+
+  while (!g_interrupted) {
+    nng_msg *msg;
+    if (nng_recvmsg(audio_sock, &msg, 0) == 0) {
+      size_t len = nng_msg_len(msg);
+      media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+      if (len > sizeof(*hdr) && g_state == PEER_CONNECTION_CONNECTED &&
+          media_now_us() - hdr->pts_us <= AGENT_AUDIO_LATE_US) {
+        peer_connection_send_audio(g_pc, (uint8_t *)(hdr + 1),
+                                   len - sizeof(*hdr));
+      }
+      nng_msg_free(msg);
+    }
+
+    audio_vad_msg_t vad;
+    size_t sz = sizeof(vad);
+    while (nng_recv(vad_sock, &vad, &sz, NNG_FLAG_NONBLOCK) == 0) {
+      if (sz == sizeof(vad)) {
+        if (speaking && !vad.speaking) {
+          // Not vad.pts_us, which trails the speech by the VAD hangover
+          atomic_store(&g_speech_end_us, vad.voiced_us);
+        } else if (vad.speaking) {
+          atomic_store(&g_speech_end_us, 0);
+        }
+        speaking = vad.speaking;
+      }
+      sz = sizeof(vad);
+    }
+  }
+
+  nng_close(audio_sock);
+  nng_close(vad_sock);
+  return NULL;
+}
+
 static void *peer_singaling_task(void *data) {
   while (!g_interrupted) {
     peer_signaling_loop();
@@ -143,13 +282,27 @@ int app_agent_main(void *args) {
 
   pthread_t peer_singaling_thread;
   pthread_t peer_connection_thread;
+  pthread_t audio_thread;
+  int rv;
 
   PeerConfiguration config = {.ice_servers =
                                   {
                                       {.urls = "stun:stun.l.google.com:19302"},
                                   },
                               .datachannel = DATA_CHANNEL_STRING,
-                              .audio_codec = CODEC_OPUS};
+                              .audio_codec = CODEC_OPUS,
+                              .onaudiotrack = onaudiotrack};
+
+  if ((rv = nng_pub0_open(&g_agent_audio_pub_sock)) != 0 ||
+      (rv = nng_listen(g_agent_audio_pub_sock, TOPIC_AUDIO_AGENT, NULL, 0)) !=
+          0) {
+    LOGE("agent: NNG publisher on %s: %s", TOPIC_AUDIO_AGENT,
+         nng_strerror(rv));
+    if (nng_socket_id(g_agent_audio_pub_sock) != -1) {
+      nng_close(g_agent_audio_pub_sock);
+      g_agent_audio_pub_sock.id = -1;
+    }
+  }
 
   peer_init();
   LOGI("Peer initialized");
@@ -159,6 +312,7 @@ int app_agent_main(void *args) {
 
   pthread_create(&peer_connection_thread, NULL, peer_connection_task, NULL);
   pthread_create(&peer_singaling_thread, NULL, peer_singaling_task, NULL);
+  pthread_create(&audio_thread, NULL, agent_audio_task, NULL);
 
   peer_signaling_connect(OPENAI_API_URL, openai_realtime_token, g_pc);
 
@@ -168,14 +322,20 @@ int app_agent_main(void *args) {
 
   pthread_join(peer_singaling_thread, NULL);
   pthread_join(peer_connection_thread, NULL);
+  pthread_join(audio_thread, NULL);
+  agent_report_latency();
 
   peer_signaling_disconnect();
   peer_connection_destroy(g_pc);
   peer_deinit();
+  if (nng_socket_id(g_agent_audio_pub_sock) != -1) {
+    nng_close(g_agent_audio_pub_sock);
+    g_agent_audio_pub_sock.id = -1;
+  }
 
   // Free allocated resources (OpenAI token, and AgentArgs members + struct)
   free(openai_realtime_token);
   return 0;
 }
 
-void app_agent_quit() {}
+void app_agent_quit() { g_interrupted = 1; }
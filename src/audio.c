@@ -1,11 +1,18 @@
 #include "audio.h"
+#include "jitter.h"
+#include "media.h"
 #include "utils.h" // For LOGE, LOGI
 
 #include <alsa/asoundlib.h>
 #include <opus/opus.h>
 #include <nng/nng.h>
 #include <nng/protocol/pubsub0/pub.h>
+#include <nng/protocol/pubsub0/sub.h>
 
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,95 +21,818 @@
 #include <stdbool.h>
 #include <unistd.h> // For usleep
 
-#define TOPIC_AUDIO_COMPRESSED "inproc://audio.compressed"
-#define MAX_FRAME_SIZE 6 * 48000 / 1000 * 2 // 6ms * 48kHz * 2 bytes/sample (stereo) * 2 (for safety)
+#define MAX_FRAME_SIZE 4000 // largest Opus packet worth producing, per libopus docs
+#define MAX_FRAME_MS 60
+#define DTX_PACKET_MAX 2 // DTX marks silent frames with packets this small
+#define POLL_TIMEOUT_MS 100
+#define PLAYBACK_IDLE_MS 5
+// Underruns are concealed only this soon after the last remote frame
+#define PLAYBACK_ACTIVE_US 200000
+#define PLAYBACK_TRACK_IDLE_US 5000000 // a quiet track is skipped after this
+#define OPUS_MAX_FRAME_SAMPLES (120 * 48000 / 1000)
+// While the VAD holds frames back one still goes out this often so the far
+// end keeps a background noise estimate, the way Opus DTX does
+#define VAD_CN_INTERVAL_MS 400
+#define VAD_REPEAT_US 1000000 // speaking state is resent for late subscribers
 
 static snd_pcm_t *g_alsa_handle = NULL;
 static OpusEncoder *g_opus_encoder = NULL;
 static nng_socket g_nng_audio_sock;
+static nng_socket g_nng_vad_sock;
+static nng_socket g_nng_raw_sock;
 static pthread_t g_audio_thread;
+static pthread_t g_playback_thread;
+static bool g_playback_started = false;
 static volatile bool g_running = false;
 
 // Audio parameters
+static AudioConfig g_config = {
+    .device = NULL,
+    .spk_device = NULL,
+    .period_ms = DEFAULT_PERIOD_MS,
+    .buffer_periods = DEFAULT_BUFFER_PERIODS,
+    .rt_priority = DEFAULT_RT_PRIORITY,
+    .dsp =
+        {
+            .highpass_hz = AUDIO_DSP_DEFAULT_HIGHPASS_HZ,
+            .agc = 1,
+            .agc_target_dbfs = AUDIO_DSP_DEFAULT_AGC_TARGET_DBFS,
+            .agc_max_gain_db = AUDIO_DSP_DEFAULT_AGC_MAX_GAIN_DB,
+            .vad = 0,
+            .vad_hangover_ms = AUDIO_DSP_DEFAULT_VAD_HANGOVER_MS,
+        },
+    .opus =
+        {
+            .bitrate = DEFAULT_BITRATE,
+            .vbr = 0,
+            .dtx = 0,
+            .fec = 0,
+            .frame_ms = DEFAULT_FRAME_SIZE_MS,
+            .complexity = DEFAULT_COMPLEXITY,
+            .budget_pct = DEFAULT_ENCODE_BUDGET_PCT,
+        },
+};
 static const char *g_audio_device = DEFAULT_AUDIO_DEVICE;
-static int g_sample_rate = DEFAULT_SAMPLE_RATE;
+static int g_sample_rate = DEFAULT_SAMPLE_RATE; // encoder rate
+static int g_capture_rate = DEFAULT_SAMPLE_RATE; // what the mic delivers
 static int g_channels = DEFAULT_CHANNELS;
 static int g_frame_size_ms = DEFAULT_FRAME_SIZE_MS;
-static int g_bitrate = DEFAULT_BITRATE;
 static int g_frame_size_samples; // Number of samples per frame
 static int g_frame_size_bytes;   // Number of bytes per frame
+static int g_capture_frame_samples; // the same frame at g_capture_rate
+static audio_dsp_t g_dsp;        // capture -> g_sample_rate, filtered
+static bool g_dsp_ready = false;
 
-static void *audio_capture_thread(void *arg) {
+// Encoder settings: app_audio_set_opus() leaves them in g_opus_pending and
+// the capture thread picks them up between frames
+static pthread_mutex_t g_opus_lock = PTHREAD_MUTEX_INITIALIZER;
+static AudioOpusConfig g_opus_pending;
+static atomic_bool g_opus_dirty;
+static atomic_int g_packet_loss_pct;
+static AudioOpusConfig g_opus;      // capture thread only
+static int g_packet_loss_applied = -1;
+static atomic_int g_complexity;     // current, at most g_opus.complexity
+static uint64_t g_encode_us;        // encode time over the current window
+static int g_encode_count;
+
+static atomic_ullong g_frames;
+static atomic_ullong g_silent;
+static atomic_ullong g_gated;
+static uint32_t g_audio_seq = 0;    // capture thread only
+static uint32_t g_raw_seq = 0;      // capture thread only
+static bool g_speaking = false;     // capture thread only
+static uint64_t g_vad_sent_us = 0;
+static uint64_t g_voiced_us = 0;    // capture thread only
+static int g_gated_ms = 0;          // since the last frame sent while gated
+static atomic_ullong g_overruns;
+static atomic_ullong g_played;
+static atomic_ullong g_concealed;
+static atomic_ullong g_underruns;
+
+// Remote audio: one jitter buffer -> Opus decoder -> FIFO per source (the
+// call and the agent), the FIFOs mixed into ALSA
+typedef struct {
+    bool open;            // decoder and FIFO allocated
+    bool idle;            // nothing for PLAYBACK_TRACK_IDLE_US, state dropped
+    jitter_buffer_t jb;
+    OpusDecoder *decoder;
+    int16_t *fifo;        // decoded and not mixed yet, fifo_capacity
+    int fifo_len;         // samples per channel
+    int frame_samples;    // duration of the last decoded packet
+    bool have_last;
+    uint64_t last_played_us;
+} audio_track_t;
+
+typedef struct {
+    snd_pcm_t *pcm;
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t buffer_size;
+    uint32_t render_us;   // from the mixer to the speaker
+    int16_t *pcm_buffer;  // OPUS_MAX_FRAME_SAMPLES per channel
+    int16_t *mix_buffer;  // fifo_capacity per channel
+    int fifo_capacity;    // samples per channel
+    audio_track_t tracks[MEDIA_FRAME_TRACKS];
+} audio_playback_t;
+
+void app_audio_set_config(const AudioConfig *config) {
+    g_config = *config;
+    if (g_config.device && g_config.device[0] != '\0') {
+        g_audio_device = g_config.device;
+    }
+}
+
+void app_audio_get_stats(AudioStats *stats) {
+    stats->frames = atomic_load(&g_frames);
+    stats->silent = atomic_load(&g_silent);
+    stats->gated = atomic_load(&g_gated);
+    stats->complexity = atomic_load(&g_complexity);
+    stats->overruns = atomic_load(&g_overruns);
+    stats->played = atomic_load(&g_played);
+    stats->concealed = atomic_load(&g_concealed);
+    stats->underruns = atomic_load(&g_underruns);
+}
+
+// S16 interleaved with g_channels at *rate, which receives the rate the
+// device settled on; periods of period_ms and a wakeup per period. The
+// stream starts once start_periods are queued, 0 leaves it to the caller
+static int audio_pcm_configure(snd_pcm_t *pcm, snd_pcm_access_t access,
+                               unsigned int *rate, int start_periods,
+                               snd_pcm_uframes_t *period_size,
+                               snd_pcm_uframes_t *buffer_size) {
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_sw_params_t *sw_params;
+    int err;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    snd_pcm_hw_params_any(pcm, hw_params);
+    if ((err = snd_pcm_hw_params_set_access(pcm, hw_params, access)) < 0) {
+        return err;
+    }
+    snd_pcm_hw_params_set_format(pcm, hw_params, SND_PCM_FORMAT_S16_LE); // Signed 16-bit Little Endian
+    snd_pcm_hw_params_set_channels(pcm, hw_params, g_channels);
+    snd_pcm_hw_params_set_rate_near(pcm, hw_params, rate, 0);
+
+    int period_ms = g_config.period_ms > 0 ? g_config.period_ms : DEFAULT_PERIOD_MS;
+    int periods = g_config.buffer_periods > 1 ? g_config.buffer_periods : DEFAULT_BUFFER_PERIODS;
+    *period_size = (*rate / 1000) * period_ms;
+    snd_pcm_hw_params_set_period_size_near(pcm, hw_params, period_size, 0);
+    *buffer_size = *period_size * periods;
+    snd_pcm_hw_params_set_buffer_size_near(pcm, hw_params, buffer_size);
+    if ((err = snd_pcm_hw_params(pcm, hw_params)) < 0) {
+        return err;
+    }
+    snd_pcm_hw_params_get_period_size(hw_params, period_size, 0);
+    snd_pcm_hw_params_get_buffer_size(hw_params, buffer_size);
+
+    snd_pcm_sw_params_alloca(&sw_params);
+    snd_pcm_sw_params_current(pcm, sw_params);
+    snd_pcm_sw_params_set_avail_min(pcm, sw_params, *period_size);
+    snd_pcm_sw_params_set_start_threshold(pcm, sw_params,
+                                          start_periods > 0 ? *period_size * start_periods
+                                                            : *buffer_size + 1);
+    if ((err = snd_pcm_sw_params(pcm, sw_params)) < 0) {
+        return err;
+    }
+    return snd_pcm_prepare(pcm);
+}
+
+// Run the calling thread under SCHED_FIFO so capture keeps its deadline when
+// the encoders load the CPU; needs CAP_SYS_NICE or an rtprio limit
+static void audio_set_realtime(const char *name, int priority) {
+    struct sched_param param;
     int rv;
-    int opus_encode_error;
-    int buffer_size;
-    
-    // Calculate frame size in samples and bytes
+
+    if (priority <= 0) {
+        return;
+    }
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    if ((rv = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0) {
+        LOGW("%s: SCHED_FIFO %d not permitted: %s", name, priority, strerror(rv));
+    } else {
+        LOGI("%s: running SCHED_FIFO priority %d", name, priority);
+    }
+}
+
+// Recover from an xrun or suspend and restart the stream
+static int audio_capture_recover(snd_pcm_t *pcm, int err) {
+    if (err == -EPIPE) {
+        unsigned long long n = atomic_fetch_add(&g_overruns, 1) + 1;
+        LOGW("audio_capture_thread: ALSA overrun (%llu so far)", n);
+    }
+    if ((err = snd_pcm_recover(pcm, err, 1)) < 0) {
+        return err;
+    }
+    // A resumed stream is running already, a prepared one needs a start
+    if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED) {
+        return snd_pcm_start(pcm);
+    }
+    return 0;
+}
+
+void app_audio_set_opus(const AudioOpusConfig *opus) {
+    pthread_mutex_lock(&g_opus_lock);
+    g_opus_pending = *opus;
+    atomic_store(&g_opus_dirty, true);
+    pthread_mutex_unlock(&g_opus_lock);
+}
+
+void app_audio_set_packet_loss(int percent) {
+    atomic_store(&g_packet_loss_pct, percent < 0 ? 0 : percent > 100 ? 100 : percent);
+}
+
+static void audio_opus_sanitize(AudioOpusConfig *opus) {
+    if (opus->frame_ms != 10 && opus->frame_ms != 20 && opus->frame_ms != 40 &&
+        opus->frame_ms != MAX_FRAME_MS) {
+        LOGW("audio: unsupported Opus frame size %d ms, using %d", opus->frame_ms,
+             DEFAULT_FRAME_SIZE_MS);
+        opus->frame_ms = DEFAULT_FRAME_SIZE_MS;
+    }
+    if (opus->bitrate < 6000 || opus->bitrate > 510000) {
+        opus->bitrate = DEFAULT_BITRATE;
+    }
+    if (opus->complexity < 0 || opus->complexity > 10) {
+        opus->complexity = DEFAULT_COMPLEXITY;
+    }
+}
+
+// Push settings into the encoder; only between frames, frame_ms changes the
+// accumulator size
+static void audio_encoder_apply(const AudioOpusConfig *opus) {
+    g_opus = *opus;
+    audio_opus_sanitize(&g_opus);
+    opus_encoder_ctl(g_opus_encoder, OPUS_SET_BITRATE(g_opus.bitrate));
+    opus_encoder_ctl(g_opus_encoder, OPUS_SET_VBR(g_opus.vbr ? 1 : 0));
+    opus_encoder_ctl(g_opus_encoder, OPUS_SET_DTX(g_opus.dtx ? 1 : 0));
+    opus_encoder_ctl(g_opus_encoder, OPUS_SET_INBAND_FEC(g_opus.fec ? 1 : 0));
+    opus_encoder_ctl(g_opus_encoder, OPUS_SET_COMPLEXITY(g_opus.complexity));
+    atomic_store(&g_complexity, g_opus.complexity);
+    app_audio_set_packet_loss(g_opus.loss_pct);
+    g_encode_us = 0;
+    g_encode_count = 0;
+
+    g_frame_size_ms = g_opus.frame_ms;
     g_frame_size_samples = (g_sample_rate / 1000) * g_frame_size_ms;
     g_frame_size_bytes = g_frame_size_samples * g_channels * sizeof(int16_t);
+    g_capture_frame_samples = g_capture_rate * g_frame_size_ms / 1000;
+    LOGI("audio: Opus %d bps %s%s%s, %d ms frames, complexity %d",
+         g_opus.bitrate, g_opus.vbr ? "VBR" : "CBR", g_opus.dtx ? " DTX" : "",
+         g_opus.fec ? " FEC" : "", g_frame_size_ms, g_opus.complexity);
+    if (g_opus.fec && g_opus.loss_pct <= 0) {
+        LOGW("audio: FEC needs an expected loss_pct, none is sent at 0%%");
+    }
+}
 
-    int16_t *pcm_buffer = (int16_t *)malloc(g_frame_size_bytes);
-    if (!pcm_buffer) {
-        LOGE("audio_capture_thread: Failed to allocate PCM buffer.");
-        g_running = false;
-        return NULL;
+// Called with an empty accumulator
+static void audio_encoder_update(void) {
+    if (atomic_load(&g_opus_dirty)) {
+        AudioOpusConfig opus;
+        pthread_mutex_lock(&g_opus_lock);
+        opus = g_opus_pending;
+        atomic_store(&g_opus_dirty, false);
+        pthread_mutex_unlock(&g_opus_lock);
+        audio_encoder_apply(&opus);
+    }
+    int loss = atomic_load(&g_packet_loss_pct);
+    if (loss != g_packet_loss_applied) {
+        opus_encoder_ctl(g_opus_encoder, OPUS_SET_PACKET_LOSS_PERC(loss));
+        g_packet_loss_applied = loss;
+    }
+}
+
+// Once a second compare the average encode time with the budget: step the
+// complexity down while over it, back up while well under it
+static void audio_encoder_budget(uint64_t spent_us) {
+    if (g_opus.budget_pct <= 0) {
+        return;
+    }
+    g_encode_us += spent_us;
+    if (++g_encode_count < 1000 / g_frame_size_ms) {
+        return;
+    }
+    uint64_t avg_us = g_encode_us / g_encode_count;
+    uint64_t budget_us = (uint64_t)g_frame_size_ms * 1000 * g_opus.budget_pct / 100;
+    int complexity = atomic_load(&g_complexity);
+    g_encode_us = 0;
+    g_encode_count = 0;
+
+    if (avg_us > budget_us && complexity > 0) {
+        complexity--;
+    } else if (avg_us < budget_us / 2 && complexity < g_opus.complexity) {
+        complexity++;
+    } else {
+        return;
+    }
+    opus_encoder_ctl(g_opus_encoder, OPUS_SET_COMPLEXITY(complexity));
+    atomic_store(&g_complexity, complexity);
+    LOGI("audio: encode %llu us per frame, budget %llu us, complexity %d",
+         (unsigned long long)avg_us, (unsigned long long)budget_us, complexity);
+}
+
+// Speaking state on TOPIC_AUDIO_VAD, on every change and once a second
+static void audio_vad_publish(uint64_t now_us) {
+    bool speaking = g_dsp.voice;
+    if (speaking == g_speaking && now_us - g_vad_sent_us < VAD_REPEAT_US) {
+        return;
+    }
+    audio_vad_msg_t vad = {
+        .speaking = speaking,
+        .level_db = (int32_t)g_dsp.level_db,
+        .pts_us = now_us,
+        .voiced_us = g_voiced_us,
+    };
+    int rv = nng_send(g_nng_vad_sock, &vad, sizeof(vad), NNG_FLAG_NONBLOCK);
+    if (rv != 0) {
+        LOGW("audio_capture_thread: nng_send vad error: %s", nng_strerror(rv));
+    }
+    if (speaking != g_speaking) {
+        LOGD("audio: %s at %d dBFS", speaking ? "speaking" : "silent", vad.level_db);
+    }
+    g_speaking = speaking;
+    g_vad_sent_us = now_us;
+}
+
+// Processed PCM on TOPIC_AUDIO_RAW; every frame goes out, the VAD only
+// gates the encoder
+static void audio_raw_publish(const int16_t *pcm, uint64_t pts_us) {
+    size_t size = (size_t)g_frame_size_samples * g_channels * sizeof(int16_t);
+    nng_msg *msg;
+    int rv;
+    if ((rv = nng_msg_alloc(&msg, sizeof(media_frame_hdr_t) + size)) != 0) {
+        LOGE("audio_capture_thread: nng_msg_alloc error: %s", nng_strerror(rv));
+        return;
+    }
+    media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+    hdr->flags = 0;
+    hdr->seq = g_raw_seq++;
+    hdr->pts_us = pts_us;
+    memcpy(hdr + 1, pcm, size);
+    if ((rv = nng_sendmsg(g_nng_raw_sock, msg, NNG_FLAG_NONBLOCK)) != 0) {
+        LOGW("audio_capture_thread: nng_sendmsg raw error: %s", nng_strerror(rv));
+        nng_msg_free(msg);
+    }
+}
+
+// Run one complete captured frame through the DSP stage in place, publish
+// it raw, then encode and publish it unless the VAD holds it back; pts_us is
+// the capture time of its first sample
+static int audio_publish_frame(int16_t *pcm, uint8_t *opus_buffer, uint64_t pts_us) {
+    int rv;
+    int frames = audio_dsp_process(&g_dsp, pcm, g_capture_frame_samples);
+    if (frames != g_frame_size_samples) {
+        LOGW("audio_capture_thread: DSP produced %d samples, expected %d", frames,
+             g_frame_size_samples);
+        return 0;
+    }
+
+    audio_raw_publish(pcm, pts_us);
+
+    // A bypassed DSP stage has no voice decision to report
+    if (!g_dsp.bypass) {
+        if (g_dsp.voiced) {
+            g_voiced_us = pts_us + (uint64_t)g_frame_size_ms * 1000;
+        }
+        audio_vad_publish(media_now_us());
+    }
+    if (g_config.dsp.vad && !g_dsp.voice) {
+        g_gated_ms += g_frame_size_ms;
+        if (g_gated_ms < VAD_CN_INTERVAL_MS) {
+            atomic_fetch_add(&g_gated, 1);
+            return 0;
+        }
+        g_gated_ms = 0;
+    } else {
+        g_gated_ms = 0;
     }
 
+    uint64_t start_us = media_now_us();
+    int opus_len = opus_encode(g_opus_encoder, pcm, g_frame_size_samples,
+                               opus_buffer, MAX_FRAME_SIZE);
+    if (opus_len < 0) {
+        LOGE("audio_capture_thread: Opus encode error: %s", opus_strerror(opus_len));
+        return -1;
+    }
+    audio_encoder_budget(media_now_us() - start_us);
+
+    // The decoder side fills the gaps with comfort noise
+    if (g_opus.dtx && opus_len <= DTX_PACKET_MAX) {
+        atomic_fetch_add(&g_silent, 1);
+        return 0;
+    }
+
+    nng_msg *msg;
+    if ((rv = nng_msg_alloc(&msg, sizeof(media_frame_hdr_t) + opus_len)) != 0) {
+        LOGE("audio_capture_thread: nng_msg_alloc error: %s", nng_strerror(rv));
+        return -1;
+    }
+    media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+    hdr->flags = 0;
+    hdr->seq = g_audio_seq++;
+    hdr->pts_us = pts_us;
+    memcpy(hdr + 1, opus_buffer, opus_len);
+
+    if ((rv = nng_sendmsg(g_nng_audio_sock, msg, 0)) != 0) {
+        LOGE("audio_capture_thread: nng_sendmsg error: %s", nng_strerror(rv));
+        nng_msg_free(msg);
+        return -1;
+    }
+    atomic_fetch_add(&g_frames, 1);
+    return 0;
+}
+
+// Wait for whole periods with poll(), copy them straight out of the mmap
+// ring into a frame accumulator and encode every time a frame fills up
+static void *audio_capture_thread(void *arg) {
+    (void)arg;
+    int err = 0;
+    int frame_fill = 0; // samples per channel in pcm_buffer
+    uint64_t frame_pts_us = 0;
+
+    audio_set_realtime("audio_capture_thread", g_config.rt_priority);
+
+    // Room for the longest frame so frame_ms can change on the fly, at
+    // whichever of the two rates is higher since the DSP works in place
+    int max_rate = g_capture_rate > g_sample_rate ? g_capture_rate : g_sample_rate;
+    int16_t *pcm_buffer = (int16_t *)malloc(max_rate * MAX_FRAME_MS / 1000 *
+                                            g_channels * sizeof(int16_t));
     uint8_t *opus_buffer = (uint8_t *)malloc(MAX_FRAME_SIZE);
-    if (!opus_buffer) {
-        LOGE("audio_capture_thread: Failed to allocate Opus buffer.");
+    int nfds = snd_pcm_poll_descriptors_count(g_alsa_handle);
+    struct pollfd *pfds = nfds > 0 ? (struct pollfd *)calloc(nfds, sizeof(*pfds)) : NULL;
+    if (!pcm_buffer || !opus_buffer || !pfds) {
+        LOGE("audio_capture_thread: Failed to allocate capture buffers.");
         free(pcm_buffer);
+        free(opus_buffer);
+        free(pfds);
         g_running = false;
         return NULL;
     }
+    snd_pcm_poll_descriptors(g_alsa_handle, pfds, nfds);
 
     LOGI("Audio capture thread started. Device: %s, Rate: %d, Ch: %d, Frame_ms: %d, Bitrate: %d",
-         g_audio_device, g_sample_rate, g_channels, g_frame_size_ms, g_bitrate);
+         g_audio_device, g_capture_rate, g_channels, g_frame_size_ms, g_opus.bitrate);
+
+    if ((err = snd_pcm_start(g_alsa_handle)) < 0) {
+        LOGE("audio_capture_thread: Cannot start ALSA capture: %s", snd_strerror(err));
+        g_running = false;
+    }
 
     while (g_running) {
-        // Read PCM data from ALSA
-        rv = snd_pcm_readi(g_alsa_handle, pcm_buffer, g_frame_size_samples);
-        if (rv == -EPIPE) {
-            // EPIPE means overrun
-            LOGW("audio_capture_thread: ALSA overrun, attempting to recover.");
-            snd_pcm_prepare(g_alsa_handle);
-            continue;
-        } else if (rv < 0) {
-            LOGE("audio_capture_thread: Error from ALSA read: %s", snd_strerror(rv));
+        unsigned short revents = 0;
+        if (poll(pfds, nfds, POLL_TIMEOUT_MS) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("audio_capture_thread: poll error: %s", strerror(errno));
             break;
-        } else if (rv != g_frame_size_samples) {
-            LOGW("audio_capture_thread: Short read from ALSA, expected %d samples, got %d",
-                 g_frame_size_samples, rv);
-            // Optionally, fill remaining buffer with zeros or handle as needed.
+        }
+        snd_pcm_poll_descriptors_revents(g_alsa_handle, pfds, nfds, &revents);
+        if (!(revents & (POLLIN | POLLERR))) {
+            continue;
         }
 
-        // Encode PCM data to Opus
-        int opus_len = opus_encode(g_opus_encoder, pcm_buffer, g_frame_size_samples,
-                                   opus_buffer, MAX_FRAME_SIZE);
-        if (opus_len < 0) {
-            LOGE("audio_capture_thread: Opus encode error: %s", opus_strerror(opus_len));
-            break;
+        // Negative on xrun or suspend, which POLLERR signals
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(g_alsa_handle);
+        uint64_t now_us = media_now_us();
+        while (avail > 0) {
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset;
+            if (frame_fill == 0) {
+                audio_encoder_update();
+                // The oldest of the avail samples waiting in the ring
+                frame_pts_us = now_us - (uint64_t)avail * 1000000 / g_capture_rate;
+            }
+            snd_pcm_uframes_t frames = g_capture_frame_samples - frame_fill;
+            if (frames > (snd_pcm_uframes_t)avail) {
+                frames = avail;
+            }
+            if ((err = snd_pcm_mmap_begin(g_alsa_handle, &areas, &offset, &frames)) < 0) {
+                avail = err;
+                break;
+            }
+
+            // Interleaved: every channel shares areas[0] with a frame stride
+            const uint8_t *src = (const uint8_t *)areas[0].addr +
+                                 areas[0].first / 8 + offset * (areas[0].step / 8);
+            memcpy(pcm_buffer + frame_fill * g_channels, src,
+                   frames * g_channels * sizeof(int16_t));
+
+            snd_pcm_sframes_t committed = snd_pcm_mmap_commit(g_alsa_handle, offset, frames);
+            if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+                avail = committed < 0 ? committed : -EPIPE;
+                break;
+            }
+            frame_fill += frames;
+            avail -= frames;
+
+            if (frame_fill == g_capture_frame_samples) {
+                frame_fill = 0;
+                if (audio_publish_frame(pcm_buffer, opus_buffer, frame_pts_us) != 0) {
+                    g_running = false;
+                    break;
+                }
+            }
+        }
+
+        if (avail < 0) {
+            // The samples around an xrun are gone, start a fresh frame
+            frame_fill = 0;
+            if ((err = audio_capture_recover(g_alsa_handle, avail)) < 0) {
+                LOGE("audio_capture_thread: Error from ALSA read: %s", snd_strerror(err));
+                break;
+            }
+        }
+    }
+
+    LOGI("Audio capture thread stopped, %llu frames, %llu overruns.",
+         (unsigned long long)atomic_load(&g_frames),
+         (unsigned long long)atomic_load(&g_overruns));
+    free(pcm_buffer);
+    free(opus_buffer);
+    free(pfds);
+    return NULL;
+}
+
+// Queue samples for the mixer; a full FIFO means playback is running
+// behind, so the rest is dropped instead of adding latency
+static void audio_track_write(audio_playback_t *pb, audio_track_t *t, const int16_t *pcm,
+                              int samples) {
+    int room = pb->fifo_capacity - t->fifo_len;
+    if (samples > room) {
+        samples = room;
+    }
+    memcpy(t->fifo + t->fifo_len * g_channels, pcm, samples * g_channels * sizeof(int16_t));
+    t->fifo_len += samples;
+}
+
+// Packet loss concealment for one frame
+static void audio_track_conceal(audio_playback_t *pb, audio_track_t *t) {
+    int n = opus_decode(t->decoder, NULL, 0, pb->pcm_buffer, t->frame_samples, 0);
+    if (n > 0) {
+        audio_track_write(pb, t, pb->pcm_buffer, n);
+        atomic_fetch_add(&g_concealed, 1);
+    }
+}
+
+// Decode one frame from the track's jitter buffer. Its seq counts arrivals,
+// not RTP packets, so network loss leaves no gap to rebuild from FEC; a lost
+// frame shows up as an underrun and is concealed by the mixer
+static void audio_track_frame(audio_playback_t *pb, audio_track_t *t, nng_msg *msg) {
+    const uint8_t *data = (const uint8_t *)nng_msg_body(msg) + sizeof(media_frame_hdr_t);
+    int len = nng_msg_len(msg) - sizeof(media_frame_hdr_t);
+
+    int n = opus_decode(t->decoder, data, len, pb->pcm_buffer, OPUS_MAX_FRAME_SAMPLES, 0);
+    if (n < 0) {
+        LOGW("audio_playback_thread: Opus decode error: %s", opus_strerror(n));
+        audio_track_conceal(pb, t);
+    } else {
+        audio_track_write(pb, t, pb->pcm_buffer, n);
+        t->frame_samples = n;
+        atomic_fetch_add(&g_played, 1);
+    }
+    t->have_last = true;
+    t->last_played_us = media_now_us();
+}
+
+// A track's decoder and FIFO are allocated when it first shows up and kept
+// for as long as the thread runs, so a returning talker costs nothing
+static audio_track_t *audio_track_get(audio_playback_t *pb, int id) {
+    audio_track_t *t = &pb->tracks[id];
+    int err;
+
+    if (!t->open) {
+        t->decoder = opus_decoder_create(g_sample_rate, g_channels, &err);
+        t->fifo = (int16_t *)malloc(pb->fifo_capacity * g_channels * sizeof(int16_t));
+        if (err != OPUS_OK || !t->fifo) {
+            LOGE("audio_playback_thread: Cannot open track %d: %s", id, opus_strerror(err));
+            if (t->decoder) {
+                opus_decoder_destroy(t->decoder);
+                t->decoder = NULL;
+            }
+            free(t->fifo);
+            t->fifo = NULL;
+            return NULL;
+        }
+        jitter_init(&t->jb, DEFAULT_FRAME_SIZE_MS * 1000,
+                    JITTER_DEFAULT_MIN_DELAY_US, JITTER_DEFAULT_MAX_DELAY_US);
+        // The call's own audio keeps in step with its video
+        if (id == AUDIO_TRACK_CALL) {
+            jitter_set_sync(&t->jb, &jitter_call_sync, JITTER_STREAM_AUDIO, pb->render_us);
+        }
+        t->open = true;
+        t->idle = true;
+        LOGI("audio_playback_thread: track %d opened", id);
+    }
+    if (t->idle) {
+        opus_decoder_ctl(t->decoder, OPUS_RESET_STATE);
+        t->frame_samples = (g_sample_rate / 1000) * DEFAULT_FRAME_SIZE_MS;
+        t->have_last = false;
+        t->idle = false;
+    }
+    return t;
+}
+
+// Tracks that went quiet give up their buffered state; the mixer skips them
+// until they send again
+static void audio_track_expire(audio_track_t *t, uint64_t now_us) {
+    if (!t->idle && t->jb.count == 0 && t->fifo_len == 0 &&
+        now_us - t->last_played_us > PLAYBACK_TRACK_IDLE_US) {
+        jitter_reset(&t->jb);
+        t->idle = true;
+    }
+}
+
+// Write the device's ALSA ring from the track FIFOs, only as far as every
+// talking track has samples so none of them gets silence spliced in. Short
+// of a period queued, talkers whose packets are merely late get a
+// concealment frame instead of an underrun; otherwise it waits for a whole
+// period
+static void audio_playback_mix(audio_playback_t *pb, uint64_t now_us) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(pb->pcm);
+    if (avail < 0) {
+        if (avail == -EPIPE) {
+            atomic_fetch_add(&g_underruns, 1);
+        }
+        if (snd_pcm_recover(pb->pcm, avail, 1) < 0) {
+            LOGE("audio_playback_thread: ALSA error: %s", snd_strerror(avail));
+        }
+        return;
+    }
+    bool running = snd_pcm_state(pb->pcm) == SND_PCM_STATE_RUNNING;
+    bool starving = running && pb->buffer_size - avail < pb->period_size;
+    bool mixing[MEDIA_FRAME_TRACKS] = {false};
+    int frames = -1;
+
+    for (int i = 0; i < MEDIA_FRAME_TRACKS; i++) {
+        audio_track_t *t = &pb->tracks[i];
+        if (!t->open || t->idle) {
+            continue;
+        }
+        // A track that just sent is still talking and is waited for; one
+        // that stopped longer ago no longer holds the others back
+        bool talking = t->have_last && now_us - t->last_played_us <= PLAYBACK_ACTIVE_US;
+        if (starving && talking && t->fifo_len < (int)pb->period_size) {
+            audio_track_conceal(pb, t);
+        }
+        if (t->fifo_len == 0 && !talking) {
+            continue;
+        }
+        mixing[i] = true;
+        if (frames < 0 || t->fifo_len < frames) {
+            frames = t->fifo_len;
+        }
+    }
+    if (frames <= 0 || (frames < (int)pb->period_size && running && !starving)) {
+        return;
+    }
+    if (frames > avail) {
+        frames = avail;
+    }
+
+    bool first = true;
+    for (int i = 0; i < MEDIA_FRAME_TRACKS; i++) {
+        audio_track_t *t = &pb->tracks[i];
+        if (!mixing[i]) {
+            continue;
         }
+        if (first) {
+            memcpy(pb->mix_buffer, t->fifo, frames * g_channels * sizeof(int16_t));
+            first = false;
+        } else {
+            audio_dsp_mix(pb->mix_buffer, t->fifo, frames * g_channels);
+        }
+        t->fifo_len -= frames;
+        memmove(t->fifo, t->fifo + frames * g_channels, t->fifo_len * g_channels * sizeof(int16_t));
+    }
+
+    const int16_t *pcm = pb->mix_buffer;
+    while (frames > 0) {
+        snd_pcm_sframes_t n = snd_pcm_writei(pb->pcm, pcm, frames);
+        if (n == -EAGAIN) {
+            return;
+        } else if (n < 0) {
+            if (n == -EPIPE) {
+                atomic_fetch_add(&g_underruns, 1);
+            }
+            if (snd_pcm_recover(pb->pcm, n, 1) < 0) {
+                LOGE("audio_playback_thread: ALSA write error: %s", snd_strerror(n));
+                return;
+            }
+            continue;
+        }
+        pcm += n * g_channels;
+        frames -= n;
+    }
+}
 
-        // Publish Opus data via NNG
+static void *audio_playback_thread(void *arg) {
+    (void)arg;
+    const char *device = g_config.spk_device && g_config.spk_device[0] != '\0'
+                             ? g_config.spk_device
+                             : g_audio_device;
+    audio_playback_t pb;
+    nng_socket sock = {.id = -1};
+    int err;
+
+    memset(&pb, 0, sizeof(pb));
+    audio_set_realtime("audio_playback_thread", g_config.rt_priority);
+
+    if ((err = snd_pcm_open(&pb.pcm, device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK)) < 0) {
+        LOGE("audio_playback_thread: Cannot open audio device %s: %s", device, snd_strerror(err));
+        return NULL;
+    }
+    // Start as soon as two periods are queued; the decoder output is not
+    // resampled, so the device has to take the capture rate
+    unsigned int rate = g_sample_rate;
+    if ((err = audio_pcm_configure(pb.pcm, SND_PCM_ACCESS_RW_INTERLEAVED, &rate, 2,
+                                   &pb.period_size, &pb.buffer_size)) < 0 ||
+        (int)rate != g_sample_rate) {
+        LOGE("audio_playback_thread: Cannot configure %s for %d Hz: %s", device, g_sample_rate,
+             err < 0 ? snd_strerror(err) : "rate not supported");
+        snd_pcm_close(pb.pcm);
+        return NULL;
+    }
+    // Mixed frames wait behind the two periods the device starts with
+    pb.render_us = (uint32_t)(2 * pb.period_size * 1000000 / g_sample_rate);
+
+    // A FIFO takes the longest Opus packet plus what is waiting on the device
+    pb.fifo_capacity = OPUS_MAX_FRAME_SAMPLES + pb.period_size;
+    pb.pcm_buffer = (int16_t *)malloc(OPUS_MAX_FRAME_SAMPLES * g_channels * sizeof(int16_t));
+    pb.mix_buffer = (int16_t *)malloc(pb.fifo_capacity * g_channels * sizeof(int16_t));
+    if (!pb.pcm_buffer || !pb.mix_buffer) {
+        LOGE("audio_playback_thread: Failed to allocate playback buffers.");
+        goto out;
+    }
+
+    if ((err = nng_sub0_open(&sock)) != 0) {
+        LOGE("audio_playback_thread: nng_sub0_open error: %s", nng_strerror(err));
+        goto out;
+    }
+    nng_socket_set_string(sock, NNG_OPT_SUB_SUBSCRIBE, "");
+    nng_socket_set_ms(sock, NNG_OPT_RECVTIMEO, PLAYBACK_IDLE_MS);
+    if ((err = nng_dial(sock, TOPIC_AUDIO_WEBRTC, NULL, NNG_FLAG_NONBLOCK)) != 0) {
+        LOGE("audio_playback_thread: nng_dial error: %s", nng_strerror(err));
+        goto out;
+    }
+    // The agent talks on a track of its own, the call goes on without it
+    if ((err = nng_dial(sock, TOPIC_AUDIO_AGENT, NULL, NNG_FLAG_NONBLOCK)) != 0) {
+        LOGW("audio_playback_thread: nng_dial %s error: %s", TOPIC_AUDIO_AGENT,
+             nng_strerror(err));
+    }
+
+    LOGI("Audio playback thread started. Device: %s, period %lu frames, buffer %lu frames",
+         device, pb.period_size, pb.buffer_size);
+    while (g_running) {
         nng_msg *msg;
-        if ((rv = nng_msg_alloc(&msg, opus_len)) != 0) {
-            LOGE("audio_capture_thread: nng_msg_alloc error: %s", nng_strerror(rv));
+        err = nng_recvmsg(sock, &msg, 0);
+        uint64_t now = media_now_us();
+        if (err == 0) {
+            media_frame_hdr_t hdr;
+            audio_track_t *t = NULL;
+            if (nng_msg_len(msg) >= sizeof(hdr)) {
+                memcpy(&hdr, nng_msg_body(msg), sizeof(hdr));
+                t = audio_track_get(&pb, media_frame_track(&hdr));
+            }
+            if (t) {
+                jitter_push(&t->jb, msg, now);
+            } else {
+                nng_msg_free(msg);
+            }
+        } else if (err != NNG_ETIMEDOUT && err != NNG_EAGAIN) {
             break;
         }
-        memcpy(nng_msg_body(msg), opus_buffer, opus_len);
 
-        if ((rv = nng_sendmsg(g_nng_audio_sock, msg, 0)) != 0) {
-            LOGE("audio_capture_thread: nng_sendmsg error: %s", nng_strerror(rv));
-            nng_msg_free(msg);
-            break;
+        for (int i = 0; i < MEDIA_FRAME_TRACKS; i++) {
+            audio_track_t *t = &pb.tracks[i];
+            if (!t->open) {
+                continue;
+            }
+            while ((msg = jitter_pop(&t->jb, now)) != NULL) {
+                audio_track_frame(&pb, t, msg);
+                nng_msg_free(msg);
+            }
+            audio_track_expire(t, now);
         }
-        // LOGD("Sent Opus packet of size %d", opus_len); // For debugging, enable if needed
+        audio_playback_mix(&pb, now);
     }
 
-    LOGI("Audio capture thread stopped.");
-    free(pcm_buffer);
-    free(opus_buffer);
+out:
+    for (int i = 0; i < MEDIA_FRAME_TRACKS; i++) {
+        audio_track_t *t = &pb.tracks[i];
+        if (!t->open) {
+            continue;
+        }
+        LOGI("audio_playback_thread: track %d played %u late %u lost %u stalled %u", i,
+             t->jb.played, t->jb.late, t->jb.lost, t->jb.stall);
+        jitter_reset(&t->jb);
+        opus_decoder_destroy(t->decoder);
+        free(t->fifo);
+    }
+    if (nng_socket_id(sock) != -1) {
+        nng_close(sock);
+    }
+    free(pb.pcm_buffer);
+    free(pb.mix_buffer);
+    snd_pcm_close(pb.pcm);
     return NULL;
 }
 
@@ -112,40 +842,36 @@ int app_audio_main(void *arg) {
     int err;
 
     // ALSA Initialization
-    snd_pcm_hw_params_t *hw_params;
-    if ((err = snd_pcm_open(&g_alsa_handle, g_audio_device, SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t buffer_size;
+    if ((err = snd_pcm_open(&g_alsa_handle, g_audio_device, SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK)) < 0) {
         LOGE("app_audio_main: Cannot open audio device %s: %s", g_audio_device, snd_strerror(err));
         return 1;
     }
 
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(g_alsa_handle, hw_params);
-
-    snd_pcm_hw_params_set_access(g_alsa_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(g_alsa_handle, hw_params, SND_PCM_FORMAT_S16_LE); // Signed 16-bit Little Endian
-    snd_pcm_hw_params_set_channels(g_alsa_handle, hw_params, g_channels);
+    // The capture thread starts the stream itself
     unsigned int actual_rate = g_sample_rate;
-    snd_pcm_hw_params_set_rate_near(g_alsa_handle, hw_params, &actual_rate, 0);
-    if (actual_rate != g_sample_rate) {
-        LOGW("app_audio_main: Sample rate mismatch. Requested %d, got %d", g_sample_rate, actual_rate);
-        g_sample_rate = actual_rate;
-    }
-
-    snd_pcm_uframes_t period_size = (g_sample_rate / 1000) * g_frame_size_ms;
-    snd_pcm_hw_params_set_period_size_near(g_alsa_handle, hw_params, &period_size, 0);
-    LOGI("app_audio_main: ALSA period size set to %lu frames", period_size);
-
-    if ((err = snd_pcm_hw_params(g_alsa_handle, hw_params)) < 0) {
-        LOGE("app_audio_main: Cannot set ALSA hardware parameters: %s", snd_strerror(err));
+    if ((err = audio_pcm_configure(g_alsa_handle, SND_PCM_ACCESS_MMAP_INTERLEAVED, &actual_rate, 0,
+                                   &period_size, &buffer_size)) < 0) {
+        LOGE("app_audio_main: Cannot configure %s for mmap capture: %s", g_audio_device, snd_strerror(err));
         app_audio_quit(); // Use new quit function for cleanup
         return 1;
     }
-
-    if ((err = snd_pcm_prepare(g_alsa_handle)) < 0) {
-        LOGE("app_audio_main: Cannot prepare ALSA audio interface: %s", snd_strerror(err));
-        app_audio_quit(); // Use new quit function for cleanup
+    // Opus stays at g_sample_rate; the DSP stage resamples whatever the
+    // device settled on
+    if ((int)actual_rate != g_sample_rate) {
+        LOGW("app_audio_main: Sample rate mismatch. Requested %d, got %u, resampling",
+             g_sample_rate, actual_rate);
+    }
+    g_capture_rate = actual_rate;
+    if (audio_dsp_init(&g_dsp, &g_config.dsp, g_capture_rate, g_sample_rate, g_channels,
+                       g_capture_rate * MAX_FRAME_MS / 1000) != 0) {
+        LOGE("app_audio_main: Cannot process %d Hz capture", g_capture_rate);
+        app_audio_quit();
         return 1;
     }
+    g_dsp_ready = true;
+    LOGI("app_audio_main: ALSA period %lu frames, buffer %lu frames", period_size, buffer_size);
 
     LOGI("app_audio_main: ALSA initialized successfully.");
 
@@ -157,9 +883,7 @@ int app_audio_main(void *arg) {
         app_audio_quit(); // Use new quit function for cleanup
         return 1;
     }
-    opus_encoder_ctl(g_opus_encoder, OPUS_SET_BITRATE(g_bitrate));
-    opus_encoder_ctl(g_opus_encoder, OPUS_SET_VBR(0)); // Constant Bit Rate
-    opus_encoder_ctl(g_opus_encoder, OPUS_SET_COMPLEXITY(10)); // Max complexity
+    audio_encoder_apply(&g_config.opus);
 
     LOGI("app_audio_main: Opus encoder initialized successfully.");
 
@@ -177,6 +901,22 @@ int app_audio_main(void *arg) {
     }
     LOGI("app_audio_main: NNG audio publisher initialized on %s.", TOPIC_AUDIO_COMPRESSED);
 
+    if ((err = nng_pub0_open(&g_nng_vad_sock)) != 0 ||
+        (err = nng_listen(g_nng_vad_sock, TOPIC_AUDIO_VAD, NULL, 0)) != 0) {
+        LOGE("app_audio_main: NNG publisher on %s: %s", TOPIC_AUDIO_VAD, nng_strerror(err));
+        app_audio_quit();
+        return 1;
+    }
+
+    // One capture and one encode for every consumer: the meeting and the
+    // agent subscribe to the compressed topic, PCM consumers to the raw one
+    if ((err = nng_pub0_open(&g_nng_raw_sock)) != 0 ||
+        (err = nng_listen(g_nng_raw_sock, TOPIC_AUDIO_RAW, NULL, 0)) != 0) {
+        LOGE("app_audio_main: NNG publisher on %s: %s", TOPIC_AUDIO_RAW, nng_strerror(err));
+        app_audio_quit();
+        return 1;
+    }
+
     // Start audio capture thread
     g_running = true;
     if (pthread_create(&g_audio_thread, NULL, audio_capture_thread, NULL) != 0) {
@@ -186,6 +926,13 @@ int app_audio_main(void *arg) {
     }
     LOGI("app_audio_main: Audio capture thread created.");
 
+    // Remote audio from the call; capture keeps running without a speaker
+    if (pthread_create(&g_playback_thread, NULL, audio_playback_thread, NULL) == 0) {
+        g_playback_started = true;
+    } else {
+        LOGE("app_audio_main: Failed to create audio playback thread.");
+    }
+
     // This thread (app_audio_main) will just return, and the pthread_detach in start_app will handle it.
     // The actual audio capture happens in audio_capture_thread.
     return 0;
@@ -198,6 +945,10 @@ void app_audio_quit() {
     }
     g_running = false;
     pthread_join(g_audio_thread, NULL); // Wait for the thread to finish
+    if (g_playback_started) {
+        pthread_join(g_playback_thread, NULL);
+        g_playback_started = false;
+    }
 
     // Cleanup resources
     if (g_alsa_handle) {
@@ -205,6 +956,10 @@ void app_audio_quit() {
         g_alsa_handle = NULL;
         LOGI("app_audio_quit: ALSA handle closed.");
     }
+    if (g_dsp_ready) {
+        audio_dsp_destroy(&g_dsp);
+        g_dsp_ready = false;
+    }
     if (g_opus_encoder) {
         opus_encoder_destroy(g_opus_encoder);
         g_opus_encoder = NULL;
@@ -215,5 +970,13 @@ void app_audio_quit() {
         g_nng_audio_sock.id = -1;
         LOGI("app_audio_quit: NNG audio socket closed.");
     }
+    if (nng_socket_id(g_nng_vad_sock) != -1) {
+        nng_close(g_nng_vad_sock);
+        g_nng_vad_sock.id = -1;
+    }
+    if (nng_socket_id(g_nng_raw_sock) != -1) {
+        nng_close(g_nng_raw_sock);
+        g_nng_raw_sock.id = -1;
+    }
     LOGI("app_audio_quit: Audio capture stopped and resources cleaned up.");
 }
@@ -1,18 +1,105 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include "audio_dsp.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 
 #define DEFAULT_AUDIO_DEVICE "default"
 #define DEFAULT_SAMPLE_RATE 48000
 #define DEFAULT_CHANNELS 1
 #define DEFAULT_FRAME_SIZE_MS 20
 #define DEFAULT_BITRATE 32000 // 32 kbps
+#define DEFAULT_PERIOD_MS 10
+#define DEFAULT_BUFFER_PERIODS 4
+#define DEFAULT_RT_PRIORITY 50
+#define DEFAULT_COMPLEXITY 10
+#define DEFAULT_ENCODE_BUDGET_PCT 20
 
+// media_frame_hdr_t then one Opus packet; pts_us is when the first sample
+// was captured
 #define TOPIC_AUDIO_COMPRESSED "inproc://audio.compressed"
+// media_frame_hdr_t then one frame of the same capture as interleaved S16 at
+// DEFAULT_SAMPLE_RATE and DEFAULT_CHANNELS, after the DSP stage and not
+// gated by the VAD
+#define TOPIC_AUDIO_RAW "inproc://audio.raw"
 #define TOPIC_AUDIO_WEBRTC "inproc://audio.webrtc"
+// Remote audio sources, see media_frame_track(); the ALSA build decodes
+// each on its own and mixes them for the speaker. The whole call is one
+// source: libpeer hands over depayloaded audio without its SSRC, so the
+// participants cannot be told apart and share one decoder
+enum {
+  AUDIO_TRACK_CALL = 0,  // TOPIC_AUDIO_WEBRTC, every remote participant
+  AUDIO_TRACK_AGENT = 1, // TOPIC_AUDIO_AGENT, the realtime agent's voice
+};
+// Same framing as TOPIC_AUDIO_WEBRTC, from the agent's peer connection;
+// the ALSA build mixes it with the call
+#define TOPIC_AUDIO_AGENT "inproc://audio.agent"
+
+// audio_vad_msg_t, on every change of the local speaking state and once a
+// second; ALSA build only
+#define TOPIC_AUDIO_VAD "inproc://audio.vad"
+
+typedef struct {
+  uint32_t speaking;
+  int32_t level_db;   // of the microphone before the AGC, dBFS
+  uint64_t pts_us;    // media_now_us()
+  uint64_t voiced_us; // end of the last voiced frame, before the hangover
+} audio_vad_msg_t;
+
+// Opus encoder settings, [audio] keys of the same names
+typedef struct {
+  int bitrate;    // bits per second
+  int vbr;        // 0 for CBR
+  int dtx;        // stop sending during silence
+  int fec;        // in-band FEC, only sent while loss_pct > 0
+  int loss_pct;   // expected uplink loss for FEC, set by hand: nothing in
+                  // the tree measures it
+  int frame_ms;   // 10, 20, 40 or 60
+  int complexity; // 0-10, the most the encoder may use
+  int budget_pct; // step complexity down while encoding takes more of a
+                  // frame interval than this, 0 keeps it fixed
+} AudioOpusConfig;
+
+// [audio] section of lamb.ini; the GStreamer build only uses the pipelines
+typedef struct {
+  const char *device;     // ALSA PCM, NULL for DEFAULT_AUDIO_DEVICE
+  const char *spk_device; // playback PCM, NULL for device
+  int period_ms;          // ALSA wakeup interval
+  int buffer_periods;     // ring size in periods
+  int rt_priority;        // SCHED_FIFO priority of the audio threads, 0 off
+  AudioDspConfig dsp;     // between capture and the encoder
+  AudioOpusConfig opus;
+} AudioConfig;
+
+typedef struct {
+  uint64_t frames;    // encoded and published
+  uint64_t silent;    // held back by DTX
+  uint64_t gated;     // held back by the VAD
+  int complexity;     // Opus complexity in use
+  uint64_t overruns;  // capture xruns, each loses the frame in progress
+  uint64_t played;    // remote frames decoded and played
+  uint64_t concealed; // late frames and decode errors replaced by PLC
+  uint64_t underruns; // playback xruns
+} AudioStats;
 
 int app_audio_main(void *arg);
+void app_audio_set_config(const AudioConfig *config);
+void app_audio_get_stats(AudioStats *stats);
+
+/**
+ * Change the encoder settings, applied from the next frame on
+ */
+void app_audio_set_opus(const AudioOpusConfig *opus);
+
+/**
+ * Expected packet loss for FEC, in percent, until the next
+ * app_audio_set_opus(). libpeer exposes neither RTP sequence numbers nor
+ * receiver reports, so loss is not measured and this is the only source
+ */
+void app_audio_set_packet_loss(int percent);
+
 void app_audio_set_pipelines(const char *mic_pipeline,
                              const char *spk_pipeline);
 void app_audio_quit(void);
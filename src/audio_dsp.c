@@ -0,0 +1,364 @@
+#include "audio_dsp.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define AUDIO_DSP_MIN_TAPS 16 // per phase when upsampling, a multiple of 4
+#define AUDIO_DSP_PASSBAND 0.9f
+#define AUDIO_DSP_HIGHPASS_Q 0.7071f
+
+// The AGC follows frames above the floor only, so pauses keep their gain
+// instead of pulling the noise up; it backs off fast and recovers slowly
+#define AUDIO_DSP_AGC_FLOOR_DBFS -50.0f
+#define AUDIO_DSP_AGC_MIN_GAIN_DB -20.0f
+#define AUDIO_DSP_AGC_ATTACK_MS 20.0f
+#define AUDIO_DSP_AGC_RELEASE_MS 1000.0f
+
+// Voice is this far above the noise floor and either clearly tonal or
+// loud enough to skip that check, e.g. fricatives
+#define AUDIO_DSP_VAD_SNR_DB 9.0f
+#define AUDIO_DSP_VAD_LOUD_SNR_DB 20.0f
+#define AUDIO_DSP_VAD_MIN_CORR 0.5f
+#define AUDIO_DSP_VAD_MIN_DBFS -65.0f
+// The floor drops at once to a quieter frame and creeps up otherwise
+#define AUDIO_DSP_VAD_NOISE_RISE_DB_PER_S 3.0f
+
+static int audio_dsp_gcd(int a, int b) {
+  while (b) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// Sum of a[i] * b[i]; the FIR and the AGC level spend their time here
+static float audio_dsp_dot(const float *a, const float *b, int n) {
+  float sum = 0.0f;
+  int i = 0;
+#if defined(__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  for (; i + 4 <= n; i += 4) {
+    acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+  }
+  float32x2_t half = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+  sum = vget_lane_f32(vpadd_f32(half, half), 0);
+#elif defined(__SSE__)
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+void audio_dsp_mix(int16_t *dst, const int16_t *src, int n) {
+  int i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 8 <= n; i += 8) {
+    vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), vld1q_s16(src + i)));
+  }
+#elif defined(__SSE2__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(a, b));
+  }
+#endif
+  for (; i < n; i++) {
+    int v = dst[i] + src[i];
+    dst[i] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+  }
+}
+
+// Blackman windowed sinc low-pass at the lower of the two Nyquist rates,
+// split into up phases with each phase normalized to unity gain at DC
+static void audio_dsp_design(audio_dsp_t *dsp) {
+  int len = dsp->up * dsp->taps;
+  float cutoff = AUDIO_DSP_PASSBAND;
+  if (dsp->down > dsp->up) {
+    cutoff *= (float)dsp->up / dsp->down;
+  }
+
+  for (int p = 0; p < dsp->up; p++) {
+    float *phase = dsp->coeffs + p * dsp->taps;
+    float sum = 0.0f;
+    for (int k = 0; k < dsp->taps; k++) {
+      int n = (dsp->taps - 1 - k) * dsp->up + p;
+      double t = (n - (len - 1) / 2.0) / dsp->up;
+      double x = M_PI * cutoff * t;
+      double sinc = fabs(x) < 1e-9 ? 1.0 : sin(x) / x;
+      double w = 0.42 - 0.5 * cos(2 * M_PI * n / (len - 1)) +
+                 0.08 * cos(4 * M_PI * n / (len - 1));
+      phase[k] = (float)(sinc * w);
+      sum += phase[k];
+    }
+    for (int k = 0; k < dsp->taps; k++) {
+      phase[k] /= sum;
+    }
+  }
+}
+
+// RBJ cookbook second order high-pass
+static void audio_dsp_design_highpass(audio_dsp_t *dsp) {
+  double w0 = 2 * M_PI * dsp->config.highpass_hz / dsp->out_rate;
+  double alpha = sin(w0) / (2 * AUDIO_DSP_HIGHPASS_Q);
+  double cosw = cos(w0);
+  double a0 = 1 + alpha;
+
+  dsp->hp_b[0] = (float)((1 + cosw) / 2 / a0);
+  dsp->hp_b[1] = (float)(-(1 + cosw) / a0);
+  dsp->hp_b[2] = dsp->hp_b[0];
+  dsp->hp_a[0] = (float)(-2 * cosw / a0);
+  dsp->hp_a[1] = (float)((1 - alpha) / a0);
+}
+
+int audio_dsp_init(audio_dsp_t *dsp, const AudioDspConfig *config,
+                   int in_rate, int out_rate, int channels, int max_in) {
+  memset(dsp, 0, sizeof(*dsp));
+  dsp->config = *config;
+  dsp->in_rate = in_rate;
+  dsp->out_rate = out_rate;
+  dsp->channels = channels;
+  dsp->max_in = max_in;
+  dsp->gain = 1.0f;
+  dsp->voice = true;
+
+  if (channels < 1 || channels > AUDIO_DSP_MAX_CHANNELS || in_rate <= 0 ||
+      in_rate % 100 != 0) {
+    LOGE("audio_dsp: cannot handle %d channels at %d Hz", channels, in_rate);
+    return -1;
+  }
+  if (dsp->config.highpass_hz * 2 >= out_rate) {
+    dsp->config.highpass_hz = 0;
+  }
+
+  int gcd = audio_dsp_gcd(in_rate, out_rate);
+  dsp->up = out_rate / gcd;
+  dsp->down = in_rate / gcd;
+  dsp->max_out = (int)(((int64_t)max_in * dsp->up + dsp->down - 1) / dsp->down);
+  dsp->bypass = dsp->up == dsp->down && dsp->config.highpass_hz <= 0 &&
+                !dsp->config.agc && !dsp->config.vad;
+  if (dsp->bypass) {
+    return 0;
+  }
+
+  if (dsp->up != dsp->down) {
+    // Downsampling narrows the passband, which takes proportionally more taps
+    dsp->taps = AUDIO_DSP_MIN_TAPS;
+    if (dsp->down > dsp->up) {
+      dsp->taps = (AUDIO_DSP_MIN_TAPS * dsp->down / dsp->up + 3) & ~3;
+    }
+    dsp->coeffs = (float *)malloc(sizeof(float) * dsp->up * dsp->taps);
+    dsp->history = (float *)calloc((size_t)channels * (dsp->taps - 1 + max_in),
+                                   sizeof(float));
+  }
+  dsp->work = (float *)malloc(sizeof(float) * channels * dsp->max_out);
+  if ((dsp->up != dsp->down && (!dsp->coeffs || !dsp->history)) ||
+      !dsp->work) {
+    LOGE("audio_dsp: out of memory");
+    audio_dsp_destroy(dsp);
+    return -1;
+  }
+  if (dsp->coeffs) {
+    audio_dsp_design(dsp);
+  }
+  if (dsp->config.highpass_hz > 0) {
+    audio_dsp_design_highpass(dsp);
+  }
+
+  LOGI("audio_dsp: %d -> %d Hz (%d/%d, %d taps), high-pass %d Hz, AGC %s, "
+       "VAD %s",
+       in_rate, out_rate, dsp->up, dsp->down, dsp->taps,
+       dsp->config.highpass_hz, dsp->config.agc ? "on" : "off",
+       dsp->config.vad ? "on" : "off");
+  return 0;
+}
+
+void audio_dsp_destroy(audio_dsp_t *dsp) {
+  free(dsp->coeffs);
+  free(dsp->history);
+  free(dsp->work);
+  dsp->coeffs = NULL;
+  dsp->history = NULL;
+  dsp->work = NULL;
+}
+
+// Every output sample is one phase of the filter against the last taps
+// inputs; the phase carries over so frame boundaries are seamless
+static int audio_dsp_resample(audio_dsp_t *dsp, int in_frames) {
+  int stride = dsp->taps - 1 + dsp->max_in;
+  int i = dsp->next;
+  int p = dsp->phase;
+  int out = 0;
+
+  while (i < in_frames && out < dsp->max_out) {
+    const float *coeffs = dsp->coeffs + p * dsp->taps;
+    for (int c = 0; c < dsp->channels; c++) {
+      dsp->work[c * dsp->max_out + out] =
+          audio_dsp_dot(coeffs, dsp->history + c * stride + i, dsp->taps);
+    }
+    out++;
+    p += dsp->down;
+    i += p / dsp->up;
+    p %= dsp->up;
+  }
+  dsp->next = i - in_frames;
+  dsp->phase = p;
+
+  for (int c = 0; c < dsp->channels; c++) {
+    float *x = dsp->history + c * stride;
+    memmove(x, x + in_frames, sizeof(float) * (dsp->taps - 1));
+  }
+  return out;
+}
+
+static void audio_dsp_highpass(audio_dsp_t *dsp, int frames) {
+  for (int c = 0; c < dsp->channels; c++) {
+    float *y = dsp->work + c * dsp->max_out;
+    float z0 = dsp->hp_z[c][0];
+    float z1 = dsp->hp_z[c][1];
+    for (int i = 0; i < frames; i++) {
+      float x = y[i];
+      y[i] = dsp->hp_b[0] * x + z0;
+      z0 = dsp->hp_b[1] * x - dsp->hp_a[0] * y[i] + z1;
+      z1 = dsp->hp_b[2] * x - dsp->hp_a[1] * y[i];
+    }
+    dsp->hp_z[c][0] = z0;
+    dsp->hp_z[c][1] = z1;
+  }
+}
+
+// Level and voice decision for this frame, before any gain
+static void audio_dsp_vad(audio_dsp_t *dsp, int frames) {
+  float energy = 0.0f;
+  float corr = 0.0f;
+  for (int c = 0; c < dsp->channels; c++) {
+    const float *y = dsp->work + c * dsp->max_out;
+    energy += audio_dsp_dot(y, y, frames);
+    corr += audio_dsp_dot(y, y + 1, frames - 1);
+  }
+  float rms = sqrtf(energy / (frames * dsp->channels)) / 32768.0f;
+  float frame_ms = frames * 1000.0f / dsp->out_rate;
+  dsp->level_db = 20.0f * log10f(rms + 1e-9f);
+  corr = energy > 0.0f ? corr / energy : 0.0f;
+
+  if (!dsp->noise_started || dsp->level_db < dsp->noise_db) {
+    dsp->noise_db = dsp->level_db;
+    dsp->noise_started = true;
+  } else {
+    dsp->noise_db += AUDIO_DSP_VAD_NOISE_RISE_DB_PER_S * frame_ms / 1000.0f;
+  }
+
+  float snr_db = dsp->level_db - dsp->noise_db;
+  bool voiced = dsp->level_db > AUDIO_DSP_VAD_MIN_DBFS &&
+                ((snr_db > AUDIO_DSP_VAD_SNR_DB &&
+                  corr > AUDIO_DSP_VAD_MIN_CORR) ||
+                 snr_db > AUDIO_DSP_VAD_LOUD_SNR_DB);
+  dsp->voiced = voiced;
+  if (voiced) {
+    dsp->hangover_ms = dsp->config.vad_hangover_ms;
+  } else if (dsp->hangover_ms > 0) {
+    dsp->hangover_ms -= (int)frame_ms;
+  }
+  dsp->voice = voiced || dsp->hangover_ms > 0;
+}
+
+// Gain for the end of this frame; it only follows voice
+static float audio_dsp_agc(audio_dsp_t *dsp, int frames) {
+  if (!dsp->voice || dsp->level_db < AUDIO_DSP_AGC_FLOOR_DBFS) {
+    return dsp->gain;
+  }
+
+  float want_db = dsp->config.agc_target_dbfs - dsp->level_db;
+  if (want_db > dsp->config.agc_max_gain_db) {
+    want_db = dsp->config.agc_max_gain_db;
+  } else if (want_db < AUDIO_DSP_AGC_MIN_GAIN_DB) {
+    want_db = AUDIO_DSP_AGC_MIN_GAIN_DB;
+  }
+  float tau_ms = want_db < dsp->gain_db ? AUDIO_DSP_AGC_ATTACK_MS
+                                        : AUDIO_DSP_AGC_RELEASE_MS;
+  float frame_ms = frames * 1000.0f / dsp->out_rate;
+  dsp->gain_db += (want_db - dsp->gain_db) * (1.0f - expf(-frame_ms / tau_ms));
+  return powf(10.0f, dsp->gain_db / 20.0f);
+}
+
+int audio_dsp_process(audio_dsp_t *dsp, int16_t *pcm, int in_frames) {
+  int channels = dsp->channels;
+  int frames = in_frames;
+
+  if (dsp->bypass) {
+    return in_frames;
+  }
+  if (in_frames > dsp->max_in) {
+    in_frames = dsp->max_in;
+  }
+
+  // Deinterleave into the resampler history, or straight into work
+  if (dsp->coeffs) {
+    int stride = dsp->taps - 1 + dsp->max_in;
+    for (int c = 0; c < channels; c++) {
+      float *x = dsp->history + c * stride + dsp->taps - 1;
+      for (int i = 0; i < in_frames; i++) {
+        x[i] = pcm[i * channels + c];
+      }
+    }
+    frames = audio_dsp_resample(dsp, in_frames);
+  } else {
+    frames = in_frames < dsp->max_out ? in_frames : dsp->max_out;
+    for (int c = 0; c < channels; c++) {
+      float *y = dsp->work + c * dsp->max_out;
+      for (int i = 0; i < frames; i++) {
+        y[i] = pcm[i * channels + c];
+      }
+    }
+  }
+  if (frames <= 0) {
+    return 0;
+  }
+
+  if (dsp->config.highpass_hz > 0) {
+    audio_dsp_highpass(dsp, frames);
+  }
+  audio_dsp_vad(dsp, frames);
+
+  // Ramp from the previous gain to avoid zipper noise, saturate on the way
+  // back to S16
+  float gain = dsp->gain;
+  float step = 0.0f;
+  if (dsp->config.agc) {
+    float target = audio_dsp_agc(dsp, frames);
+    step = (target - gain) / frames;
+    dsp->gain = target;
+  }
+  for (int i = 0; i < frames; i++) {
+    gain += step;
+    for (int c = 0; c < channels; c++) {
+      float v = dsp->work[c * dsp->max_out + i] * gain;
+      if (v > 32767.0f) {
+        v = 32767.0f;
+      } else if (v < -32768.0f) {
+        v = -32768.0f;
+      }
+      pcm[i * channels + c] = (int16_t)lrintf(v);
+    }
+  }
+  return frames;
+}
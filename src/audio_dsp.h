@@ -0,0 +1,91 @@
+#ifndef AUDIO_DSP_H_
+#define AUDIO_DSP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * audio_dsp - microphone front end between capture and the encoder:
+ * polyphase resampling to the encoder rate, a high-pass filter for rumble
+ * and DC, a voice activity detector and an automatic gain control for
+ * far-field mics. Works in place on interleaved S16 frames and allocates
+ * nothing after audio_dsp_init()
+ */
+#define AUDIO_DSP_MAX_CHANNELS 2
+
+#define AUDIO_DSP_DEFAULT_HIGHPASS_HZ 80
+#define AUDIO_DSP_DEFAULT_AGC_TARGET_DBFS -18
+#define AUDIO_DSP_DEFAULT_AGC_MAX_GAIN_DB 30
+#define AUDIO_DSP_DEFAULT_VAD_HANGOVER_MS 300
+
+// [audio] keys highpass_hz, agc, agc_target, agc_max_gain, vad and
+// vad_hangover
+typedef struct {
+  int highpass_hz;     // cutoff, 0 off
+  int agc;             // 0 leaves the level alone
+  int agc_target_dbfs; // RMS level speech is brought to
+  int agc_max_gain_db; // most it may boost quiet input
+  int vad;             // the capture side stops encoding without voice
+  int vad_hangover_ms; // voice lasts this long past the last voiced frame
+} AudioDspConfig;
+
+typedef struct {
+  AudioDspConfig config;
+  int in_rate;
+  int out_rate;
+  int channels;
+  int max_in;  // frames per call at most
+  int max_out; // frames the resampler can produce from max_in
+  int bypass;  // nothing enabled, frames pass untouched
+
+  // Resampler: out_rate / in_rate == up / down, up phases of taps each
+  int up;
+  int down;
+  int taps;
+  int phase; // of the next output, in 1/up input samples
+  int next;  // input index of the next output in the coming frame
+  float *coeffs;  // phase p at coeffs[p * taps], reversed for the dot product
+  float *history; // per channel: taps - 1 samples of context, then a frame
+  float *work;    // per channel: one output frame
+
+  // High-pass: one biquad per channel, transposed direct form II
+  float hp_b[3];
+  float hp_a[2];
+  float hp_z[AUDIO_DSP_MAX_CHANNELS][2];
+
+  // VAD: energy against a tracked noise floor plus the lag-1
+  // autocorrelation, which is high for voiced speech and low for hiss
+  bool voice;     // the last frame, hangover included; true when bypassed
+  bool voiced;    // the last frame, hangover excluded
+  float level_db; // of the last frame before gain, dBFS
+  float noise_db;
+  int hangover_ms; // left
+  bool noise_started;
+
+  // AGC
+  float gain_db;
+  float gain; // applied at the end of the last frame
+} audio_dsp_t;
+
+/**
+ * Set up for frames of at most max_in samples per channel at in_rate,
+ * producing out_rate; in_rate must divide into 10 ms frames
+ * Returns 0 if success, -1 if the rates are unsupported or out of memory
+ */
+int audio_dsp_init(audio_dsp_t *dsp, const AudioDspConfig *config,
+                   int in_rate, int out_rate, int channels, int max_in);
+void audio_dsp_destroy(audio_dsp_t *dsp);
+
+/**
+ * dst[i] += src[i] for n interleaved samples, saturating at the S16 range
+ */
+void audio_dsp_mix(int16_t *dst, const int16_t *src, int n);
+
+/**
+ * Run one frame of in_frames samples per channel through the stage in place;
+ * pcm must have room for the resampled frame
+ * Returns the number of frames now in pcm
+ */
+int audio_dsp_process(audio_dsp_t *dsp, int16_t *pcm, int in_frames);
+
+#endif // AUDIO_DSP_H_
@@ -0,0 +1,654 @@
+/*
+ * lamb_bench - synthetic multi-publisher load generator
+ *
+ * N video and audio publishers push stamped frames onto the real bus
+ * topics; the production forwarding path (MeetWebrtcDataHandlerThread and
+ * the publisher PeerConnection) sends them to a loopback peer in the same
+ * process. Every frame carries its publish time, so latency is measured at
+ * the bus (a tap subscriber) and end to end (the loopback peer's tracks).
+ *
+ * Each publisher gets its own video bus and audio topic, numbered like
+ * cameras (see video_camera_topic()), so the N streams stay independent and
+ * decodable. Meet publishes a single video and audio track, which carries
+ * stream 0: only that stream has end to end latency, every stream has
+ * publish and bus latency.
+ */
+#define _GNU_SOURCE // memmem
+#include "audio.h"
+#include "h264_file.h"
+#include "media.h"
+#include "meet.h"
+#include "peer.h"
+#include "utils.h"
+#include "video.h"
+#include "video_bus.h"
+#include <nng/nng.h>
+#include <nng/protocol/pubsub0/pub.h>
+#include <nng/protocol/pubsub0/sub.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_PUBLISHERS 64
+#define BENCH_STAMP_MAGIC "LAMBSTMP"
+#define BENCH_STAMP_MAGIC_LEN 8
+// magic + 8-byte timestamp, one nibble per byte so it never forms a start
+// code or a zero byte inside the bitstream
+#define BENCH_STAMP_LEN (BENCH_STAMP_MAGIC_LEN + 16)
+#define BENCH_STAMP_NAL_LEN (5 + BENCH_STAMP_LEN)
+#define BENCH_AUDIO_FRAME_MS 20
+#define BENCH_FILE "/tmp/lamb_bench.264"
+
+// From meet.c
+extern pthread_t g_data_handler_thread_;
+extern pthread_t g_publisher_thread_;
+
+typedef enum {
+  BENCH_VIDEO,
+  BENCH_AUDIO,
+  BENCH_MEDIA_COUNT,
+} bench_media_t;
+
+typedef enum {
+  BENCH_STAGE_PUBLISH, // nng_sendmsg() duration in the publisher
+  BENCH_STAGE_BUS,     // publish -> tap subscriber on the same topic
+  BENCH_STAGE_E2E,     // publish -> loopback peer track callback
+  BENCH_STAGE_COUNT,
+} bench_stage_t;
+
+typedef struct {
+  uint64_t *samples;
+  size_t capacity;
+  atomic_size_t count;
+  atomic_uint_fast64_t frames;
+  atomic_uint_fast64_t bytes;
+} bench_hist_t;
+
+typedef struct {
+  int publishers; // per medium, each on its own topic
+  int fps;
+  int video_kbps;
+  int audio_kbps;
+  int seconds;
+  const char *input;
+} bench_options_t;
+
+typedef struct {
+  bench_media_t media;
+  int stream;
+  bool tap;
+  pthread_t tid;
+  uint64_t cpu_ns;
+} bench_worker_t;
+
+typedef struct {
+  video_bus_t video_bus;
+  nng_socket audio_pub_sock;
+  char video_topic[VIDEO_TOPIC_MAX];
+  char keyframe_topic[VIDEO_TOPIC_MAX];
+  char audio_topic[VIDEO_TOPIC_MAX];
+  bench_hist_t hist[BENCH_MEDIA_COUNT][BENCH_STAGE_COUNT];
+} bench_stream_t;
+
+static bench_options_t g_opts = {
+    .publishers = 1,
+    .fps = VIDEO_DEFAULT_FPS,
+    .video_kbps = 2000,
+    .audio_kbps = DEFAULT_BITRATE / 1000,
+    .seconds = 10,
+    .input = NULL,
+};
+
+static const char *kMediaNames[BENCH_MEDIA_COUNT] = {"video", "audio"};
+static const char *kStageNames[BENCH_STAGE_COUNT] = {"publish", "bus", "e2e"};
+
+static bench_stream_t g_streams[BENCH_MAX_PUBLISHERS];
+static PeerConnection *g_remote_pc = NULL;
+static volatile bool g_running = false;
+static volatile bool g_remote_running = false;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t thread_cpu_ns(pthread_t tid) {
+  clockid_t clock;
+  if (pthread_getcpuclockid(tid, &clock) != 0) {
+    return 0;
+  }
+  return clock_ns(clock);
+}
+
+static void bench_record(int stream, bench_media_t media, bench_stage_t stage,
+                         uint64_t latency_ns, size_t bytes) {
+  bench_hist_t *h = &g_streams[stream].hist[media][stage];
+  size_t i = atomic_fetch_add(&h->count, 1);
+  if (i < h->capacity) {
+    h->samples[i] = latency_ns;
+  }
+  atomic_fetch_add(&h->frames, 1);
+  atomic_fetch_add(&h->bytes, bytes);
+}
+
+static void bench_stamp_write(uint8_t *p, uint64_t ts) {
+  memcpy(p, BENCH_STAMP_MAGIC, BENCH_STAMP_MAGIC_LEN);
+  p += BENCH_STAMP_MAGIC_LEN;
+  for (int i = 60; i >= 0; i -= 4) {
+    *p++ = 0x10 | ((ts >> i) & 0x0f);
+  }
+}
+
+static int bench_stamp_read(const uint8_t *buf, size_t size, uint64_t *ts) {
+  const uint8_t *p =
+      memmem(buf, size, BENCH_STAMP_MAGIC, BENCH_STAMP_MAGIC_LEN);
+  if (!p || p + BENCH_STAMP_LEN > buf + size) {
+    return -1;
+  }
+  p += BENCH_STAMP_MAGIC_LEN;
+  *ts = 0;
+  for (int i = 0; i < 16; i++) {
+    *ts = (*ts << 4) | (p[i] & 0x0f);
+  }
+  return 0;
+}
+
+// Write a GOP-structured Annex-B file matching the requested bitrate so the
+// publishers can use the same mmap'd file source as test_video.c.
+static int bench_write_synthetic_file(const char *path) {
+  static const uint8_t sps[] = {0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1f, 0x8c};
+  static const uint8_t pps[] = {0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80};
+  size_t frame_bytes = (size_t)g_opts.video_kbps * 1000 / 8 /
+                       (g_opts.fps > 0 ? g_opts.fps : VIDEO_DEFAULT_FPS);
+  int gop = g_opts.fps > 0 ? g_opts.fps : VIDEO_DEFAULT_FPS;
+  uint8_t *slice;
+  FILE *fp;
+
+  if (frame_bytes < 16) {
+    frame_bytes = 16;
+  }
+  slice = malloc(frame_bytes * 4);
+  fp = fopen(path, "wb");
+  if (!slice || !fp) {
+    free(slice);
+    if (fp) {
+      fclose(fp);
+    }
+    return -1;
+  }
+  memset(slice, 0xaa, frame_bytes * 4);
+
+  for (int i = 0; i < gop; i++) {
+    // first_mb_in_slice = 0, IDR frames are four times as large
+    size_t size = i == 0 ? frame_bytes * 4 : frame_bytes;
+    slice[0] = 0;
+    slice[1] = 0;
+    slice[2] = 0;
+    slice[3] = 1;
+    slice[4] = i == 0 ? 0x65 : 0x41;
+    slice[5] = 0x88;
+    if (i == 0) {
+      fwrite(sps, 1, sizeof(sps), fp);
+      fwrite(pps, 1, sizeof(pps), fp);
+    }
+    fwrite(slice, 1, size, fp);
+  }
+
+  fclose(fp);
+  free(slice);
+  return 0;
+}
+
+static void *bench_video_publisher(void *arg) {
+  bench_worker_t *w = (bench_worker_t *)arg;
+  bench_stream_t *st = &g_streams[w->stream];
+  uint64_t cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  h264_file_t file;
+  h264_au_t au;
+  uint8_t *body = NULL;
+  size_t body_capacity = 0;
+
+  if (h264_file_open(&file, g_opts.input ? g_opts.input : BENCH_FILE,
+                     g_opts.fps, 1) < 0) {
+    return NULL;
+  }
+
+  while (g_running && h264_file_next(&file, &au) == 0) {
+    size_t size = BENCH_STAMP_NAL_LEN + au.size;
+    h264_file_pace(&file);
+    if (size > body_capacity) {
+      uint8_t *p = realloc(body, size);
+      if (!p) {
+        continue;
+      }
+      body = p;
+      body_capacity = size;
+    }
+    // Unspecified NAL type 30 in front of the access unit, sent as its own
+    // RTP packet and ignored by decoders
+    body[0] = 0;
+    body[1] = 0;
+    body[2] = 0;
+    body[3] = 1;
+    body[4] = 0x1e;
+    memcpy(body + BENCH_STAMP_NAL_LEN, au.data, au.size);
+
+    uint64_t t0 = now_ns();
+    bench_stamp_write(body + 5, t0);
+    if (video_bus_publish(&st->video_bus, body, size, t0 / 1000) != 0) {
+      continue;
+    }
+    bench_record(w->stream, BENCH_VIDEO, BENCH_STAGE_PUBLISH, now_ns() - t0,
+                 sizeof(media_frame_hdr_t) + size);
+  }
+
+  free(body);
+  h264_file_close(&file);
+  w->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+  return NULL;
+}
+
+static void *bench_audio_publisher(void *arg) {
+  bench_worker_t *w = (bench_worker_t *)arg;
+  bench_stream_t *st = &g_streams[w->stream];
+  uint64_t cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  size_t size = (size_t)g_opts.audio_kbps * 1000 / 8 *
+                BENCH_AUDIO_FRAME_MS / 1000;
+  struct timespec deadline;
+  uint32_t seq = 0;
+
+  if (size < 1 + BENCH_STAMP_LEN) {
+    size = 1 + BENCH_STAMP_LEN;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  while (g_running) {
+    nng_msg *msg;
+
+    deadline.tv_nsec += BENCH_AUDIO_FRAME_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                           NULL) == EINTR) {
+    }
+
+    if (nng_msg_alloc(&msg, sizeof(media_frame_hdr_t) + size) != 0) {
+      continue;
+    }
+    media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+    uint8_t *body = (uint8_t *)(hdr + 1);
+    memset(body, 0xaa, size);
+    body[0] = 0xfc; // CELT FB 20 ms, mono, one frame
+
+    uint64_t t0 = now_ns();
+    hdr->flags = 0;
+    hdr->seq = seq++;
+    hdr->pts_us = t0 / 1000;
+    bench_stamp_write(body + 1, t0);
+    if (nng_sendmsg(st->audio_pub_sock, msg, 0) != 0) {
+      nng_msg_free(msg);
+      continue;
+    }
+    bench_record(w->stream, BENCH_AUDIO, BENCH_STAGE_PUBLISH, now_ns() - t0,
+                 sizeof(media_frame_hdr_t) + size);
+  }
+
+  w->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+  return NULL;
+}
+
+static void *bench_tap(void *arg) {
+  bench_worker_t *w = (bench_worker_t *)arg;
+  uint64_t cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  bench_stream_t *st = &g_streams[w->stream];
+  const char *topic =
+      w->media == BENCH_VIDEO ? st->video_topic : st->audio_topic;
+  nng_socket sock;
+  int rv;
+
+  if ((rv = nng_sub0_open(&sock)) != 0) {
+    LOGE("bench_tap: nng_sub0_open: %s", nng_strerror(rv));
+    return NULL;
+  }
+  nng_socket_set(sock, NNG_OPT_SUB_SUBSCRIBE, "", 0);
+  nng_socket_set_ms(sock, NNG_OPT_RECVTIMEO, 100);
+  if ((rv = nng_dial(sock, topic, NULL, 0)) != 0) {
+    LOGE("bench_tap: nng_dial %s: %s", topic, nng_strerror(rv));
+    nng_close(sock);
+    return NULL;
+  }
+
+  while (g_running) {
+    nng_msg *msg;
+    uint64_t ts;
+    if (nng_recvmsg(sock, &msg, 0) != 0) {
+      continue;
+    }
+    uint64_t t = now_ns();
+    if (bench_stamp_read(nng_msg_body(msg), nng_msg_len(msg), &ts) == 0) {
+      bench_record(w->stream, w->media, BENCH_STAGE_BUS, t - ts,
+                   nng_msg_len(msg));
+    }
+    nng_msg_free(msg);
+  }
+
+  nng_close(sock);
+  w->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+  return NULL;
+}
+
+// The loopback peer only receives stream 0, the one Meet publishes
+static void bench_on_track(bench_media_t media, uint8_t *data, size_t size) {
+  uint64_t ts;
+  uint64_t t = now_ns();
+  if (bench_stamp_read(data, size, &ts) == 0) {
+    bench_record(0, media, BENCH_STAGE_E2E, t - ts, size);
+  }
+}
+
+static void bench_on_video_track(uint8_t *data, size_t size, void *userdata) {
+  (void)userdata;
+  bench_on_track(BENCH_VIDEO, data, size);
+}
+
+static void bench_on_audio_track(uint8_t *data, size_t size, void *userdata) {
+  (void)userdata;
+  bench_on_track(BENCH_AUDIO, data, size);
+}
+
+static void *bench_remote_loop(void *arg) {
+  (void)arg;
+  while (g_remote_running) {
+    peer_connection_loop(g_remote_pc);
+    usleep(1000);
+  }
+  return NULL;
+}
+
+// Connect the Meet publisher to an in-process peer with a direct
+// offer/answer exchange; host candidates are carried in the SDP.
+static int bench_connect_loopback(void) {
+  PeerConfiguration config = {
+      .datachannel = DATA_CHANNEL_NONE,
+      .audio_codec = CODEC_OPUS,
+      .video_codec = CODEC_H264,
+      .onvideotrack = bench_on_video_track,
+      .onaudiotrack = bench_on_audio_track,
+  };
+
+  g_remote_pc = peer_connection_create(&config);
+  if (!g_remote_pc) {
+    return -1;
+  }
+
+  const char *offer = MeetWebrtcCreateOffer();
+  peer_connection_set_remote_description(g_remote_pc, offer, SDP_TYPE_OFFER);
+  const char *answer = peer_connection_create_answer(g_remote_pc);
+  MeetWebrtcSetRemoteDescription(answer, "answer");
+
+  for (int i = 0; i < 100; i++) {
+    peer_connection_loop(g_remote_pc);
+    if (MeetWebrtcPublisherIsConnected() == PEER_CONNECTION_CONNECTED ||
+        MeetWebrtcPublisherIsConnected() == PEER_CONNECTION_COMPLETED) {
+      return 0;
+    }
+    usleep(50 * 1000);
+  }
+  return -1;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void bench_print_row(const char *stream, bench_media_t media,
+                            bench_stage_t stage, uint64_t *samples, size_t n,
+                            uint64_t frames, uint64_t bytes, double seconds) {
+  if (frames == 0 || n == 0) {
+    return;
+  }
+  qsort(samples, n, sizeof(uint64_t), cmp_u64);
+  printf("%-6s %-8s %-6s %10llu %10.1f %10.2f %9.3f %9.3f %9.3f\n", stream,
+         kStageNames[stage], kMediaNames[media], (unsigned long long)frames,
+         frames / seconds, bytes * 8 / seconds / 1e6, samples[n / 2] / 1e6,
+         samples[n * 99 / 100] / 1e6, samples[n - 1] / 1e6);
+}
+
+static void bench_report(double seconds, const bench_worker_t *workers,
+                         int n_workers, uint64_t handler_cpu_ns,
+                         uint64_t peer_cpu_ns, uint64_t remote_cpu_ns) {
+  uint64_t publisher_cpu_ns = 0;
+  uint64_t tap_cpu_ns = 0;
+  size_t total_capacity = 0;
+
+  for (int i = 0; i < g_opts.publishers; i++) {
+    for (int m = 0; m < BENCH_MEDIA_COUNT; m++) {
+      if (g_streams[i].hist[m][0].capacity > total_capacity) {
+        total_capacity = g_streams[i].hist[m][0].capacity;
+      }
+    }
+  }
+  total_capacity *= g_opts.publishers;
+  uint64_t *total = malloc(total_capacity * sizeof(uint64_t));
+
+  printf("\n%d publisher(s), one stream per medium each\n", g_opts.publishers);
+  printf("%-6s %-8s %-6s %10s %10s %10s %9s %9s %9s\n", "stream", "stage",
+         "media", "frames", "frames/s", "Mbit/s", "p50(ms)", "p99(ms)",
+         "max(ms)");
+  for (int m = 0; m < BENCH_MEDIA_COUNT; m++) {
+    for (int s = 0; s < BENCH_STAGE_COUNT; s++) {
+      size_t total_n = 0;
+      uint64_t total_frames = 0;
+      uint64_t total_bytes = 0;
+      for (int i = 0; i < g_opts.publishers; i++) {
+        bench_hist_t *h = &g_streams[i].hist[m][s];
+        size_t n = atomic_load(&h->count);
+        uint64_t frames = atomic_load(&h->frames);
+        uint64_t bytes = atomic_load(&h->bytes);
+        char name[16];
+        if (n > h->capacity) {
+          n = h->capacity;
+        }
+        // Copy first, the per-stream row sorts in place
+        if (total) {
+          memcpy(total + total_n, h->samples, n * sizeof(uint64_t));
+        }
+        total_n += n;
+        total_frames += frames;
+        total_bytes += bytes;
+        snprintf(name, sizeof(name), "%d", i);
+        bench_print_row(name, m, s, h->samples, n, frames, bytes, seconds);
+      }
+      if (total && g_opts.publishers > 1) {
+        bench_print_row("total", m, s, total, total_n, total_frames,
+                        total_bytes, seconds);
+      }
+    }
+  }
+  free(total);
+
+  for (int i = 0; i < n_workers; i++) {
+    if (workers[i].tap) {
+      tap_cpu_ns += workers[i].cpu_ns;
+    } else {
+      publisher_cpu_ns += workers[i].cpu_ns;
+    }
+  }
+  printf("\n%-24s %8s\n", "cpu", "%core");
+  printf("%-24s %8.1f\n", "publishers", publisher_cpu_ns / seconds / 1e7);
+  printf("%-24s %8.1f\n", "bus taps", tap_cpu_ns / seconds / 1e7);
+  printf("%-24s %8.1f\n", "meet data handler", handler_cpu_ns / seconds / 1e7);
+  printf("%-24s %8.1f\n", "meet publisher peer", peer_cpu_ns / seconds / 1e7);
+  printf("%-24s %8.1f\n", "loopback peer", remote_cpu_ns / seconds / 1e7);
+}
+
+static void usage(const char *prog) {
+  printf("usage: %s [-n publishers] [-f fps] [-b video_kbps] [-a audio_kbps] "
+         "[-d seconds] [-i file.264]\n",
+         prog);
+}
+
+int main(int argc, char *argv[]) {
+  bench_worker_t workers[2 * BENCH_MEDIA_COUNT * BENCH_MAX_PUBLISHERS];
+  int n_workers = 0;
+  pthread_t remote_tid;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:f:b:a:d:i:h")) != -1) {
+    switch (c) {
+    case 'n':
+      g_opts.publishers = atoi(optarg);
+      break;
+    case 'f':
+      g_opts.fps = atoi(optarg);
+      break;
+    case 'b':
+      g_opts.video_kbps = atoi(optarg);
+      break;
+    case 'a':
+      g_opts.audio_kbps = atoi(optarg);
+      break;
+    case 'd':
+      g_opts.seconds = atoi(optarg);
+      break;
+    case 'i':
+      g_opts.input = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (g_opts.publishers < 1 || g_opts.publishers > BENCH_MAX_PUBLISHERS ||
+      g_opts.seconds < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (!g_opts.input && bench_write_synthetic_file(BENCH_FILE) < 0) {
+    LOGE("Failed to write %s", BENCH_FILE);
+    return 1;
+  }
+
+  // Room for twice the nominal frame count per stage
+  size_t video_cap =
+      2 * (size_t)g_opts.seconds * (g_opts.fps > 0 ? g_opts.fps : 1000);
+  size_t audio_cap = 2 * (size_t)g_opts.seconds * (1000 / BENCH_AUDIO_FRAME_MS);
+  for (int i = 0; i < g_opts.publishers; i++) {
+    bench_stream_t *st = &g_streams[i];
+    for (int s = 0; s < BENCH_STAGE_COUNT; s++) {
+      st->hist[BENCH_VIDEO][s].capacity = video_cap;
+      st->hist[BENCH_VIDEO][s].samples = malloc(video_cap * sizeof(uint64_t));
+      st->hist[BENCH_AUDIO][s].capacity = audio_cap;
+      st->hist[BENCH_AUDIO][s].samples = malloc(audio_cap * sizeof(uint64_t));
+      if (!st->hist[BENCH_VIDEO][s].samples ||
+          !st->hist[BENCH_AUDIO][s].samples) {
+        LOGE("Failed to allocate latency samples");
+        return 1;
+      }
+    }
+  }
+
+  // Stream 0 is on the well known topics Meet forwards
+  for (int i = 0; i < g_opts.publishers; i++) {
+    bench_stream_t *st = &g_streams[i];
+    int rv;
+    video_camera_topic(st->video_topic, sizeof(st->video_topic),
+                       TOPIC_VIDEO_COMPRESSED, i);
+    video_camera_topic(st->keyframe_topic, sizeof(st->keyframe_topic),
+                       TOPIC_VIDEO_KEYFRAME, i);
+    video_camera_topic(st->audio_topic, sizeof(st->audio_topic),
+                       TOPIC_AUDIO_COMPRESSED, i);
+    if (video_bus_open(&st->video_bus, st->video_topic, st->keyframe_topic) <
+        0) {
+      return 1;
+    }
+    if ((rv = nng_pub0_open(&st->audio_pub_sock)) != 0 ||
+        (rv = nng_listen(st->audio_pub_sock, st->audio_topic, NULL, 0)) != 0) {
+      LOGE("Failed to publish on %s: %s", st->audio_topic, nng_strerror(rv));
+      return 1;
+    }
+  }
+
+  MeetWebrtcCreatePeerConnections();
+  if (bench_connect_loopback() < 0) {
+    LOGW("Loopback peer did not connect, e2e latency will be missing");
+  }
+  g_remote_running = true;
+  pthread_create(&remote_tid, NULL, bench_remote_loop, NULL);
+
+  LOGI("Running %d publisher(s) at %d fps, video %d kbps, audio %d kbps for "
+       "%d s, stream 0 published to the loopback peer",
+       g_opts.publishers, g_opts.fps, g_opts.video_kbps, g_opts.audio_kbps,
+       g_opts.seconds);
+
+  g_running = true;
+  for (int i = 0; i < g_opts.publishers; i++) {
+    for (int m = 0; m < BENCH_MEDIA_COUNT; m++) {
+      if (m == BENCH_AUDIO && g_opts.audio_kbps <= 0) {
+        continue;
+      }
+      for (int tap = 0; tap < 2; tap++) {
+        bench_worker_t *w = &workers[n_workers++];
+        w->media = m;
+        w->stream = i;
+        w->tap = tap;
+        pthread_create(&w->tid, NULL,
+                       tap ? bench_tap
+                           : m == BENCH_VIDEO ? bench_video_publisher
+                                              : bench_audio_publisher,
+                       w);
+      }
+    }
+  }
+
+  uint64_t handler_cpu = thread_cpu_ns(g_data_handler_thread_);
+  uint64_t peer_cpu = thread_cpu_ns(g_publisher_thread_);
+  uint64_t remote_cpu = thread_cpu_ns(remote_tid);
+  uint64_t start = now_ns();
+  sleep(g_opts.seconds);
+  handler_cpu = thread_cpu_ns(g_data_handler_thread_) - handler_cpu;
+  peer_cpu = thread_cpu_ns(g_publisher_thread_) - peer_cpu;
+  remote_cpu = thread_cpu_ns(remote_tid) - remote_cpu;
+  double seconds = (now_ns() - start) / 1e9;
+
+  g_running = false;
+  for (int i = 0; i < n_workers; i++) {
+    pthread_join(workers[i].tid, NULL);
+  }
+
+  bench_report(seconds, workers, n_workers, handler_cpu, peer_cpu,
+               remote_cpu);
+
+  g_remote_running = false;
+  pthread_join(remote_tid, NULL);
+  peer_connection_destroy(g_remote_pc);
+  MeetWebrtcDestroyPeerConnections();
+  for (int i = 0; i < g_opts.publishers; i++) {
+    video_bus_close(&g_streams[i].video_bus);
+    nng_close(g_streams[i].audio_pub_sock);
+    for (int s = 0; s < BENCH_STAGE_COUNT; s++) {
+      free(g_streams[i].hist[BENCH_VIDEO][s].samples);
+      free(g_streams[i].hist[BENCH_AUDIO][s].samples);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include "color.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// BT.601 limited range coefficients scaled by 64 so every term fits in
+// 16 bits; overflow only happens past the clamp and saturates
+#define COLOR_Y 74
+#define COLOR_RV 102
+#define COLOR_GU -25
+#define COLOR_GV -52
+#define COLOR_BU 129
+
+static inline uint8_t clamp_u8(int v) {
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static void nv12_row_scalar(const uint8_t *y, const uint8_t *uv,
+                            uint8_t *dst, int x, int width) {
+  for (; x < width; x++) {
+    int c = COLOR_Y * (y[x] - 16);
+    int d = uv[x & ~1] - 128;
+    int e = uv[x | 1] - 128;
+    dst[4 * x + 0] = clamp_u8((c + COLOR_BU * d) >> 6);
+    dst[4 * x + 1] = clamp_u8((c + COLOR_GU * d + COLOR_GV * e) >> 6);
+    dst[4 * x + 2] = clamp_u8((c + COLOR_RV * e) >> 6);
+    dst[4 * x + 3] = 0xff;
+  }
+}
+
+#if defined(__SSE2__)
+static int nv12_row_simd(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+                         int width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ff = _mm_set1_epi8((char)0xff);
+  const __m128i lo_mask = _mm_set1_epi16(0xff);
+  const __m128i c16 = _mm_set1_epi16(16);
+  const __m128i c128 = _mm_set1_epi16(128);
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    __m128i yv = _mm_loadu_si128((const __m128i *)(y + x));
+    __m128i uvv = _mm_loadu_si128((const __m128i *)(uv + x));
+    __m128i u = _mm_sub_epi16(_mm_and_si128(uvv, lo_mask), c128);
+    __m128i v = _mm_sub_epi16(_mm_srli_epi16(uvv, 8), c128);
+
+    // Chroma terms for 8 sample pairs, each shared by two pixels
+    __m128i r = _mm_mullo_epi16(v, _mm_set1_epi16(COLOR_RV));
+    __m128i g = _mm_adds_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(COLOR_GU)),
+                               _mm_mullo_epi16(v, _mm_set1_epi16(COLOR_GV)));
+    __m128i b = _mm_mullo_epi16(u, _mm_set1_epi16(COLOR_BU));
+
+    __m128i yl = _mm_mullo_epi16(
+        _mm_sub_epi16(_mm_unpacklo_epi8(yv, zero), c16),
+        _mm_set1_epi16(COLOR_Y));
+    __m128i yh = _mm_mullo_epi16(
+        _mm_sub_epi16(_mm_unpackhi_epi8(yv, zero), c16),
+        _mm_set1_epi16(COLOR_Y));
+
+    __m128i R = _mm_packus_epi16(
+        _mm_srai_epi16(_mm_adds_epi16(yl, _mm_unpacklo_epi16(r, r)), 6),
+        _mm_srai_epi16(_mm_adds_epi16(yh, _mm_unpackhi_epi16(r, r)), 6));
+    __m128i G = _mm_packus_epi16(
+        _mm_srai_epi16(_mm_adds_epi16(yl, _mm_unpacklo_epi16(g, g)), 6),
+        _mm_srai_epi16(_mm_adds_epi16(yh, _mm_unpackhi_epi16(g, g)), 6));
+    __m128i B = _mm_packus_epi16(
+        _mm_srai_epi16(_mm_adds_epi16(yl, _mm_unpacklo_epi16(b, b)), 6),
+        _mm_srai_epi16(_mm_adds_epi16(yh, _mm_unpackhi_epi16(b, b)), 6));
+
+    __m128i bg_lo = _mm_unpacklo_epi8(B, G);
+    __m128i bg_hi = _mm_unpackhi_epi8(B, G);
+    __m128i rx_lo = _mm_unpacklo_epi8(R, ff);
+    __m128i rx_hi = _mm_unpackhi_epi8(R, ff);
+    __m128i *out = (__m128i *)(dst + 4 * x);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(bg_lo, rx_lo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg_lo, rx_lo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bg_hi, rx_hi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bg_hi, rx_hi));
+  }
+  return x;
+}
+#elif defined(__ARM_NEON)
+static int nv12_row_simd(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+                         int width) {
+  const int16x8_t c16 = vdupq_n_s16(16);
+  const int16x8_t c128 = vdupq_n_s16(128);
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t yv = vld1q_u8(y + x);
+    uint8x8x2_t uvv = vld2_u8(uv + x);
+    int16x8_t u =
+        vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uvv.val[0])), c128);
+    int16x8_t v =
+        vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uvv.val[1])), c128);
+
+    int16x8x2_t r = vzipq_s16(vmulq_n_s16(v, COLOR_RV),
+                              vmulq_n_s16(v, COLOR_RV));
+    int16x8_t g1 = vqaddq_s16(vmulq_n_s16(u, COLOR_GU),
+                              vmulq_n_s16(v, COLOR_GV));
+    int16x8x2_t g = vzipq_s16(g1, g1);
+    int16x8x2_t b = vzipq_s16(vmulq_n_s16(u, COLOR_BU),
+                              vmulq_n_s16(u, COLOR_BU));
+
+    int16x8_t yl = vmulq_n_s16(
+        vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(yv))), c16),
+        COLOR_Y);
+    int16x8_t yh = vmulq_n_s16(
+        vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(yv))), c16),
+        COLOR_Y);
+
+    uint8x16x4_t px;
+    px.val[0] = vcombine_u8(vqshrun_n_s16(vqaddq_s16(yl, b.val[0]), 6),
+                            vqshrun_n_s16(vqaddq_s16(yh, b.val[1]), 6));
+    px.val[1] = vcombine_u8(vqshrun_n_s16(vqaddq_s16(yl, g.val[0]), 6),
+                            vqshrun_n_s16(vqaddq_s16(yh, g.val[1]), 6));
+    px.val[2] = vcombine_u8(vqshrun_n_s16(vqaddq_s16(yl, r.val[0]), 6),
+                            vqshrun_n_s16(vqaddq_s16(yh, r.val[1]), 6));
+    px.val[3] = vdupq_n_u8(0xff);
+    vst4q_u8(dst + 4 * x, px);
+  }
+  return x;
+}
+#else
+static int nv12_row_simd(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+                         int width) {
+  (void)y;
+  (void)uv;
+  (void)dst;
+  (void)width;
+  return 0;
+}
+#endif
+
+void color_nv12_to_xrgb8888(const uint8_t *y, int y_stride, const uint8_t *uv,
+                            int uv_stride, uint8_t *dst, int dst_stride,
+                            int width, int height) {
+  for (int row = 0; row < height; row++) {
+    const uint8_t *y_row = y + (size_t)row * y_stride;
+    const uint8_t *uv_row = uv + (size_t)(row / 2) * uv_stride;
+    uint8_t *dst_row = dst + (size_t)row * dst_stride;
+    int x = nv12_row_simd(y_row, uv_row, dst_row, width);
+    nv12_row_scalar(y_row, uv_row, dst_row, x, width);
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef COLOR_H_
+#define COLOR_H_
+
+#include <stdint.h>
+
+/**
+ * Convert an NV12 picture to XRGB8888 (B, G, R, X byte order), BT.601
+ * limited range. Uses SSE2/NEON when available, width may be any value
+ */
+void color_nv12_to_xrgb8888(const uint8_t *y, int y_stride, const uint8_t *uv,
+                            int uv_stride, uint8_t *dst, int dst_stride,
+                            int width, int height);
+
+#endif // COLOR_H_
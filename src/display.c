@@ -1,25 +1,53 @@
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "audio.h"
+#include "color.h"
+#include "display.h"
 #include "lvgl/driver_backends.h"
 #include "lvgl/lvgl.h"
 #include "lvgl/simulator_settings.h"
 #include "lvgl/simulator_util.h"
 #include "lvgl/src/libs/freetype/lv_freetype.h"
+#include <nng/nng.h>
+#include <nng/protocol/pubsub0/sub.h>
 
 /* Global simulator settings */
 extern simulator_settings_t settings;
 
 static lv_obj_t *date_label;
 static lv_obj_t *time_label;
+static lv_obj_t *mic_label;
+
+static nng_socket g_vad_sock = NNG_SOCKET_INITIALIZER;
 
 static lv_font_t *date_font;
 static lv_font_t *time_font;
 
+#define VIDEO_MAX_WIDTH 1280
+#define VIDEO_MAX_HEIGHT 720
+#define VIDEO_BYTES_PER_PIXEL 4
+
+// Remote video layer. The decoder converts into the back buffer while LVGL
+// shows the front one; the LVGL timer swaps them when a frame is ready.
+typedef struct {
+  lv_obj_t *image;
+  lv_image_dsc_t dsc[2];
+  uint8_t *buf[2];
+  int back;
+  bool ready;
+  pthread_mutex_t mtx;
+} video_layer_t;
+
+static video_layer_t g_video = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
 void font_init(void) {
   lv_freetype_init(64);
 
@@ -57,6 +85,129 @@ static void update_time_cb(lv_timer_t *timer) {
   lv_label_set_text(time_label, time_buf);
 }
 
+int app_display_push_nv12(const uint8_t *y, int y_stride, const uint8_t *uv,
+                          int uv_stride, int width, int height) {
+  int back;
+
+  if (width > VIDEO_MAX_WIDTH || height > VIDEO_MAX_HEIGHT) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&g_video.mtx);
+  if (!g_video.buf[0] || g_video.ready) {
+    // Not initialized yet, or the previous frame has not been shown
+    pthread_mutex_unlock(&g_video.mtx);
+    return -1;
+  }
+  back = g_video.back;
+  pthread_mutex_unlock(&g_video.mtx);
+
+  int stride = width * VIDEO_BYTES_PER_PIXEL;
+  color_nv12_to_xrgb8888(y, y_stride, uv, uv_stride, g_video.buf[back],
+                         stride, width, height);
+
+  pthread_mutex_lock(&g_video.mtx);
+  lv_image_dsc_t *dsc = &g_video.dsc[back];
+  dsc->header.w = width;
+  dsc->header.h = height;
+  dsc->header.stride = stride;
+  dsc->data_size = stride * height;
+  g_video.ready = true;
+  pthread_mutex_unlock(&g_video.mtx);
+  return 0;
+}
+
+static void update_video_cb(lv_timer_t *timer) {
+  LV_UNUSED(timer);
+
+  lv_image_dsc_t *front = NULL;
+
+  pthread_mutex_lock(&g_video.mtx);
+  if (g_video.ready) {
+    front = &g_video.dsc[g_video.back];
+    g_video.back ^= 1;
+    g_video.ready = false;
+  }
+  pthread_mutex_unlock(&g_video.mtx);
+
+  if (front) {
+    lv_image_cache_drop(front);
+    lv_image_set_src(g_video.image, front);
+    lv_obj_remove_flag(g_video.image, LV_OBJ_FLAG_HIDDEN);
+  }
+}
+
+#define MIC_COLOR_SPEAKING 0x33CC66
+#define MIC_COLOR_SILENT 0x555555
+
+// Local speaking state from the capture side's VAD, latest message wins
+static void update_mic_cb(lv_timer_t *timer) {
+  LV_UNUSED(timer);
+
+  audio_vad_msg_t vad;
+  size_t size = sizeof(vad);
+  int speaking = -1;
+
+  while (nng_recv(g_vad_sock, &vad, &size, NNG_FLAG_NONBLOCK) == 0) {
+    if (size == sizeof(vad)) {
+      speaking = vad.speaking ? 1 : 0;
+    }
+    size = sizeof(vad);
+  }
+  if (speaking >= 0) {
+    lv_obj_set_style_text_color(
+        mic_label,
+        lv_color_hex(speaking ? MIC_COLOR_SPEAKING : MIC_COLOR_SILENT), 0);
+  }
+}
+
+static void mic_indicator_init(lv_obj_t *parent) {
+  if (nng_sub0_open(&g_vad_sock) != 0) {
+    printf("Mic indicator socket failed\n");
+    return;
+  }
+  nng_socket_set(g_vad_sock, NNG_OPT_SUB_SUBSCRIBE, "", 0);
+  // Keeps retrying in the background until the audio module listens
+  nng_dial(g_vad_sock, TOPIC_AUDIO_VAD, NULL, NNG_FLAG_NONBLOCK);
+
+  mic_label = lv_label_create(parent);
+  lv_label_set_text(mic_label, LV_SYMBOL_AUDIO);
+  lv_obj_set_style_text_color(mic_label, lv_color_hex(MIC_COLOR_SILENT), 0);
+  lv_obj_align(mic_label, LV_ALIGN_TOP_RIGHT, -16, 16);
+
+  lv_timer_create(update_mic_cb, 100, NULL);
+}
+
+static void video_layer_init(lv_obj_t *parent) {
+  size_t size = VIDEO_MAX_WIDTH * VIDEO_MAX_HEIGHT * VIDEO_BYTES_PER_PIXEL;
+  uint8_t *buf[2] = {NULL, NULL};
+
+  if (posix_memalign((void **)&buf[0], 64, size) != 0 ||
+      posix_memalign((void **)&buf[1], 64, size) != 0) {
+    printf("Video buffer allocation failed\n");
+    free(buf[0]);
+    return;
+  }
+
+  // Created first so the clock and call UI are drawn on top of it
+  g_video.image = lv_image_create(parent);
+  lv_obj_set_size(g_video.image, LV_PCT(100), LV_PCT(100));
+  lv_obj_center(g_video.image);
+  lv_image_set_inner_align(g_video.image, LV_IMAGE_ALIGN_CONTAIN);
+  lv_obj_add_flag(g_video.image, LV_OBJ_FLAG_HIDDEN);
+
+  pthread_mutex_lock(&g_video.mtx);
+  for (int i = 0; i < 2; i++) {
+    g_video.dsc[i].header.magic = LV_IMAGE_HEADER_MAGIC;
+    g_video.dsc[i].header.cf = LV_COLOR_FORMAT_XRGB8888;
+    g_video.dsc[i].data = buf[i];
+    g_video.buf[i] = buf[i];
+  }
+  pthread_mutex_unlock(&g_video.mtx);
+
+  lv_timer_create(update_video_cb, 5, NULL);
+}
+
 int app_display_main(void *args) {
   settings.window_width = 1280;
   settings.window_height = 720;
@@ -80,6 +231,8 @@ int app_display_main(void *args) {
 
   lv_obj_set_style_bg_color(lv_scr_act(), lv_color_hex(0x000000), 0);
 
+  video_layer_init(lv_scr_act());
+
   lv_obj_t *container = lv_obj_create(lv_scr_act());
   lv_obj_set_size(container, LV_PCT(100), LV_PCT(100));
   lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
@@ -101,6 +254,8 @@ int app_display_main(void *args) {
 
   update_time_cb(NULL);
 
+  mic_indicator_init(lv_scr_act());
+
   lv_timer_create(update_time_cb, 1000, NULL);
 
   driver_backends_run_loop();
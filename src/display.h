@@ -5,4 +5,12 @@
 
 int app_display_main(void *args);
 
+/**
+ * Hand a decoded NV12 frame to the display's video layer
+ * Safe to call from any thread, converts into a preallocated back buffer
+ * Returns 0 if queued, -1 if dropped (not ready or previous frame pending)
+ */
+int app_display_push_nv12(const uint8_t *y, int y_stride, const uint8_t *uv,
+                          int uv_stride, int width, int height);
+
 #endif /* DISPLAY_H_ */
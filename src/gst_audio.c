@@ -1,4 +1,7 @@
 #include "audio.h"
+#include "gst_jitter.h"
+#include "jitter.h"
+#include "media.h"
 #include "utils.h"
 
 #include <gst/gst.h>
@@ -12,8 +15,12 @@
 #include <string.h>
 #include <unistd.h>
 
+// appsink "sink" takes the Opus frames, the optional appsink "raw" the same
+// capture as PCM for TOPIC_AUDIO_RAW
 static const char DEFAULT_MIC_PIPELINE[] =
-    "audiotestsrc ! opusenc ! appsink name=sink";
+    "audiotestsrc ! audio/x-raw,format=S16LE,rate=48000,channels=1 ! "
+    "tee name=t ! queue ! opusenc ! appsink name=sink "
+    "t. ! queue ! appsink name=raw";
 static const char DEFAULT_SPK_PIPELINE[] =
     "appsrc name=src format=time ! opusparse ! opusdec ! alsasink";
 
@@ -22,11 +29,18 @@ static char *g_spk_pipeline_desc = NULL;
 
 static GstElement *g_mic_pipeline = NULL;
 static GstElement *g_mic_sink = NULL;
+static GstElement *g_mic_raw_sink = NULL;
 static GstElement *g_spk_pipeline = NULL;
 static GstElement *g_spk_src = NULL;
 static nng_socket g_nng_audio_pub_sock = { .id = -1 };
 static nng_socket g_nng_audio_sub_sock = { .id = -1 };
+static nng_socket g_nng_raw_pub_sock = { .id = -1 };
 static volatile bool g_running = false;
+static uint32_t g_audio_seq = 0;
+static uint32_t g_raw_seq = 0;
+
+// From appsrc to alsasink output with its default buffering, roughly
+#define SPK_RENDER_US 40000
 
 static const char *get_mic_pipeline_desc(void) {
   return g_mic_pipeline_desc ? g_mic_pipeline_desc : DEFAULT_MIC_PIPELINE;
@@ -48,9 +62,33 @@ void app_audio_set_pipelines(const char *mic_pipeline,
   }
 }
 
-static GstFlowReturn on_audio_data(GstElement *sink, void *data) {
-  (void)data;
+// The pipelines carry their own device and buffering settings
+void app_audio_set_config(const AudioConfig *config) { (void)config; }
+
+void app_audio_get_stats(AudioStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+// opusenc is configured in the mic pipeline description instead
+void app_audio_set_opus(const AudioOpusConfig *opus) { (void)opus; }
 
+void app_audio_set_packet_loss(int percent) { (void)percent; }
+
+// The pipeline runs on the monotonic system clock, so base time plus
+// running time is the capture time on the media clock
+static uint64_t capture_us(GstElement *sink, GstBuffer *buffer) {
+  uint64_t now_us = media_now_us();
+  GstClockTime pts = GST_BUFFER_PTS(buffer);
+  if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+    return now_us;
+  }
+  return media_capture_us((gst_element_get_base_time(sink) + pts) / GST_USECOND,
+                          now_us);
+}
+
+// Publish an appsink's next buffer on sock behind a media_frame_hdr_t
+static GstFlowReturn publish_sample(GstElement *sink, nng_socket sock,
+                                    uint32_t *seq) {
   GstSample *sample = NULL;
   GstBuffer *buffer = NULL;
   GstMapInfo info;
@@ -73,10 +111,14 @@ static GstFlowReturn on_audio_data(GstElement *sink, void *data) {
 
   if (info.size > 0) {
     nng_msg *msg = NULL;
-    int rv = nng_msg_alloc(&msg, info.size);
+    int rv = nng_msg_alloc(&msg, sizeof(media_frame_hdr_t) + info.size);
     if (rv == 0) {
-      memcpy(nng_msg_body(msg), info.data, info.size);
-      rv = nng_sendmsg(g_nng_audio_pub_sock, msg, 0);
+      media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+      hdr->flags = 0;
+      hdr->seq = (*seq)++;
+      hdr->pts_us = capture_us(sink, buffer);
+      memcpy(hdr + 1, info.data, info.size);
+      rv = nng_sendmsg(sock, msg, 0);
       if (rv != 0) {
         LOGE("gst_audio: nng_sendmsg error: %s", nng_strerror(rv));
         nng_msg_free(msg);
@@ -91,6 +133,16 @@ static GstFlowReturn on_audio_data(GstElement *sink, void *data) {
   return GST_FLOW_OK;
 }
 
+static GstFlowReturn on_audio_data(GstElement *sink, void *data) {
+  (void)data;
+  return publish_sample(sink, g_nng_audio_pub_sock, &g_audio_seq);
+}
+
+static GstFlowReturn on_raw_data(GstElement *sink, void *data) {
+  (void)data;
+  return publish_sample(sink, g_nng_raw_pub_sock, &g_raw_seq);
+}
+
 int app_audio_main(void *arg) {
   (void)arg;
 
@@ -111,6 +163,14 @@ int app_audio_main(void *arg) {
     return 1;
   }
 
+  if ((err = nng_pub0_open(&g_nng_raw_pub_sock)) != 0 ||
+      (err = nng_listen(g_nng_raw_pub_sock, TOPIC_AUDIO_RAW, NULL, 0)) != 0) {
+    LOGE("app_audio_main: NNG publisher on %s: %s", TOPIC_AUDIO_RAW,
+         nng_strerror(err));
+    app_audio_quit();
+    return 1;
+  }
+
   g_mic_pipeline = gst_parse_launch(get_mic_pipeline_desc(), NULL);
   if (!g_mic_pipeline) {
     LOGE("app_audio_main: failed to create mic pipeline");
@@ -132,6 +192,13 @@ int app_audio_main(void *arg) {
     return 1;
   }
 
+  // Without it PCM consumers get nothing, the Opus path is unaffected
+  g_mic_raw_sink = gst_bin_get_by_name(GST_BIN(g_mic_pipeline), "raw");
+  if (!g_mic_raw_sink) {
+    LOGI("app_audio_main: mic pipeline has no raw appsink, %s stays empty",
+         TOPIC_AUDIO_RAW);
+  }
+
   g_spk_src = gst_bin_get_by_name(GST_BIN(g_spk_pipeline), "src");
   if (!g_spk_src) {
     LOGE("app_audio_main: failed to get spk appsrc");
@@ -141,6 +208,11 @@ int app_audio_main(void *arg) {
 
   g_signal_connect(g_mic_sink, "new-sample", G_CALLBACK(on_audio_data), NULL);
   g_object_set(g_mic_sink, "emit-signals", TRUE, NULL);
+  if (g_mic_raw_sink) {
+    g_signal_connect(g_mic_raw_sink, "new-sample", G_CALLBACK(on_raw_data),
+                     NULL);
+    g_object_set(g_mic_raw_sink, "emit-signals", TRUE, NULL);
+  }
   g_object_set(g_spk_src, "emit-signals", TRUE, NULL);
 
   gst_element_set_state(g_mic_pipeline, GST_STATE_PLAYING);
@@ -159,27 +231,26 @@ int app_audio_main(void *arg) {
     return 1;
   }
 
+  jitter_buffer_t jb;
+  jitter_init(&jb, DEFAULT_FRAME_SIZE_MS * 1000,
+              JITTER_DEFAULT_MIN_DELAY_US, JITTER_DEFAULT_MAX_DELAY_US);
+  jitter_set_sync(&jb, &jitter_call_sync, JITTER_STREAM_AUDIO, SPK_RENDER_US);
+  // One opusdec in the speaker pipeline: the call only, no mixing
+  jb.track = AUDIO_TRACK_CALL;
+
   g_running = true;
   while (g_running) {
-    uint8_t *buf = NULL;
-    size_t sz = 0;
-    int rv = nng_recv(g_nng_audio_sub_sock, &buf, &sz,
-                      NNG_FLAG_ALLOC | NNG_FLAG_NONBLOCK);
-    if (rv == 0 && buf && sz > 0) {
-      GstBuffer *gst_buf = gst_buffer_new_and_alloc(sz);
-      GstMapInfo info;
-      if (gst_buffer_map(gst_buf, &info, GST_MAP_WRITE)) {
-        memcpy(info.data, buf, sz);
-        info.size = sz;
-        GstFlowReturn *ret = NULL;
-        g_signal_emit_by_name(g_spk_src, "push-buffer", gst_buf, &ret);
-        gst_buffer_unmap(gst_buf, &info);
-      }
-      gst_buffer_unref(gst_buf);
-      nng_free(buf, sz);
+    nng_msg *msg;
+    if (jitter_recv(&jb, g_nng_audio_sub_sock, 100) != 0) {
+      break;
+    }
+    while ((msg = jitter_pop(&jb, media_now_us())) != NULL) {
+      gst_jitter_push(g_spk_src, msg);
     }
-    usleep(1000);
   }
+  LOGI("app_audio_main: jitter buffer played %u late %u lost %u stalled %u",
+       jb.played, jb.late, jb.lost, jb.stall);
+  jitter_reset(&jb);
 
   app_audio_quit();
   return 0;
@@ -199,6 +270,10 @@ void app_audio_quit(void) {
     g_object_unref(g_mic_sink);
     g_mic_sink = NULL;
   }
+  if (g_mic_raw_sink) {
+    g_object_unref(g_mic_raw_sink);
+    g_mic_raw_sink = NULL;
+  }
   if (g_spk_src) {
     g_object_unref(g_spk_src);
     g_spk_src = NULL;
@@ -226,4 +301,8 @@ void app_audio_quit(void) {
     nng_close(g_nng_audio_pub_sock);
     g_nng_audio_pub_sock.id = -1;
   }
+  if (nng_socket_id(g_nng_raw_pub_sock) != -1) {
+    nng_close(g_nng_raw_pub_sock);
+    g_nng_raw_pub_sock.id = -1;
+  }
 }
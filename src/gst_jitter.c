@@ -0,0 +1,13 @@
+#include "gst_jitter.h"
+#include "media.h"
+
+void gst_jitter_push(GstElement *src, nng_msg *msg) {
+  size_t len = nng_msg_len(msg);
+  GstBuffer *buf = gst_buffer_new_wrapped_full(
+      GST_MEMORY_FLAG_READONLY, nng_msg_body(msg), len,
+      sizeof(media_frame_hdr_t), len - sizeof(media_frame_hdr_t), msg,
+      (GDestroyNotify)nng_msg_free);
+  GstFlowReturn ret;
+  g_signal_emit_by_name(src, "push-buffer", buf, &ret);
+  gst_buffer_unref(buf);
+}
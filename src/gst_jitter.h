@@ -0,0 +1,13 @@
+#ifndef GST_JITTER_H_
+#define GST_JITTER_H_
+
+#include <gst/gst.h>
+#include <nng/nng.h>
+
+/**
+ * Hand a frame released by jitter_pop() to appsrc without copying; the
+ * GstBuffer takes msg and frees it once the pipeline is done with it
+ */
+void gst_jitter_push(GstElement *src, nng_msg *msg);
+
+#endif // GST_JITTER_H_
@@ -1,7 +1,14 @@
 #include "video.h"
+#include "display.h"
+#include "gst_jitter.h"
+#include "jitter.h"
+#include "media.h"
+#include "snapshot.h"
 #include "utils.h"
+#include "video_bus.h"
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <nng/nng.h>
 #include <nng/protocol/pubsub0/pub.h>
 #include <nng/protocol/pubsub0/sub.h>
@@ -12,28 +19,79 @@
 #include <string.h>
 #include <unistd.h>
 
-static const char DEFAULT_CAM_PIPELINE[] =
-    "libcamerasrc ! video/x-raw,width=1280,height=720,format=NV12 ! v4l2convert "
+// Snapshot branch: the valve stays closed until a snapshot is requested, so
+// jpegenc only runs on demand and the H.264 branch never waits on it
+#define CAM_SNAPSHOT_BRANCH                                                    \
+  "t. ! queue leaky=downstream max-size-buffers=1 "                           \
+  "! valve name=snapvalve drop=true ! jpegenc "                                \
+  "! appsink name=snapsink sync=false max-buffers=1 drop=true"
+static const char DEFAULT_CAM_PIPELINE_FMT[] =
+    "libcamerasrc ! video/x-raw,width=1280,height=720,format=NV12,"
+    "framerate=%d/1 ! tee name=t "
+    "t. ! queue ! v4l2convert "
     "! v4l2h264enc extra-controls=\"controls,repeat_sequence_header=1\" "
-    "! video/x-h264,level=(string)4 ! appsink name=sink";
+    "! video/x-h264,level=(string)4 ! appsink name=sink " CAM_SNAPSHOT_BRANCH;
+// With [video] sub_width set, the camera is split and a second encoder
+// feeds the optional "subsink" appsink
+static const char DEFAULT_CAM_PIPELINE_SUB_FMT[] =
+    "libcamerasrc ! video/x-raw,width=1280,height=720,format=NV12,"
+    "framerate=%d/1 ! tee name=t "
+    "t. ! queue ! v4l2convert "
+    "! v4l2h264enc extra-controls=\"controls,repeat_sequence_header=1\" "
+    "! video/x-h264,level=(string)4 ! appsink name=sink "
+    "t. ! queue leaky=downstream max-size-buffers=2 ! v4l2convert "
+    "! video/x-raw,width=%d,height=%d "
+    "! v4l2h264enc extra-controls=\"controls,repeat_sequence_header=1,"
+    "video_bitrate=%d\" ! video/x-h264,level=(string)4 "
+    "! appsink name=subsink " CAM_SNAPSHOT_BRANCH;
+// Decoded frames go to the LVGL display app through an appsink named
+// "sink"; a pipeline ending in its own video sink is also accepted.
 static const char DEFAULT_DIS_PIPELINE[] =
     "appsrc name=src is-live=true do-timestamp=true format=time "
     "! queue ! h264parse ! v4l2h264dec qos=false output-io-mode=4 "
-    "capture-io-mode=4 ! glimagesink";
+    "capture-io-mode=4 ! video/x-raw,format=NV12 "
+    "! appsink name=sink sync=false max-buffers=1 drop=true";
 
 static char *g_cam_pipeline_desc = NULL;
 static char *g_dis_pipeline_desc = NULL;
+static char g_default_cam_pipeline_desc[1024];
+static VideoConfig g_config = {
+    .fps = VIDEO_DEFAULT_FPS,
+    .loop = 1,
+};
 
 static GstElement *g_cam_pipeline = NULL;
 static GstElement *g_cam_sink = NULL;
+static GstElement *g_cam_subsink = NULL;
+static GstElement *g_cam_snapsink = NULL;
+static GstElement *g_cam_snapvalve = NULL;
+static snapshot_service_t g_snapshot;
 static GstElement *g_dis_pipeline = NULL;
 static GstElement *g_dis_src = NULL;
-static nng_socket g_nng_video_pub_sock = { .id = -1 };
+static GstElement *g_dis_sink = NULL;
+static video_bus_t g_video_bus;
+static bool g_video_bus_open = false;
+static video_bus_t g_sub_bus;
+static bool g_sub_bus_open = false;
 static nng_socket g_nng_video_sub_sock = { .id = -1 };
 static volatile bool g_running = false;
 
 static const char *get_cam_pipeline_desc(void) {
-  return g_cam_pipeline_desc ? g_cam_pipeline_desc : DEFAULT_CAM_PIPELINE;
+  if (g_cam_pipeline_desc) {
+    return g_cam_pipeline_desc;
+  }
+  int fps = g_config.fps > 0 ? g_config.fps : VIDEO_DEFAULT_FPS;
+  if (g_config.sub_width > 0) {
+    int height = g_config.sub_height > 0 ? g_config.sub_height
+                                         : (g_config.sub_width * 9 / 16) & ~1;
+    snprintf(g_default_cam_pipeline_desc, sizeof(g_default_cam_pipeline_desc),
+             DEFAULT_CAM_PIPELINE_SUB_FMT, fps, g_config.sub_width, height,
+             g_config.sub_bitrate_kbps * 1000);
+  } else {
+    snprintf(g_default_cam_pipeline_desc, sizeof(g_default_cam_pipeline_desc),
+             DEFAULT_CAM_PIPELINE_FMT, fps);
+  }
+  return g_default_cam_pipeline_desc;
 }
 
 static const char *get_dis_pipeline_desc(void) {
@@ -52,8 +110,23 @@ void app_video_set_pipelines(const char *cam_pipeline,
   }
 }
 
+void app_video_set_config(const VideoConfig *config) { g_config = *config; }
+
+// The pipeline runs on the monotonic system clock, so base time plus
+// running time is the capture time on the media clock
+static uint64_t capture_us(GstElement *sink, GstBuffer *buffer) {
+  uint64_t now_us = media_now_us();
+  GstClockTime pts = GST_BUFFER_PTS(buffer);
+  if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+    return now_us;
+  }
+  return media_capture_us((gst_element_get_base_time(sink) + pts) / GST_USECOND,
+                          now_us);
+}
+
+// data is the video_bus_t the sink publishes on
 static GstFlowReturn on_video_data(GstElement *sink, void *data) {
-  (void)data;
+  video_bus_t *bus = (video_bus_t *)data;
 
   GstSample *sample = NULL;
   GstBuffer *buffer = NULL;
@@ -76,18 +149,8 @@ static GstFlowReturn on_video_data(GstElement *sink, void *data) {
   }
 
   if (info.size > 0) {
-    nng_msg *msg = NULL;
-    int rv = nng_msg_alloc(&msg, info.size);
-    if (rv == 0) {
-      memcpy(nng_msg_body(msg), info.data, info.size);
-      rv = nng_sendmsg(g_nng_video_pub_sock, msg, 0);
-      if (rv != 0) {
-        LOGE("gst_video: nng_sendmsg error: %s", nng_strerror(rv));
-        nng_msg_free(msg);
-      }
-    } else {
-      LOGE("gst_video: nng_msg_alloc error: %s", nng_strerror(rv));
-    }
+    video_bus_publish(bus, info.data, info.size,
+                      capture_us(sink, buffer));
   }
 
   gst_buffer_unmap(buffer, &info);
@@ -95,6 +158,93 @@ static GstFlowReturn on_video_data(GstElement *sink, void *data) {
   return GST_FLOW_OK;
 }
 
+static GstFlowReturn on_display_frame(GstElement *sink, void *data) {
+  (void)data;
+
+  GstSample *sample = NULL;
+  GstBuffer *buffer = NULL;
+  GstVideoInfo vinfo;
+  GstVideoFrame frame;
+
+  g_signal_emit_by_name(sink, "pull-sample", &sample);
+  if (!sample) {
+    return GST_FLOW_ERROR;
+  }
+
+  buffer = gst_sample_get_buffer(sample);
+  if (!buffer ||
+      !gst_video_info_from_caps(&vinfo, gst_sample_get_caps(sample))) {
+    gst_sample_unref(sample);
+    return GST_FLOW_ERROR;
+  }
+
+  if (GST_VIDEO_INFO_FORMAT(&vinfo) != GST_VIDEO_FORMAT_NV12) {
+    LOGW("gst_video: display sink expects NV12, got %s",
+         gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&vinfo)));
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+  }
+
+  if (gst_video_frame_map(&frame, &vinfo, buffer, GST_MAP_READ)) {
+    app_display_push_nv12(GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+                          GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0),
+                          GST_VIDEO_FRAME_PLANE_DATA(&frame, 1),
+                          GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 1),
+                          GST_VIDEO_FRAME_WIDTH(&frame),
+                          GST_VIDEO_FRAME_HEIGHT(&frame));
+    gst_video_frame_unmap(&frame);
+  }
+
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
+
+// Open the snapshot valve for the next camera frame and wait for its JPEG
+static int snapshot_capture(void *ctx, nng_msg **jpeg, int timeout_ms) {
+  (void)ctx;
+
+  GstSample *sample = NULL;
+  GstBuffer *buffer;
+  GstMapInfo info;
+  int rv = -1;
+
+  // Discard a picture that slipped through after the previous request
+  g_signal_emit_by_name(g_cam_snapsink, "try-pull-sample", (GstClockTime)0,
+                        &sample);
+  if (sample) {
+    gst_sample_unref(sample);
+    sample = NULL;
+  }
+
+  g_object_set(g_cam_snapvalve, "drop", FALSE, NULL);
+  g_signal_emit_by_name(g_cam_snapsink, "try-pull-sample",
+                        (GstClockTime)timeout_ms * GST_MSECOND, &sample);
+  g_object_set(g_cam_snapvalve, "drop", TRUE, NULL);
+  if (!sample) {
+    LOGW("gst_video: no snapshot within %d ms", timeout_ms);
+    return -1;
+  }
+
+  buffer = gst_sample_get_buffer(sample);
+  if (buffer && gst_buffer_map(buffer, &info, GST_MAP_READ)) {
+    if (info.size > 0 && nng_msg_alloc(jpeg, info.size) == 0) {
+      memcpy(nng_msg_body(*jpeg), info.data, info.size);
+      rv = 0;
+    }
+    gst_buffer_unmap(buffer, &info);
+  }
+  gst_sample_unref(sample);
+  return rv;
+}
+
+// Keyframe topic requests for a new GOP go up to the encoder feeding sink
+static void request_idr(void *arg) {
+  gst_element_send_event(
+      (GstElement *)arg,
+      gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE,
+                                                  0));
+}
+
 int app_video_main(void *arg) {
   (void)arg;
 
@@ -102,17 +252,19 @@ int app_video_main(void *arg) {
 
   gst_init(NULL, NULL);
 
-  if ((err = nng_pub0_open(&g_nng_video_pub_sock)) != 0) {
-    LOGE("app_video_main: nng_pub0_open error: %s", nng_strerror(err));
+  if (video_bus_open(&g_video_bus, TOPIC_VIDEO_COMPRESSED,
+                     TOPIC_VIDEO_KEYFRAME) < 0) {
+    LOGE("app_video_main: failed to open video bus");
     return 1;
   }
-
-  if ((err = nng_listen(g_nng_video_pub_sock, TOPIC_VIDEO_COMPRESSED, NULL,
-                        0)) != 0) {
-    LOGE("app_video_main: nng_listen error: %s", nng_strerror(err));
-    nng_close(g_nng_video_pub_sock);
-    g_nng_video_pub_sock.id = -1;
-    return 1;
+  g_video_bus_open = true;
+  // v4l2h264enc exposes no reference structure control; frames the encoder
+  // leaves unreferenced are still flagged discardable by the bus
+  if (g_config.temporal_layers > 1) {
+    LOGW("app_video_main: temporal layers are not supported, using one");
+  }
+  if (g_config.osd.enabled) {
+    LOGW("app_video_main: overlays need the RK encoder, osd disabled");
   }
 
   g_cam_pipeline = gst_parse_launch(get_cam_pipeline_desc(), NULL);
@@ -143,8 +295,42 @@ int app_video_main(void *arg) {
     return 1;
   }
 
-  g_signal_connect(g_cam_sink, "new-sample", G_CALLBACK(on_video_data), NULL);
+  g_dis_sink = gst_bin_get_by_name(GST_BIN(g_dis_pipeline), "sink");
+  if (g_dis_sink) {
+    g_signal_connect(g_dis_sink, "new-sample", G_CALLBACK(on_display_frame),
+                     NULL);
+    g_object_set(g_dis_sink, "emit-signals", TRUE, NULL);
+  }
+
+  g_signal_connect(g_cam_sink, "new-sample", G_CALLBACK(on_video_data),
+                   &g_video_bus);
+  video_bus_set_idr_handler(&g_video_bus, request_idr, g_cam_sink);
   g_object_set(g_cam_sink, "emit-signals", TRUE, NULL);
+
+  g_cam_subsink = gst_bin_get_by_name(GST_BIN(g_cam_pipeline), "subsink");
+  if (g_cam_subsink) {
+    if (video_bus_open(&g_sub_bus, TOPIC_VIDEO_COMPRESSED_SUB,
+                       TOPIC_VIDEO_KEYFRAME_SUB) == 0) {
+      g_sub_bus_open = true;
+      g_signal_connect(g_cam_subsink, "new-sample", G_CALLBACK(on_video_data),
+                       &g_sub_bus);
+      video_bus_set_idr_handler(&g_sub_bus, request_idr, g_cam_subsink);
+      g_object_set(g_cam_subsink, "emit-signals", TRUE, NULL);
+    } else {
+      LOGE("app_video_main: failed to open sub stream bus");
+    }
+  }
+
+  // Custom pipelines may leave out the snapshot branch
+  g_cam_snapsink = gst_bin_get_by_name(GST_BIN(g_cam_pipeline), "snapsink");
+  g_cam_snapvalve = gst_bin_get_by_name(GST_BIN(g_cam_pipeline), "snapvalve");
+  if (g_cam_snapsink && g_cam_snapvalve) {
+    int fps = g_config.fps > 0 ? g_config.fps : VIDEO_DEFAULT_FPS;
+    // One frame interval to reach the valve, one for the software encoder
+    snapshot_service_open(&g_snapshot, TOPIC_VIDEO_SNAPSHOT, snapshot_capture,
+                          NULL, 2 * 1000 / fps + 1);
+  }
+
   g_object_set(g_dis_src, "emit-signals", TRUE, "is-live", TRUE,
                "do-timestamp", TRUE, "block", FALSE, NULL);
 
@@ -164,27 +350,29 @@ int app_video_main(void *arg) {
     return 1;
   }
 
+  jitter_buffer_t jb;
+  int fps = g_config.fps > 0 ? g_config.fps : VIDEO_DEFAULT_FPS;
+  // The far end's frame rate is unknown, start from ours and follow arrivals
+  jitter_init(&jb, 1000000 / fps, JITTER_DEFAULT_MIN_DELAY_US,
+              JITTER_DEFAULT_MAX_DELAY_US);
+  jitter_track_interval(&jb);
+  // One frame to decode, one more until the display timer picks it up
+  jitter_set_sync(&jb, &jitter_call_sync, JITTER_STREAM_VIDEO,
+                  2 * 1000000 / fps);
+
   g_running = true;
   while (g_running) {
-    uint8_t *buf = NULL;
-    size_t sz = 0;
-    int rv = nng_recv(g_nng_video_sub_sock, &buf, &sz,
-                      NNG_FLAG_ALLOC | NNG_FLAG_NONBLOCK);
-    if (rv == 0 && buf && sz > 0) {
-      GstBuffer *gst_buf = gst_buffer_new_and_alloc(sz);
-      GstMapInfo info;
-      if (gst_buffer_map(gst_buf, &info, GST_MAP_WRITE)) {
-        memcpy(info.data, buf, sz);
-        info.size = sz;
-        GstFlowReturn *ret = NULL;
-        g_signal_emit_by_name(g_dis_src, "push-buffer", gst_buf, &ret);
-        gst_buffer_unmap(gst_buf, &info);
-      }
-      gst_buffer_unref(gst_buf);
-      nng_free(buf, sz);
+    nng_msg *msg;
+    if (jitter_recv(&jb, g_nng_video_sub_sock, 100) != 0) {
+      break;
+    }
+    while ((msg = jitter_pop(&jb, media_now_us())) != NULL) {
+      gst_jitter_push(g_dis_src, msg);
     }
-    usleep(1000);
   }
+  LOGI("app_video_main: jitter buffer played %u late %u lost %u stalled %u",
+       jb.played, jb.late, jb.lost, jb.stall);
+  jitter_reset(&jb);
 
   app_video_quit();
   return 0;
@@ -193,6 +381,8 @@ int app_video_main(void *arg) {
 void app_video_quit(void) {
   g_running = false;
 
+  snapshot_service_close(&g_snapshot);
+
   if (g_cam_pipeline) {
     gst_element_set_state(g_cam_pipeline, GST_STATE_NULL);
   }
@@ -200,14 +390,38 @@ void app_video_quit(void) {
     gst_element_set_state(g_dis_pipeline, GST_STATE_NULL);
   }
 
+  // The keyframe threads outlive the sinks they send IDR requests through
+  if (g_video_bus_open) {
+    video_bus_set_idr_handler(&g_video_bus, NULL, NULL);
+  }
+  if (g_sub_bus_open) {
+    video_bus_set_idr_handler(&g_sub_bus, NULL, NULL);
+  }
+
   if (g_cam_sink) {
     g_object_unref(g_cam_sink);
     g_cam_sink = NULL;
   }
+  if (g_cam_subsink) {
+    g_object_unref(g_cam_subsink);
+    g_cam_subsink = NULL;
+  }
+  if (g_cam_snapsink) {
+    g_object_unref(g_cam_snapsink);
+    g_cam_snapsink = NULL;
+  }
+  if (g_cam_snapvalve) {
+    g_object_unref(g_cam_snapvalve);
+    g_cam_snapvalve = NULL;
+  }
   if (g_dis_src) {
     g_object_unref(g_dis_src);
     g_dis_src = NULL;
   }
+  if (g_dis_sink) {
+    g_object_unref(g_dis_sink);
+    g_dis_sink = NULL;
+  }
 
   if (g_cam_pipeline) {
     g_object_unref(g_cam_pipeline);
@@ -227,8 +441,12 @@ void app_video_quit(void) {
     nng_close(g_nng_video_sub_sock);
     g_nng_video_sub_sock.id = -1;
   }
-  if (nng_socket_id(g_nng_video_pub_sock) != -1) {
-    nng_close(g_nng_video_pub_sock);
-    g_nng_video_pub_sock.id = -1;
+  if (g_video_bus_open) {
+    video_bus_close(&g_video_bus);
+    g_video_bus_open = false;
+  }
+  if (g_sub_bus_open) {
+    video_bus_close(&g_sub_bus);
+    g_sub_bus_open = false;
   }
 }
@@ -0,0 +1,242 @@
+#include "h264.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Locate the next 00 00 01 triplet. The vector loops only decide whether a
+// 16-byte block can hold the start of a triplet; most blocks of slice data
+// contain no zero byte at all and are skipped after a single compare.
+static const uint8_t *find_001(const uint8_t *p, const uint8_t *end) {
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  while (p + 18 <= end) {
+    __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), zero);
+    if (_mm_movemask_epi8(a) == 0) {
+      p += 16;
+      continue;
+    }
+    __m128i b =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), zero);
+    __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), one);
+    int m = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c));
+    if (m) {
+      return p + __builtin_ctz(m);
+    }
+    p += 16;
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t zero = vdupq_n_u8(0);
+  const uint8x16_t one = vdupq_n_u8(1);
+  while (p + 18 <= end) {
+    uint8x16_t a = vceqq_u8(vld1q_u8(p), zero);
+    uint8x16_t b = vceqq_u8(vld1q_u8(p + 1), zero);
+    uint8x16_t c = vceqq_u8(vld1q_u8(p + 2), one);
+    uint64x2_t m = vreinterpretq_u64_u8(vandq_u8(vandq_u8(a, b), c));
+    if (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) {
+      break; // the scalar loop below pins down the offset in this block
+    }
+    p += 16;
+  }
+#endif
+  while (p + 3 <= end) {
+    if (p[2] > 1) {
+      p += 3;
+    } else if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+      return p;
+    } else {
+      p++;
+    }
+  }
+  return end;
+}
+
+const uint8_t *h264_find_start_code(const uint8_t *p, const uint8_t *end,
+                                    int *sc_len) {
+  const uint8_t *start = p;
+  const uint8_t *q = find_001(p, end);
+  if (q == end) {
+    return end;
+  }
+  if (q > start && q[-1] == 0) {
+    *sc_len = 4;
+    return q - 1;
+  }
+  *sc_len = 3;
+  return q;
+}
+
+void h264_au_reader_init(h264_au_reader_t *r, const uint8_t *buf,
+                         size_t size) {
+  int sc_len;
+  r->end = buf + size;
+  r->buf = h264_find_start_code(buf, r->end, &sc_len);
+  r->pos = r->buf;
+}
+
+void h264_au_reader_rewind(h264_au_reader_t *r) { r->pos = r->buf; }
+
+// Whether a NAL of this type opens a new access unit once the current one
+// already holds a slice (H.264 7.4.1.2.3, primary pictures only)
+static int h264_nal_starts_au(int type, const uint8_t *hdr,
+                              const uint8_t *end) {
+  switch (type) {
+  case H264_NALU_AUD:
+  case H264_NALU_SEI:
+  case H264_NALU_SPS:
+  case H264_NALU_PPS:
+  case 14: // prefix NAL
+  case 15: // subset SPS
+    return 1;
+  case H264_NALU_NON_IDR:
+  case H264_NALU_IDR:
+    // first_mb_in_slice == 0 is coded as a single '1' bit
+    return hdr + 1 < end && (hdr[1] & 0x80);
+  default:
+    return 0;
+  }
+}
+
+int h264_au_reader_next(h264_au_reader_t *r, h264_au_t *au) {
+  const uint8_t *nal = r->pos;
+  const uint8_t *end = r->end;
+  int seen_vcl = 0;
+  int flags = 0;
+
+  if (nal >= end) {
+    return -1;
+  }
+
+  while (nal < end) {
+    int sc_len = nal[2] == 1 ? 3 : 4;
+    const uint8_t *hdr = nal + sc_len;
+    if (hdr >= end) {
+      nal = end;
+      break;
+    }
+    int type = hdr[0] & 0x1f;
+    if (seen_vcl && h264_nal_starts_au(type, hdr, end)) {
+      break;
+    }
+    switch (type) {
+    case H264_NALU_IDR:
+      flags |= H264_AU_FLAG_IDR;
+      seen_vcl = 1;
+      break;
+    case H264_NALU_NON_IDR:
+      seen_vcl = 1;
+      break;
+    case H264_NALU_SPS:
+      flags |= H264_AU_FLAG_SPS;
+      break;
+    case H264_NALU_PPS:
+      flags |= H264_AU_FLAG_PPS;
+      break;
+    default:
+      break;
+    }
+    nal = h264_find_start_code(hdr + 1, end, &sc_len);
+  }
+
+  au->data = r->pos;
+  au->size = nal - r->pos;
+  au->flags = flags;
+  r->pos = nal;
+  return 0;
+}
+
+// Call fn for every NAL unit of an access unit, start code included
+static int h264_for_each_nal(const uint8_t *au, size_t size,
+                             void (*fn)(void *, int, const uint8_t *, size_t),
+                             void *arg) {
+  const uint8_t *end = au + size;
+  int flags = 0;
+  int sc_len = 0;
+  int slices = 0;
+  int ref_slices = 0;
+  const uint8_t *nal = h264_find_start_code(au, end, &sc_len);
+
+  while (nal < end) {
+    const uint8_t *hdr = nal + sc_len;
+    const uint8_t *next = end;
+    int next_sc_len = 0;
+    if (hdr < end) {
+      next = h264_find_start_code(hdr + 1, end, &next_sc_len);
+      int type = hdr[0] & 0x1f;
+      if (type == H264_NALU_IDR) {
+        flags |= H264_AU_FLAG_IDR;
+      } else if (type == H264_NALU_SPS) {
+        flags |= H264_AU_FLAG_SPS;
+      } else if (type == H264_NALU_PPS) {
+        flags |= H264_AU_FLAG_PPS;
+      }
+      if (type == H264_NALU_IDR || type == H264_NALU_NON_IDR) {
+        slices++;
+        ref_slices += (hdr[0] & 0x60) != 0;
+      }
+      if (fn) {
+        fn(arg, type, nal, next - nal);
+      }
+    }
+    nal = next;
+    sc_len = next_sc_len;
+  }
+  if (slices && !ref_slices) {
+    flags |= H264_AU_FLAG_NONREF;
+  }
+  return flags;
+}
+
+int h264_au_flags(const uint8_t *au, size_t size) {
+  return h264_for_each_nal(au, size, NULL, NULL);
+}
+
+void h264_param_cache_init(h264_param_cache_t *c) {
+  memset(c, 0, sizeof(*c));
+}
+
+void h264_param_cache_destroy(h264_param_cache_t *c) {
+  free(c->keyframe);
+  memset(c, 0, sizeof(*c));
+}
+
+static void h264_param_cache_store(void *arg, int type, const uint8_t *nal,
+                                   size_t size) {
+  h264_param_cache_t *c = (h264_param_cache_t *)arg;
+  if (size > H264_PARAM_SET_MAX) {
+    return;
+  }
+  if (type == H264_NALU_SPS) {
+    memcpy(c->sps, nal, size);
+    c->sps_size = size;
+  } else if (type == H264_NALU_PPS) {
+    memcpy(c->pps, nal, size);
+    c->pps_size = size;
+  }
+}
+
+int h264_param_cache_update(h264_param_cache_t *c, const uint8_t *au,
+                            size_t size) {
+  return h264_for_each_nal(au, size, h264_param_cache_store, c);
+}
+
+int h264_param_cache_set_keyframe(h264_param_cache_t *c, const uint8_t *au,
+                                  size_t size) {
+  if (size > c->keyframe_capacity) {
+    uint8_t *buf = (uint8_t *)realloc(c->keyframe, size);
+    if (!buf) {
+      return -1;
+    }
+    c->keyframe = buf;
+    c->keyframe_capacity = size;
+  }
+  memcpy(c->keyframe, au, size);
+  c->keyframe_size = size;
+  return 0;
+}
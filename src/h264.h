@@ -0,0 +1,101 @@
+#ifndef H264_H_
+#define H264_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * h264 - Annex-B bitstream helpers
+ * start code scanning and access unit splitting, no allocation
+ */
+typedef enum {
+  H264_NALU_NON_IDR = 1,
+  H264_NALU_IDR = 5,
+  H264_NALU_SEI = 6,
+  H264_NALU_SPS = 7,
+  H264_NALU_PPS = 8,
+  H264_NALU_AUD = 9,
+} h264_nalu_type_t;
+
+#define H264_AU_FLAG_IDR 0x01
+#define H264_AU_FLAG_SPS 0x02
+#define H264_AU_FLAG_PPS 0x04
+#define H264_AU_FLAG_NONREF 0x08 // every slice has nal_ref_idc == 0
+
+// An access unit, pointing into the caller's buffer (start codes included)
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  int flags; // H264_AU_FLAG_*
+} h264_au_t;
+
+#define H264_PARAM_SET_MAX 256
+
+// Latest parameter sets and keyframe seen on a stream
+typedef struct {
+  uint8_t sps[H264_PARAM_SET_MAX]; // with start code
+  size_t sps_size;
+  uint8_t pps[H264_PARAM_SET_MAX];
+  size_t pps_size;
+  uint8_t *keyframe; // SPS + PPS + IDR access unit
+  size_t keyframe_size;
+  size_t keyframe_capacity;
+} h264_param_cache_t;
+
+typedef struct {
+  const uint8_t *buf;
+  const uint8_t *end;
+  const uint8_t *pos; // start code of the next unread NAL
+} h264_au_reader_t;
+
+/**
+ * Find the next start code in [p, end)
+ * Returns a pointer to its first byte (including the leading zero of a
+ * 4-byte code) or end if there is none; *sc_len receives 3 or 4
+ */
+const uint8_t *h264_find_start_code(const uint8_t *p, const uint8_t *end,
+                                    int *sc_len);
+
+/**
+ * Initialize an access unit reader over buf
+ * Bytes before the first start code are skipped
+ */
+void h264_au_reader_init(h264_au_reader_t *r, const uint8_t *buf,
+                         size_t size);
+
+/**
+ * Rewind the reader to the first access unit
+ */
+void h264_au_reader_rewind(h264_au_reader_t *r);
+
+/**
+ * Get the next access unit
+ * Returns 0 if success, -1 at end of buffer
+ */
+int h264_au_reader_next(h264_au_reader_t *r, h264_au_t *au);
+
+/**
+ * Get the H264_AU_FLAG_* of an access unit without touching any cache
+ */
+int h264_au_flags(const uint8_t *au, size_t size);
+
+void h264_param_cache_init(h264_param_cache_t *c);
+
+void h264_param_cache_destroy(h264_param_cache_t *c);
+
+/**
+ * Record the SPS/PPS carried by an access unit
+ * Returns its H264_AU_FLAG_*
+ */
+int h264_param_cache_update(h264_param_cache_t *c, const uint8_t *au,
+                            size_t size);
+
+/**
+ * Keep a copy of a complete keyframe (parameter sets included)
+ * The buffer only grows, so steady state costs one memcpy per GOP
+ * Returns 0 if success, -1 if memory allocation failed
+ */
+int h264_param_cache_set_keyframe(h264_param_cache_t *c, const uint8_t *au,
+                                  size_t size);
+
+#endif // H264_H_
@@ -0,0 +1,103 @@
+#include "h264_file.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC 1000000000L
+
+int h264_file_open(h264_file_t *f, const char *path, int fps, int loop) {
+  struct stat st;
+
+  memset(f, 0, sizeof(*f));
+  f->fd = open(path, O_RDONLY);
+  if (f->fd < 0) {
+    LOGE("h264_file_open: open %s: %s", path, strerror(errno));
+    return -1;
+  }
+
+  if (fstat(f->fd, &st) < 0 || st.st_size == 0) {
+    LOGE("h264_file_open: %s is empty or unreadable", path);
+    close(f->fd);
+    return -1;
+  }
+
+  f->size = st.st_size;
+  f->map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+  if (f->map == MAP_FAILED) {
+    LOGE("h264_file_open: mmap %s: %s", path, strerror(errno));
+    close(f->fd);
+    f->map = NULL;
+    return -1;
+  }
+  // Looping replays the whole file, keep it resident after the first pass
+  madvise(f->map, f->size, loop ? MADV_WILLNEED : MADV_SEQUENTIAL);
+
+  h264_au_reader_init(&f->reader, f->map, f->size);
+  if (f->reader.buf == f->reader.end) {
+    LOGE("h264_file_open: no start code in %s", path);
+    h264_file_close(f);
+    return -1;
+  }
+
+  f->loop = loop;
+  f->period_ns = fps > 0 ? NSEC_PER_SEC / fps : 0;
+  clock_gettime(CLOCK_MONOTONIC, &f->deadline);
+  LOGI("h264_file_open: %s, %zu bytes, fps %d, loop %d", path, f->size, fps,
+       loop);
+  return 0;
+}
+
+int h264_file_next(h264_file_t *f, h264_au_t *au) {
+  if (h264_au_reader_next(&f->reader, au) == 0) {
+    return 0;
+  }
+  if (!f->loop) {
+    return -1;
+  }
+  h264_au_reader_rewind(&f->reader);
+  f->loops++;
+  return h264_au_reader_next(&f->reader, au);
+}
+
+void h264_file_pace(h264_file_t *f) {
+  struct timespec now;
+
+  if (f->period_ns == 0) {
+    return;
+  }
+
+  f->deadline.tv_nsec += f->period_ns;
+  if (f->deadline.tv_nsec >= NSEC_PER_SEC) {
+    f->deadline.tv_sec++;
+    f->deadline.tv_nsec -= NSEC_PER_SEC;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (now.tv_sec > f->deadline.tv_sec ||
+      (now.tv_sec == f->deadline.tv_sec &&
+       now.tv_nsec > f->deadline.tv_nsec)) {
+    f->deadline = now;
+    return;
+  }
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &f->deadline,
+                         NULL) == EINTR) {
+  }
+}
+
+void h264_file_close(h264_file_t *f) {
+  if (f->map) {
+    munmap(f->map, f->size);
+    f->map = NULL;
+  }
+  if (f->fd >= 0) {
+    close(f->fd);
+    f->fd = -1;
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef H264_FILE_H_
+#define H264_FILE_H_
+
+#include "h264.h"
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * h264_file - memory mapped Annex-B file source
+ * hands out access units as slices of the mapping, paced to a frame rate
+ */
+typedef struct {
+  int fd;
+  uint8_t *map;
+  size_t size;
+  h264_au_reader_t reader;
+  int loop;
+  long period_ns; // 0 = unpaced
+  struct timespec deadline;
+  uint64_t loops;
+} h264_file_t;
+
+/**
+ * Map path and prepare to read it
+ * fps <= 0 disables pacing, loop restarts playback at end of file
+ * Returns 0 if success, -1 on error
+ */
+int h264_file_open(h264_file_t *f, const char *path, int fps, int loop);
+
+/**
+ * Get the next access unit, valid until h264_file_close
+ * Returns 0 if success, -1 at end of file when not looping
+ */
+int h264_file_next(h264_file_t *f, h264_au_t *au);
+
+/**
+ * Sleep until the next frame is due
+ * Falls back to the current time instead of bursting after a stall
+ */
+void h264_file_pace(h264_file_t *f);
+
+void h264_file_close(h264_file_t *f);
+
+#endif // H264_FILE_H_
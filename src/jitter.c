@@ -0,0 +1,252 @@
+#include "jitter.h"
+#include "media.h"
+
+#include <string.h>
+
+// Playout delay as a multiple of the jitter estimate
+#define JITTER_DELAY_FACTOR 4
+// Releases later than this count as a stall and move the schedule
+#define JITTER_STALL_US 2000
+// Bounds of a tracked frame interval, 1000 to 1 fps
+#define JITTER_MIN_INTERVAL_US 1000
+#define JITTER_MAX_INTERVAL_US 1000000
+
+jitter_sync_t jitter_call_sync;
+
+void jitter_init(jitter_buffer_t *jb, uint32_t interval_us,
+                 uint32_t min_delay_us, uint32_t max_delay_us) {
+  memset(jb, 0, sizeof(*jb));
+  jb->interval_us = interval_us;
+  jb->min_delay_us = min_delay_us;
+  jb->max_delay_us = max_delay_us > min_delay_us ? max_delay_us : min_delay_us;
+  jb->delay_us = min_delay_us;
+  jb->track = -1;
+}
+
+static void jitter_flush(jitter_buffer_t *jb) {
+  for (int i = 0; i < JITTER_SLOTS; i++) {
+    if (jb->slots[i]) {
+      nng_msg_free(jb->slots[i]);
+      jb->slots[i] = NULL;
+    }
+  }
+  jb->count = 0;
+}
+
+void jitter_set_sync(jitter_buffer_t *jb, jitter_sync_t *sync, int stream,
+                     uint32_t render_us) {
+  jb->sync = sync;
+  jb->sync_stream = stream;
+  jb->render_us = render_us;
+}
+
+void jitter_track_interval(jitter_buffer_t *jb) { jb->track_interval = true; }
+
+void jitter_reset(jitter_buffer_t *jb) {
+  jitter_flush(jb);
+  jb->started = false;
+  jb->jitter_us = 0;
+  jb->delay_us = jb->min_delay_us;
+  if (jb->sync) {
+    atomic_store(&jb->sync->latency_us[jb->sync_stream], 0);
+  }
+}
+
+// Own delay, stretched to match the slowest other stream of the call
+static uint32_t jitter_delay_us(const jitter_buffer_t *jb) {
+  if (!jb->sync) {
+    return jb->delay_us;
+  }
+  uint64_t now_us = media_now_us();
+  uint32_t delay_us = jb->delay_us;
+  for (int i = 0; i < JITTER_STREAMS; i++) {
+    uint32_t latency_us = atomic_load(&jb->sync->latency_us[i]);
+    if (i == jb->sync_stream || latency_us <= jb->render_us ||
+        now_us - atomic_load(&jb->sync->updated_us[i]) > JITTER_SYNC_STALE_US) {
+      continue;
+    }
+    if (latency_us - jb->render_us > delay_us) {
+      delay_us = latency_us - jb->render_us;
+    }
+  }
+  return delay_us < jb->max_delay_us ? delay_us : jb->max_delay_us;
+}
+
+static int64_t jitter_playout_us(const jitter_buffer_t *jb, uint32_t seq) {
+  return jb->base_us + (int64_t)(int32_t)(seq - jb->next_seq) * jb->interval_us +
+         jitter_delay_us(jb);
+}
+
+// Anchor the schedule so that seq is due delay_us after now
+static void jitter_sync(jitter_buffer_t *jb, uint32_t seq, uint64_t now_us) {
+  jb->next_seq = seq;
+  jb->base_us = (int64_t)now_us;
+  jb->last_seq = seq;
+  jb->last_arrival_us = now_us;
+}
+
+// Mean spacing of frames that arrive in order; bursts and gaps average out
+static void jitter_update_interval(jitter_buffer_t *jb, int32_t step,
+                                   int64_t elapsed_us) {
+  if (step <= 0 || elapsed_us < 0) {
+    return;
+  }
+  int64_t sample = elapsed_us / step;
+  int64_t interval = jb->interval_us;
+  interval += (sample - interval) / 16;
+  if (interval < JITTER_MIN_INTERVAL_US) {
+    interval = JITTER_MIN_INTERVAL_US;
+  } else if (interval > JITTER_MAX_INTERVAL_US) {
+    interval = JITTER_MAX_INTERVAL_US;
+  }
+  jb->interval_us = (uint32_t)interval;
+}
+
+// Transit difference of consecutive arrivals against the nominal interval
+static void jitter_update_delay(jitter_buffer_t *jb, uint32_t seq,
+                                uint64_t now_us) {
+  int32_t step = (int32_t)(seq - jb->last_seq);
+  int64_t elapsed_us = (int64_t)(now_us - jb->last_arrival_us);
+  int64_t d = elapsed_us - (int64_t)step * jb->interval_us;
+  uint32_t target;
+
+  if (d < 0) {
+    d = -d;
+  }
+  if (jb->track_interval) {
+    jitter_update_interval(jb, step, elapsed_us);
+  }
+  jb->last_seq = seq;
+  jb->last_arrival_us = now_us;
+  jb->jitter_us += (d - (int64_t)jb->jitter_us) / 16;
+
+  target = jb->jitter_us * JITTER_DELAY_FACTOR;
+  if (target < jb->min_delay_us) {
+    target = jb->min_delay_us;
+  } else if (target > jb->max_delay_us) {
+    target = jb->max_delay_us;
+  }
+  if (target > jb->delay_us) {
+    jb->delay_us = target;
+  } else {
+    jb->delay_us -= (jb->delay_us - target) / 64;
+  }
+  if (jb->sync) {
+    atomic_store(&jb->sync->latency_us[jb->sync_stream],
+                 jb->delay_us + jb->render_us);
+    atomic_store(&jb->sync->updated_us[jb->sync_stream], media_now_us());
+  }
+}
+
+int jitter_push(jitter_buffer_t *jb, nng_msg *msg, uint64_t now_us) {
+  media_frame_hdr_t hdr;
+
+  if (nng_msg_len(msg) < sizeof(hdr)) {
+    nng_msg_free(msg);
+    return -1;
+  }
+  memcpy(&hdr, nng_msg_body(msg), sizeof(hdr));
+  if (jb->track >= 0 && media_frame_track(&hdr) != jb->track) {
+    nng_msg_free(msg);
+    return -1;
+  }
+
+  if (!jb->started) {
+    jitter_sync(jb, hdr.seq, now_us);
+    jb->started = true;
+  }
+
+  int32_t ahead = (int32_t)(hdr.seq - jb->next_seq);
+  if (ahead >= JITTER_SLOTS) {
+    // The sender jumped ahead (restart or long outage), start over from here
+    jb->lost += jb->count;
+    jitter_flush(jb);
+    jitter_sync(jb, hdr.seq, now_us);
+    ahead = 0;
+  }
+
+  jitter_update_delay(jb, hdr.seq, now_us);
+
+  if (ahead < 0) {
+    jb->late++;
+    nng_msg_free(msg);
+    return -1;
+  }
+
+  // Frames arriving ahead of the schedule pull it in gradually
+  int64_t offset_us =
+      (int64_t)now_us - jb->base_us - (int64_t)ahead * jb->interval_us;
+  if (offset_us < 0) {
+    jb->base_us += offset_us / 8;
+  }
+
+  nng_msg **slot = &jb->slots[hdr.seq & (JITTER_SLOTS - 1)];
+  if (*slot) {
+    nng_msg_free(msg);
+    return -1;
+  }
+  *slot = msg;
+  jb->count++;
+  return 0;
+}
+
+nng_msg *jitter_pop(jitter_buffer_t *jb, uint64_t now_us) {
+  while (jb->count > 0) {
+    int64_t deadline = jitter_playout_us(jb, jb->next_seq);
+    if ((int64_t)now_us < deadline) {
+      return NULL;
+    }
+
+    nng_msg **slot = &jb->slots[jb->next_seq & (JITTER_SLOTS - 1)];
+    nng_msg *msg = *slot;
+    jb->next_seq++;
+    jb->base_us += jb->interval_us;
+    if (!msg) {
+      // A later frame is already here, give up on this one
+      jb->lost++;
+      continue;
+    }
+
+    *slot = NULL;
+    jb->count--;
+    jb->played++;
+    if ((int64_t)now_us - deadline > JITTER_STALL_US) {
+      // It arrived after its deadline; shift the schedule so the following
+      // frames are not released late as well
+      jb->stall++;
+      jb->base_us += (int64_t)now_us - deadline;
+    }
+    return msg;
+  }
+  return NULL;
+}
+
+int jitter_recv(jitter_buffer_t *jb, nng_socket sock, int idle_ms) {
+  uint64_t now = media_now_us();
+  int wait_ms = idle_ms;
+  nng_msg *msg;
+  int rv;
+
+  if (jb->count > 0) {
+    int64_t left = jitter_playout_us(jb, jb->next_seq) - (int64_t)now;
+    if (left <= 0) {
+      wait_ms = 0;
+    } else if (left < (int64_t)idle_ms * 1000) {
+      wait_ms = (int)((left + 999) / 1000);
+    }
+  }
+
+  if (wait_ms > 0) {
+    nng_socket_set_ms(sock, NNG_OPT_RECVTIMEO, wait_ms);
+    rv = nng_recvmsg(sock, &msg, 0);
+  } else {
+    rv = nng_recvmsg(sock, &msg, NNG_FLAG_NONBLOCK);
+  }
+
+  if (rv == 0) {
+    jitter_push(jb, msg, media_now_us());
+  } else if (rv == NNG_ETIMEDOUT || rv == NNG_EAGAIN) {
+    rv = 0;
+  }
+  return rv;
+}
@@ -0,0 +1,113 @@
+#ifndef JITTER_H_
+#define JITTER_H_
+
+#include <nng/nng.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * jitter - adaptive playout buffer for media_frame_hdr_t framed messages
+ * frames are reordered by seq and released on a schedule derived from the
+ * nominal frame interval plus a playout delay that follows the measured
+ * interarrival jitter (RFC 3550 A.8): it grows at once and shrinks slowly
+ */
+#define JITTER_SLOTS 64 // power of two, frames held at most
+
+#define JITTER_DEFAULT_MIN_DELAY_US 20000
+#define JITTER_DEFAULT_MAX_DELAY_US 400000
+
+// Lip sync: the buffers of one call's audio and video share a
+// jitter_sync_t and each plays out late enough to line up with the other.
+// Both tracks are stamped on arrival with the media clock, so equal
+// arrival-to-output latency on both is equal capture-to-output skew
+enum {
+  JITTER_STREAM_AUDIO = 0,
+  JITTER_STREAM_VIDEO = 1,
+  JITTER_STREAMS = 2,
+};
+
+// A stream that has not updated for this long no longer holds the other back
+#define JITTER_SYNC_STALE_US 2000000
+
+typedef struct {
+  // buffer delay plus render latency of each stream, 0 when not playing
+  _Atomic uint32_t latency_us[JITTER_STREAMS];
+  _Atomic uint64_t updated_us[JITTER_STREAMS];
+} jitter_sync_t;
+
+// The remote participant's audio and video
+extern jitter_sync_t jitter_call_sync;
+
+typedef struct {
+  nng_msg *slots[JITTER_SLOTS]; // indexed by seq, NULL if empty
+  uint32_t next_seq;            // next frame to release
+  int count;
+  bool started;
+
+  uint32_t interval_us; // nominal frame interval
+  bool track_interval;  // interval_us follows the arrival rate
+  uint32_t min_delay_us;
+  uint32_t max_delay_us;
+  uint32_t delay_us; // current playout delay
+
+  int track; // only frames of this media_frame_track(), -1 for all
+
+  jitter_sync_t *sync; // NULL when playing on its own
+  int sync_stream;
+  uint32_t render_us; // from release to the frame being seen or heard
+
+  // playout(seq) = base_us + (seq - next_seq) * interval + delay
+  int64_t base_us;
+  uint32_t last_seq;       // most recent frame pushed
+  uint64_t last_arrival_us; // and when it arrived
+  uint32_t jitter_us; // interarrival jitter estimate
+
+  uint32_t played;
+  uint32_t late;  // arrived after their slot was released or skipped
+  uint32_t lost;  // skipped over
+  uint32_t stall; // released after their deadline
+} jitter_buffer_t;
+
+void jitter_init(jitter_buffer_t *jb, uint32_t interval_us,
+                 uint32_t min_delay_us, uint32_t max_delay_us);
+
+/**
+ * Play out in step with the other streams of sync; render_us is how long a
+ * released frame takes to reach the screen or speaker
+ */
+void jitter_set_sync(jitter_buffer_t *jb, jitter_sync_t *sync, int stream,
+                     uint32_t render_us);
+
+/**
+ * For senders whose frame rate is not known up front: the interval given
+ * to jitter_init() is only the starting point and then follows the mean
+ * interarrival time of consecutive frames
+ */
+void jitter_track_interval(jitter_buffer_t *jb);
+
+/**
+ * Drop every buffered frame and restart synchronization
+ */
+void jitter_reset(jitter_buffer_t *jb);
+
+/**
+ * Queue a frame, taking ownership of msg
+ * Returns 0 if queued, -1 if it was discarded (late, duplicate or runt)
+ */
+int jitter_push(jitter_buffer_t *jb, nng_msg *msg, uint64_t now_us);
+
+/**
+ * Get the next frame due at now_us, header included, or NULL
+ * The caller owns the returned message
+ */
+nng_msg *jitter_pop(jitter_buffer_t *jb, uint64_t now_us);
+
+/**
+ * Wait on sock until a frame arrives or the next buffered frame is due,
+ * but no longer than idle_ms; received frames are pushed
+ * Returns 0 on timeout or receipt, an nng error if the socket failed
+ */
+int jitter_recv(jitter_buffer_t *jb, nng_socket sock, int idle_ms);
+
+#endif // JITTER_H_
@@ -0,0 +1,646 @@
+/*
+ * lamb_latency - audio mouth-to-ear latency through the real pipeline
+ *
+ * A click train is played into the capture device, audio.c captures,
+ * processes and encodes it, the Meet publisher sends it to an in-process
+ * peer that stands in for the SFU, which forwards it to the Meet subscriber,
+ * whose audio goes through the playback mixer to the speaker device, where
+ * a monitor listens for it. Each click is detected again at every hop:
+ *
+ *   onset     written into the capture device (or its capture stamp)
+ *   bus       encoded frame on TOPIC_AUDIO_COMPRESSED
+ *   uplink    Opus packet at the SFU stand-in's track callback
+ *   downlink  OnAudioTrack's frame on TOPIC_AUDIO_WEBRTC
+ *   speaker   sample read back from the speaker device
+ *
+ * With snd-aloop (modprobe snd-aloop) the defaults wire it up: the clicks go
+ * into hw:Loopback,0,0 for lamb to capture on hw:Loopback,1,0, and lamb plays
+ * to hw:Loopback,0,1 for the monitor on hw:Loopback,1,1.
+ *
+ * Without a loopback card, -w writes the click train for a file-backed PCM
+ * and -g - leaves generation to it, e.g. in ~/.asoundrc
+ *
+ *   pcm.clicks { type file; slave.pcm "hw:0"; file "/dev/null";
+ *                infile "/tmp/clicks.raw"; format raw }
+ *
+ * then onsets come from the capture stamps and -m - skips the speaker.
+ */
+#include "audio.h"
+#include "media.h"
+#include "meet.h"
+#include "peer.h"
+#include "utils.h"
+#include <alsa/asoundlib.h>
+#include <nng/nng.h>
+#include <nng/protocol/pubsub0/sub.h>
+#include <opus/opus.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LAT_RATE 48000
+#define LAT_PERIOD_FRAMES (LAT_RATE / 100)
+#define LAT_PCM_LATENCY_US 20000
+#define LAT_MAX_DECODE (120 * LAT_RATE / 1000)
+// A 10 ms chirp from 1 to 4 kHz with 1 ms raised cosine edges, well inside
+// the Opus and high-pass bands
+#define LAT_CLICK_MS 10
+#define LAT_CLICK_RAMP_MS 1
+#define LAT_CLICK_F0 1000.0
+#define LAT_CLICK_F1 4000.0
+#define LAT_CLICK_AMPLITUDE 16000.0
+// A click starts at the first sample this loud after a quiet stretch
+#define LAT_DETECT_LEVEL 4096
+#define LAT_DETECT_QUIET_MS 100
+#define LAT_CONNECT_TRIES 100
+
+typedef enum {
+  LAT_POINT_ONSET,
+  LAT_POINT_BUS,
+  LAT_POINT_UPLINK,
+  LAT_POINT_DOWNLINK,
+  LAT_POINT_SPEAKER,
+  LAT_POINT_COUNT,
+} lat_point_t;
+
+typedef struct {
+  const char *capture;   // lamb's capture PCM
+  const char *speaker;   // lamb's playback PCM
+  const char *generator; // clicks are played here, NULL when they are not
+  const char *monitor;   // lamb's speaker output is read back here, or NULL
+  int interval_ms;
+  int seconds;
+  int frame_ms;
+  int period_ms;
+} lat_options_t;
+
+typedef struct {
+  int quiet; // samples below LAT_DETECT_LEVEL in a row
+} lat_detector_t;
+
+static lat_options_t g_opts = {
+    .capture = "hw:Loopback,1,0",
+    .speaker = "hw:Loopback,0,1",
+    .generator = "hw:Loopback,0,0",
+    .monitor = "hw:Loopback,1,1",
+    .interval_ms = 1000,
+    .seconds = 20,
+    .frame_ms = DEFAULT_FRAME_SIZE_MS,
+    .period_ms = DEFAULT_PERIOD_MS,
+};
+
+static const char *kStageNames[LAT_POINT_COUNT] = {
+    "total", "capture", "uplink", "downlink", "playback"};
+
+// When each click reached each point, media clock, 0 if it never did;
+// a click is attributed to the last onset before it was seen, so the
+// interval has to be longer than the total latency
+static uint64_t *g_seen[LAT_POINT_COUNT];
+static size_t g_max_clicks;
+static atomic_size_t g_clicks;
+
+static PeerConnection *g_uplink_pc = NULL;
+static PeerConnection *g_downlink_pc = NULL;
+static OpusDecoder *g_uplink_decoder = NULL;
+static lat_detector_t g_uplink_detector;
+static volatile bool g_running = false;
+static volatile bool g_peers_running = false;
+
+static int16_t lat_click_sample(size_t pos, size_t interval) {
+  size_t len = LAT_RATE * LAT_CLICK_MS / 1000;
+  size_t ramp = LAT_RATE * LAT_CLICK_RAMP_MS / 1000;
+  size_t n = pos % interval;
+  if (n >= len) {
+    return 0;
+  }
+  double t = (double)n / LAT_RATE;
+  double sweep = (LAT_CLICK_F1 - LAT_CLICK_F0) / (2.0 * LAT_CLICK_MS / 1000);
+  double env = 1.0;
+  if (n < ramp) {
+    env = 0.5 - 0.5 * cos(M_PI * n / ramp);
+  } else if (n >= len - ramp) {
+    env = 0.5 - 0.5 * cos(M_PI * (len - n) / ramp);
+  }
+  return (int16_t)(LAT_CLICK_AMPLITUDE * env *
+                   sin(2.0 * M_PI * (LAT_CLICK_F0 * t + sweep * t * t)));
+}
+
+/**
+ * Index of the first click sample in pcm, -1 if none starts there
+ */
+static int lat_detect(lat_detector_t *d, const int16_t *pcm, int n) {
+  int found = -1;
+  for (int i = 0; i < n; i++) {
+    if (abs(pcm[i]) < LAT_DETECT_LEVEL) {
+      d->quiet++;
+      continue;
+    }
+    if (found < 0 && d->quiet >= LAT_RATE * LAT_DETECT_QUIET_MS / 1000) {
+      found = i;
+    }
+    d->quiet = 0;
+  }
+  return found;
+}
+
+static void lat_onset(uint64_t t) {
+  size_t i = atomic_load(&g_clicks);
+  if (i < g_max_clicks) {
+    g_seen[LAT_POINT_ONSET][i] = t;
+    atomic_store(&g_clicks, i + 1);
+  }
+}
+
+static void lat_seen(lat_point_t point, uint64_t t) {
+  size_t n = atomic_load(&g_clicks);
+  while (n > 0) {
+    uint64_t onset = g_seen[LAT_POINT_ONSET][--n];
+    if (onset > t) {
+      continue;
+    }
+    if (t - onset < (uint64_t)g_opts.interval_ms * 1000 &&
+        g_seen[point][n] == 0) {
+      g_seen[point][n] = t;
+    }
+    return;
+  }
+}
+
+// Decode one Opus packet and report a click in it as seen at t; pts_us is
+// the capture time of the packet's first sample when onsets come from there
+static void lat_decode(OpusDecoder *decoder, lat_detector_t *d,
+                       lat_point_t point, const uint8_t *data, size_t size,
+                       uint64_t pts_us, uint64_t t) {
+  int16_t pcm[LAT_MAX_DECODE];
+  int n = opus_decode(decoder, data, (opus_int32)size, pcm, LAT_MAX_DECODE, 0);
+  if (n <= 0) {
+    return;
+  }
+  int i = lat_detect(d, pcm, n);
+  if (i < 0) {
+    return;
+  }
+  if (point == LAT_POINT_BUS && !g_opts.generator) {
+    lat_onset(pts_us + (uint64_t)i * 1000000 / LAT_RATE);
+  }
+  lat_seen(point, t);
+}
+
+static snd_pcm_t *lat_pcm_open(const char *device, snd_pcm_stream_t stream) {
+  snd_pcm_t *pcm;
+  int err;
+  if ((err = snd_pcm_open(&pcm, device, stream, 0)) < 0) {
+    LOGE("Cannot open %s: %s", device, snd_strerror(err));
+    return NULL;
+  }
+  if ((err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE,
+                                SND_PCM_ACCESS_RW_INTERLEAVED, 1, LAT_RATE, 1,
+                                LAT_PCM_LATENCY_US)) < 0) {
+    LOGE("Cannot configure %s: %s", device, snd_strerror(err));
+    snd_pcm_close(pcm);
+    return NULL;
+  }
+  return pcm;
+}
+
+// Plays the click train; a click's onset is when its first sample leaves
+// the device, the write time plus what is queued ahead of it
+static void *lat_generator(void *arg) {
+  snd_pcm_t *pcm = (snd_pcm_t *)arg;
+  size_t interval = (size_t)LAT_RATE * g_opts.interval_ms / 1000;
+  int16_t buf[LAT_PERIOD_FRAMES];
+  size_t pos = 0;
+
+  while (g_running) {
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(pcm, &delay) < 0 || delay < 0) {
+      delay = 0;
+    }
+    uint64_t t0 = media_now_us() + (uint64_t)delay * 1000000 / LAT_RATE;
+    for (int i = 0; i < LAT_PERIOD_FRAMES; i++) {
+      buf[i] = lat_click_sample(pos + i, interval);
+      if ((pos + i) % interval == 0) {
+        lat_onset(t0 + (uint64_t)i * 1000000 / LAT_RATE);
+      }
+    }
+    snd_pcm_sframes_t n = snd_pcm_writei(pcm, buf, LAT_PERIOD_FRAMES);
+    if (n < 0) {
+      snd_pcm_recover(pcm, (int)n, 1);
+      continue;
+    }
+    pos += (size_t)n;
+  }
+  return NULL;
+}
+
+// Reads lamb's speaker output back; the last sample read was played avail
+// frames before now
+static void *lat_monitor(void *arg) {
+  snd_pcm_t *pcm = (snd_pcm_t *)arg;
+  lat_detector_t detector = {0};
+  int16_t buf[LAT_PERIOD_FRAMES];
+
+  while (g_running) {
+    snd_pcm_sframes_t n = snd_pcm_readi(pcm, buf, LAT_PERIOD_FRAMES);
+    if (n < 0) {
+      snd_pcm_recover(pcm, (int)n, 1);
+      continue;
+    }
+    uint64_t now = media_now_us();
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+    if (avail < 0) {
+      avail = 0;
+    }
+    int i = lat_detect(&detector, buf, (int)n);
+    if (i >= 0) {
+      lat_seen(LAT_POINT_SPEAKER,
+               now - (uint64_t)(avail + n - 1 - i) * 1000000 / LAT_RATE);
+    }
+  }
+  return NULL;
+}
+
+// Subscribes to a bus topic and decodes its media_frame_hdr_t + Opus frames
+static void *lat_tap(void *arg) {
+  lat_point_t point = (lat_point_t)(intptr_t)arg;
+  const char *topic = point == LAT_POINT_BUS ? TOPIC_AUDIO_COMPRESSED
+                                             : TOPIC_AUDIO_WEBRTC;
+  lat_detector_t detector = {0};
+  OpusDecoder *decoder;
+  nng_socket sock;
+  int rv;
+
+  decoder = opus_decoder_create(LAT_RATE, 1, &rv);
+  if (rv != OPUS_OK) {
+    LOGE("lat_tap: opus_decoder_create: %s", opus_strerror(rv));
+    return NULL;
+  }
+  if ((rv = nng_sub0_open(&sock)) != 0) {
+    LOGE("lat_tap: nng_sub0_open: %s", nng_strerror(rv));
+    opus_decoder_destroy(decoder);
+    return NULL;
+  }
+  nng_socket_set(sock, NNG_OPT_SUB_SUBSCRIBE, "", 0);
+  nng_socket_set_ms(sock, NNG_OPT_RECVTIMEO, 100);
+  if ((rv = nng_dial(sock, topic, NULL, 0)) != 0) {
+    LOGE("lat_tap: nng_dial %s: %s", topic, nng_strerror(rv));
+    nng_close(sock);
+    opus_decoder_destroy(decoder);
+    return NULL;
+  }
+
+  while (g_running) {
+    nng_msg *msg;
+    if (nng_recvmsg(sock, &msg, 0) != 0) {
+      continue;
+    }
+    uint64_t t = media_now_us();
+    if (nng_msg_len(msg) > sizeof(media_frame_hdr_t)) {
+      media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+      // Only the call's participants, not the agent
+      if (point == LAT_POINT_BUS ||
+          media_frame_track(hdr) == AUDIO_TRACK_CALL) {
+        lat_decode(decoder, &detector, point, (const uint8_t *)(hdr + 1),
+                   nng_msg_len(msg) - sizeof(*hdr), hdr->pts_us, t);
+      }
+    }
+    nng_msg_free(msg);
+  }
+
+  nng_close(sock);
+  opus_decoder_destroy(decoder);
+  return NULL;
+}
+
+// The SFU stand-in: what the publisher sends is forwarded to the subscriber
+static void lat_on_uplink_audio(uint8_t *data, size_t size, void *userdata) {
+  (void)userdata;
+  lat_decode(g_uplink_decoder, &g_uplink_detector, LAT_POINT_UPLINK, data,
+             size, 0, media_now_us());
+  if (peer_connection_get_state(g_downlink_pc) == PEER_CONNECTION_CONNECTED) {
+    peer_connection_send_audio(g_downlink_pc, data, size);
+  }
+}
+
+static void *lat_peers_loop(void *arg) {
+  (void)arg;
+  while (g_peers_running) {
+    peer_connection_loop(g_uplink_pc);
+    peer_connection_loop(g_downlink_pc);
+    usleep(1000);
+  }
+  return NULL;
+}
+
+// Answer the Meet publisher's offer and offer to the Meet subscriber, the
+// way the SFU does; host candidates are carried in the SDP
+static int lat_connect(void) {
+  PeerConfiguration uplink_config = {
+      .datachannel = DATA_CHANNEL_NONE,
+      .audio_codec = CODEC_OPUS,
+      .video_codec = CODEC_H264,
+      .onaudiotrack = lat_on_uplink_audio,
+  };
+  PeerConfiguration downlink_config = {
+      .datachannel = DATA_CHANNEL_NONE,
+      .audio_codec = CODEC_OPUS,
+      .video_codec = CODEC_H264,
+  };
+
+  g_uplink_pc = peer_connection_create(&uplink_config);
+  g_downlink_pc = peer_connection_create(&downlink_config);
+  if (!g_uplink_pc || !g_downlink_pc) {
+    LOGE("Failed to create the loopback peers");
+    return -1;
+  }
+
+  const char *offer = MeetWebrtcCreateOffer();
+  peer_connection_set_remote_description(g_uplink_pc, offer, SDP_TYPE_OFFER);
+  MeetWebrtcSetRemoteDescription(peer_connection_create_answer(g_uplink_pc),
+                                 "answer");
+
+  offer = peer_connection_create_offer(g_downlink_pc);
+  MeetWebrtcSetRemoteDescription(offer, "offer");
+  peer_connection_set_remote_description(g_downlink_pc,
+                                         MeetWebrtcCreateAnswer(),
+                                         SDP_TYPE_ANSWER);
+
+  for (int i = 0; i < LAT_CONNECT_TRIES; i++) {
+    peer_connection_loop(g_uplink_pc);
+    peer_connection_loop(g_downlink_pc);
+    int publisher = MeetWebrtcPublisherIsConnected();
+    if ((publisher == PEER_CONNECTION_CONNECTED ||
+         publisher == PEER_CONNECTION_COMPLETED) &&
+        MeetWebrtcSubscriberIsConnected() == 1) {
+      return 0;
+    }
+    usleep(50 * 1000);
+  }
+  return -1;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Prints the spread of to - from over the clicks seen at both points
+static void lat_report_stage(const char *name, lat_point_t from, lat_point_t to,
+                             uint64_t *samples, size_t clicks) {
+  size_t n = 0;
+  for (size_t c = 0; c < clicks; c++) {
+    if (g_seen[from][c] && g_seen[to][c] >= g_seen[from][c]) {
+      samples[n++] = g_seen[to][c] - g_seen[from][c];
+    }
+  }
+  if (n == 0) {
+    printf("%-10s %7d %7zu\n", name, 0, clicks);
+    return;
+  }
+  qsort(samples, n, sizeof(uint64_t), cmp_u64);
+  printf("%-10s %7zu %7zu %9.1f %9.1f %9.1f %9.1f\n", name, n, clicks - n,
+         samples[n / 2] / 1e3, samples[n * 90 / 100] / 1e3,
+         samples[n * 99 / 100] / 1e3, samples[n - 1] / 1e3);
+}
+
+// Each stage runs from the point before it, the total from the onset to the
+// last point any click reached
+static void lat_report(void) {
+  size_t clicks = atomic_load(&g_clicks);
+  uint64_t *samples = malloc((clicks + 1) * sizeof(uint64_t));
+  lat_point_t last = LAT_POINT_ONSET;
+
+  if (!samples) {
+    return;
+  }
+  printf("\n%-10s %7s %7s %9s %9s %9s %9s\n", "stage", "clicks", "missed",
+         "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)");
+  for (int p = LAT_POINT_BUS; p < LAT_POINT_COUNT; p++) {
+    lat_report_stage(kStageNames[p], p - 1, p, samples, clicks);
+    for (size_t c = 0; c < clicks; c++) {
+      if (g_seen[p][c]) {
+        last = p;
+      }
+    }
+  }
+  if (last != LAT_POINT_ONSET) {
+    lat_report_stage(kStageNames[LAT_POINT_ONSET], LAT_POINT_ONSET, last,
+                     samples, clicks);
+  }
+  free(samples);
+
+  AudioStats stats;
+  app_audio_get_stats(&stats);
+  printf("\nencoded %llu, played %llu, concealed %llu, overruns %llu, "
+         "underruns %llu\n",
+         (unsigned long long)stats.frames, (unsigned long long)stats.played,
+         (unsigned long long)stats.concealed,
+         (unsigned long long)stats.overruns,
+         (unsigned long long)stats.underruns);
+}
+
+static int lat_write_clicks(const char *path) {
+  size_t interval = (size_t)LAT_RATE * g_opts.interval_ms / 1000;
+  size_t total = (size_t)LAT_RATE * g_opts.seconds;
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    return -1;
+  }
+  for (size_t i = 0; i < total; i++) {
+    int16_t s = lat_click_sample(i, interval);
+    fwrite(&s, sizeof(s), 1, fp);
+  }
+  fclose(fp);
+  return 0;
+}
+
+static void usage(const char *prog) {
+  printf("usage: %s [-c capture] [-s speaker] [-g generator|-] "
+         "[-m monitor|-] [-i interval_ms] [-d seconds] [-f frame_ms] "
+         "[-p period_ms] [-w clicks.raw]\n",
+         prog);
+}
+
+int main(int argc, char *argv[]) {
+  const char *click_file = NULL;
+  snd_pcm_t *generator = NULL;
+  snd_pcm_t *monitor = NULL;
+  pthread_t generator_tid;
+  pthread_t monitor_tid;
+  pthread_t tap_tids[2];
+  pthread_t peers_tid;
+  int c;
+
+  while ((c = getopt(argc, argv, "c:s:g:m:i:d:f:p:w:h")) != -1) {
+    switch (c) {
+    case 'c':
+      g_opts.capture = optarg;
+      break;
+    case 's':
+      g_opts.speaker = optarg;
+      break;
+    case 'g':
+      g_opts.generator = strcmp(optarg, "-") == 0 ? NULL : optarg;
+      break;
+    case 'm':
+      g_opts.monitor = strcmp(optarg, "-") == 0 ? NULL : optarg;
+      break;
+    case 'i':
+      g_opts.interval_ms = atoi(optarg);
+      break;
+    case 'd':
+      g_opts.seconds = atoi(optarg);
+      break;
+    case 'f':
+      g_opts.frame_ms = atoi(optarg);
+      break;
+    case 'p':
+      g_opts.period_ms = atoi(optarg);
+      break;
+    case 'w':
+      click_file = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (g_opts.interval_ms < 2 * LAT_DETECT_QUIET_MS || g_opts.seconds < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (click_file) {
+    if (lat_write_clicks(click_file) < 0) {
+      LOGE("Failed to write %s", click_file);
+      return 1;
+    }
+    LOGI("Wrote %d s of clicks every %d ms to %s, S16_LE %d Hz mono",
+         g_opts.seconds, g_opts.interval_ms, click_file, LAT_RATE);
+    return 0;
+  }
+
+  g_max_clicks = (size_t)g_opts.seconds * 1000 / g_opts.interval_ms + 2;
+  for (int p = 0; p < LAT_POINT_COUNT; p++) {
+    g_seen[p] = calloc(g_max_clicks, sizeof(uint64_t));
+    if (!g_seen[p]) {
+      LOGE("Failed to allocate latency samples");
+      return 1;
+    }
+  }
+
+  // AGC and VAD would move the click level and gate the silence between
+  // clicks, the rest is the production pipeline
+  AudioConfig config = {
+      .device = g_opts.capture,
+      .spk_device = g_opts.speaker,
+      .period_ms = g_opts.period_ms,
+      .buffer_periods = DEFAULT_BUFFER_PERIODS,
+      .rt_priority = DEFAULT_RT_PRIORITY,
+      .dsp =
+          {
+              .highpass_hz = AUDIO_DSP_DEFAULT_HIGHPASS_HZ,
+              .agc = 0,
+              .vad = 0,
+          },
+      .opus =
+          {
+              .bitrate = DEFAULT_BITRATE,
+              .frame_ms = g_opts.frame_ms,
+              .complexity = DEFAULT_COMPLEXITY,
+              .budget_pct = DEFAULT_ENCODE_BUDGET_PCT,
+          },
+  };
+  app_audio_set_config(&config);
+  if (app_audio_main(NULL) != 0) {
+    return 1;
+  }
+
+  int rv;
+  g_uplink_decoder = opus_decoder_create(LAT_RATE, 1, &rv);
+  if (rv != OPUS_OK) {
+    LOGE("opus_decoder_create: %s", opus_strerror(rv));
+    app_audio_quit();
+    return 1;
+  }
+
+  MeetWebrtcCreatePeerConnections();
+  rv = lat_connect();
+  if (rv < 0 && (!g_uplink_pc || !g_downlink_pc)) {
+    MeetWebrtcDestroyPeerConnections();
+    app_audio_quit();
+    return 1;
+  }
+  if (rv < 0) {
+    LOGW("Loopback peers did not connect, only the capture stage will be "
+         "measured");
+  }
+  g_peers_running = true;
+  pthread_create(&peers_tid, NULL, lat_peers_loop, NULL);
+
+  if (g_opts.generator &&
+      !(generator = lat_pcm_open(g_opts.generator, SND_PCM_STREAM_PLAYBACK))) {
+    g_opts.generator = NULL;
+  }
+  if (g_opts.monitor &&
+      !(monitor = lat_pcm_open(g_opts.monitor, SND_PCM_STREAM_CAPTURE))) {
+    g_opts.monitor = NULL;
+  }
+
+  LOGI("Clicks every %d ms for %d s from %s, %d ms Opus frames, %d ms ALSA "
+       "periods",
+       g_opts.interval_ms, g_opts.seconds,
+       g_opts.generator ? g_opts.generator : g_opts.capture, g_opts.frame_ms,
+       g_opts.period_ms);
+
+  g_running = true;
+  pthread_create(&tap_tids[0], NULL, lat_tap, (void *)(intptr_t)LAT_POINT_BUS);
+  pthread_create(&tap_tids[1], NULL, lat_tap,
+                 (void *)(intptr_t)LAT_POINT_DOWNLINK);
+  if (monitor) {
+    pthread_create(&monitor_tid, NULL, lat_monitor, monitor);
+  }
+  if (generator) {
+    pthread_create(&generator_tid, NULL, lat_generator, generator);
+  }
+
+  sleep(g_opts.seconds);
+
+  g_running = false;
+  if (generator) {
+    pthread_join(generator_tid, NULL);
+  }
+  if (monitor) {
+    pthread_join(monitor_tid, NULL);
+  }
+  pthread_join(tap_tids[0], NULL);
+  pthread_join(tap_tids[1], NULL);
+
+  lat_report();
+
+  g_peers_running = false;
+  pthread_join(peers_tid, NULL);
+  peer_connection_destroy(g_uplink_pc);
+  peer_connection_destroy(g_downlink_pc);
+  MeetWebrtcDestroyPeerConnections();
+  app_audio_quit();
+  opus_decoder_destroy(g_uplink_decoder);
+  if (generator) {
+    snd_pcm_close(generator);
+  }
+  if (monitor) {
+    snd_pcm_close(monitor);
+  }
+  for (int p = 0; p < LAT_POINT_COUNT; p++) {
+    free(g_seen[p]);
+  }
+  return 0;
+}
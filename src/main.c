@@ -3,6 +3,8 @@
 #include "display.h"
 #include "ini.h" // For inih library
 #include "meet.h"
+#include "preroll.h"
+#include "recorder.h"
 #include "telegram.h"
 #include "utils.h"
 #include "video.h"
@@ -22,11 +24,16 @@ typedef struct {
   char *telegram_bot_token;
   char *livekit_url;
   char *livekit_token;
+  int livekit_camera;
   char *openai_api_key;
   char *video_cam_pipeline;
   char *video_dis_pipeline;
   char *audio_mic_pipeline;
   char *audio_spk_pipeline;
+  VideoConfig video;
+  AudioConfig audio;
+  RecorderConfig recorder;
+  PrerollConfig preroll;
 } AppConfig;
 
 // Global instance of our application configuration
@@ -34,13 +41,104 @@ static AppConfig g_app_config = {
     .telegram_bot_token = NULL,
     .livekit_url = NULL,
     .livekit_token = NULL,
+    .livekit_camera = 0,
     .openai_api_key = NULL,
     .video_cam_pipeline = NULL,
     .video_dis_pipeline = NULL,
     .audio_mic_pipeline = NULL,
     .audio_spk_pipeline = NULL,
+    .video =
+        {
+            .fps = VIDEO_DEFAULT_FPS,
+            .loop = 1,
+            .bitrate_kbps = VIDEO_DEFAULT_BITRATE_KBPS,
+            .motion = 0,
+            .motion_idle_s = VIDEO_DEFAULT_MOTION_IDLE_S,
+            .static_fps = VIDEO_DEFAULT_STATIC_FPS,
+            .static_kbps = VIDEO_DEFAULT_STATIC_KBPS,
+            .sub_bitrate_kbps = VIDEO_DEFAULT_SUB_BITRATE_KBPS,
+            .temporal_layers = 1,
+            .osd =
+                {
+                    .enabled = 0,
+                    .label = NULL,
+                    .time_format = NULL,
+                    .x = 16,
+                    .y = 16,
+                    .scale = OSD_DEFAULT_SCALE,
+                },
+        },
+    .audio =
+        {
+            .device = NULL,
+            .spk_device = NULL,
+            .period_ms = DEFAULT_PERIOD_MS,
+            .buffer_periods = DEFAULT_BUFFER_PERIODS,
+            .rt_priority = DEFAULT_RT_PRIORITY,
+            .dsp =
+                {
+                    .highpass_hz = AUDIO_DSP_DEFAULT_HIGHPASS_HZ,
+                    .agc = 1,
+                    .agc_target_dbfs = AUDIO_DSP_DEFAULT_AGC_TARGET_DBFS,
+                    .agc_max_gain_db = AUDIO_DSP_DEFAULT_AGC_MAX_GAIN_DB,
+                    .vad = 0,
+                    .vad_hangover_ms = AUDIO_DSP_DEFAULT_VAD_HANGOVER_MS,
+                },
+            .opus =
+                {
+                    .bitrate = DEFAULT_BITRATE,
+                    .vbr = 0,
+                    .dtx = 0,
+                    .fec = 0,
+                    .loss_pct = 0,
+                    .frame_ms = DEFAULT_FRAME_SIZE_MS,
+                    .complexity = DEFAULT_COMPLEXITY,
+                    .budget_pct = DEFAULT_ENCODE_BUDGET_PCT,
+                },
+        },
+    .recorder =
+        {
+            .enabled = 0,
+            .dir = NULL,
+            .camera = 0,
+            .segment_s = RECORDER_DEFAULT_SEGMENT_S,
+            .segment_mb = RECORDER_DEFAULT_SEGMENT_MB,
+        },
+    .preroll =
+        {
+            .enabled = 0,
+            .camera = 0,
+            .seconds = PREROLL_DEFAULT_SECONDS,
+            .budget_kb = PREROLL_DEFAULT_BUDGET_KB,
+        },
 };
 
+// [cameraN] sections, N in [0, VIDEO_MAX_CAMERAS)
+static int camera_ini_handler(VideoConfig *video, const char *section,
+                              const char *name, const char *value) {
+  char *end;
+  long id = strtol(section + strlen("camera"), &end, 10);
+  if (end == section + strlen("camera") || *end != '\0' || id < 0 ||
+      id >= VIDEO_MAX_CAMERAS) {
+    return 0;
+  }
+
+  // Only a known key enables the camera, so a typo cannot turn on one that
+  // is not there
+  VideoCameraConfig *camera = &video->cameras[id];
+  if (strcmp(name, "width") == 0) {
+    camera->width = atoi(value);
+  } else if (strcmp(name, "height") == 0) {
+    camera->height = atoi(value);
+  } else if (strcmp(name, "bitrate") == 0) {
+    camera->bitrate_kbps = atoi(value);
+  } else {
+    return 0;
+  }
+  camera->enabled = 1;
+  return 1;
+}
+
 // Handler function for inih
 static int config_ini_handler(void *user, const char *section, const char *name,
                               const char *value) {
@@ -52,6 +150,8 @@ static int config_ini_handler(void *user, const char *section, const char *name,
     pconfig->telegram_bot_token = strdup(value);
   } else if (MATCH("livekit", "url")) {
     pconfig->livekit_url = strdup(value);
+  } else if (MATCH("livekit", "camera")) {
+    pconfig->livekit_camera = atoi(value);
   } else if (MATCH("livekit", "token")) {
 
     pconfig->livekit_token = strdup(value);
@@ -63,10 +163,102 @@ static int config_ini_handler(void *user, const char *section, const char *name,
     pconfig->video_cam_pipeline = strdup(value);
   } else if (MATCH("video", "dis")) {
     pconfig->video_dis_pipeline = strdup(value);
+  } else if (MATCH("video", "fps")) {
+    pconfig->video.fps = atoi(value);
+  } else if (MATCH("video", "loop")) {
+    pconfig->video.loop = atoi(value);
+  } else if (MATCH("video", "bitrate")) {
+    pconfig->video.bitrate_kbps = atoi(value);
+  } else if (MATCH("video", "motion")) {
+    pconfig->video.motion = atoi(value);
+  } else if (MATCH("video", "motion_idle")) {
+    pconfig->video.motion_idle_s = atoi(value);
+  } else if (MATCH("video", "static_fps")) {
+    pconfig->video.static_fps = atoi(value);
+  } else if (MATCH("video", "static_bitrate")) {
+    pconfig->video.static_kbps = atoi(value);
+  } else if (MATCH("video", "sub_width")) {
+    pconfig->video.sub_width = atoi(value);
+  } else if (MATCH("video", "sub_height")) {
+    pconfig->video.sub_height = atoi(value);
+  } else if (MATCH("video", "sub_bitrate")) {
+    pconfig->video.sub_bitrate_kbps = atoi(value);
+  } else if (MATCH("video", "temporal_layers")) {
+    pconfig->video.temporal_layers = atoi(value);
+  } else if (MATCH("osd", "enabled")) {
+    pconfig->video.osd.enabled = atoi(value);
+  } else if (MATCH("osd", "label")) {
+    pconfig->video.osd.label = strdup(value);
+  } else if (MATCH("osd", "time_format")) {
+    pconfig->video.osd.time_format = strdup(value);
+  } else if (MATCH("osd", "x")) {
+    pconfig->video.osd.x = atoi(value);
+  } else if (MATCH("osd", "y")) {
+    pconfig->video.osd.y = atoi(value);
+  } else if (MATCH("osd", "scale")) {
+    pconfig->video.osd.scale = atoi(value);
+  } else if (strncmp(section, "camera", strlen("camera")) == 0) {
+    return camera_ini_handler(&pconfig->video, section, name, value);
+  } else if (MATCH("recorder", "enabled")) {
+    pconfig->recorder.enabled = atoi(value);
+  } else if (MATCH("recorder", "dir")) {
+    pconfig->recorder.dir = strdup(value);
+  } else if (MATCH("recorder", "camera")) {
+    pconfig->recorder.camera = atoi(value);
+  } else if (MATCH("recorder", "segment_time")) {
+    pconfig->recorder.segment_s = atoi(value);
+  } else if (MATCH("recorder", "segment_size")) {
+    pconfig->recorder.segment_mb = atoi(value);
+  } else if (MATCH("preroll", "enabled")) {
+    pconfig->preroll.enabled = atoi(value);
+  } else if (MATCH("preroll", "camera")) {
+    pconfig->preroll.camera = atoi(value);
+  } else if (MATCH("preroll", "seconds")) {
+    pconfig->preroll.seconds = atoi(value);
+  } else if (MATCH("preroll", "budget")) {
+    pconfig->preroll.budget_kb = atoi(value);
   } else if (MATCH("audio", "mic")) {
     pconfig->audio_mic_pipeline = strdup(value);
   } else if (MATCH("audio", "spk")) {
     pconfig->audio_spk_pipeline = strdup(value);
+  } else if (MATCH("audio", "device")) {
+    pconfig->audio.device = strdup(value);
+  } else if (MATCH("audio", "spk_device")) {
+    pconfig->audio.spk_device = strdup(value);
+  } else if (MATCH("audio", "period_ms")) {
+    pconfig->audio.period_ms = atoi(value);
+  } else if (MATCH("audio", "buffer_periods")) {
+    pconfig->audio.buffer_periods = atoi(value);
+  } else if (MATCH("audio", "rt_priority")) {
+    pconfig->audio.rt_priority = atoi(value);
+  } else if (MATCH("audio", "highpass_hz")) {
+    pconfig->audio.dsp.highpass_hz = atoi(value);
+  } else if (MATCH("audio", "agc")) {
+    pconfig->audio.dsp.agc = atoi(value);
+  } else if (MATCH("audio", "agc_target")) {
+    pconfig->audio.dsp.agc_target_dbfs = atoi(value);
+  } else if (MATCH("audio", "agc_max_gain")) {
+    pconfig->audio.dsp.agc_max_gain_db = atoi(value);
+  } else if (MATCH("audio", "vad")) {
+    pconfig->audio.dsp.vad = atoi(value);
+  } else if (MATCH("audio", "vad_hangover")) {
+    pconfig->audio.dsp.vad_hangover_ms = atoi(value);
+  } else if (MATCH("audio", "bitrate")) {
+    pconfig->audio.opus.bitrate = atoi(value);
+  } else if (MATCH("audio", "vbr")) {
+    pconfig->audio.opus.vbr = atoi(value);
+  } else if (MATCH("audio", "dtx")) {
+    pconfig->audio.opus.dtx = atoi(value);
+  } else if (MATCH("audio", "fec")) {
+    pconfig->audio.opus.fec = atoi(value);
+  } else if (MATCH("audio", "packet_loss")) {
+    pconfig->audio.opus.loss_pct = atoi(value);
+  } else if (MATCH("audio", "frame_ms")) {
+    pconfig->audio.opus.frame_ms = atoi(value);
+  } else if (MATCH("audio", "complexity")) {
+    pconfig->audio.opus.complexity = atoi(value);
+  } else if (MATCH("audio", "encode_budget")) {
+    pconfig->audio.opus.budget_pct = atoi(value);
   } else {
     return 0; // Unknown section/name, error
   }
@@ -154,8 +346,12 @@ int main(int argc, char *argv[]) {
 
   app_video_set_pipelines(g_app_config.video_cam_pipeline,
                           g_app_config.video_dis_pipeline);
+  app_video_set_config(&g_app_config.video);
   app_audio_set_pipelines(g_app_config.audio_mic_pipeline,
                           g_app_config.audio_spk_pipeline);
+  app_audio_set_config(&g_app_config.audio);
+  app_recorder_set_config(&g_app_config.recorder);
+  app_preroll_set_config(&g_app_config.preroll);
 
 
 
@@ -171,6 +367,12 @@ int main(int argc, char *argv[]) {
 //            (void *)g_app_config.openai_api_key);
   start_app((app_main_func_t)app_audio_main, "Audio", NULL);
   start_app((app_main_func_t)app_display_main, "Display", NULL);
+  if (g_app_config.recorder.enabled) {
+    start_app((app_main_func_t)app_recorder_main, "Recorder", NULL);
+  }
+  if (g_app_config.preroll.enabled) {
+    start_app((app_main_func_t)app_preroll_main, "Preroll", NULL);
+  }
 
   if ((rv = nng_sub0_open(&sock)) != 0) {
     LOGE("nng_sub0_open: %s", nng_strerror(rv));
@@ -188,9 +390,18 @@ int main(int argc, char *argv[]) {
     int rv = nng_recv(sock, &buf, &sz, NNG_FLAG_ALLOC);
     printf("Received message: %.*s\n", (int)sz, buf);
     if (buf && strncmp(buf, "/meet", 5) == 0) {
+      // "/meet <camera>" overrides [livekit] camera
+      int camera = g_app_config.livekit_camera;
+      if (sz > 6 && buf[5] == ' ') {
+        char arg[8] = {0};
+        size_t len = sz - 6 < sizeof(arg) - 1 ? sz - 6 : sizeof(arg) - 1;
+        memcpy(arg, buf + 6, len);
+        camera = atoi(arg);
+      }
       MeetArgs meet_args = {
           .url = g_app_config.livekit_url,
           .token = g_app_config.livekit_token,
+          .camera = camera,
       };
       start_app((app_main_func_t)AppMeetMain, "LiveKit", (void *)&meet_args);
     }
@@ -200,16 +411,23 @@ int main(int argc, char *argv[]) {
   app_telegram_quit();
   AppMeetQuit();
   app_audio_quit();
+  app_recorder_quit();
+  app_preroll_quit();
   nng_close(sock);
 
   // Free allocated config strings
   free(g_app_config.telegram_bot_token);
   free(g_app_config.livekit_url);
   free(g_app_config.livekit_token);
+  free((char *)g_app_config.video.osd.label);
+  free((char *)g_app_config.video.osd.time_format);
   free(g_app_config.openai_api_key);
   free(g_app_config.video_cam_pipeline);
   free(g_app_config.video_dis_pipeline);
   free(g_app_config.audio_mic_pipeline);
   free(g_app_config.audio_spk_pipeline);
+  free((char *)g_app_config.audio.device);
+  free((char *)g_app_config.audio.spk_device);
+  free((char *)g_app_config.recorder.dir);
   return 0;
 }
@@ -0,0 +1,63 @@
+#ifndef MEDIA_H_
+#define MEDIA_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * media - framing shared by the compressed media topics
+ * every message starts with a media_frame_hdr_t followed by the payload;
+ * pts_us is on the media clock, media_now_us(), for audio and video alike
+ */
+#define MEDIA_FRAME_FLAG_KEY 0x01 // decodable on its own (IDR + SPS/PPS)
+#define MEDIA_FRAME_FLAG_DISCARDABLE 0x02 // no later frame references it
+// Temporal layer id of a video frame; dropping every frame with an id >= n
+// leaves a decodable stream, 0 is the base layer
+#define MEDIA_FRAME_TID_SHIFT 8
+#define MEDIA_FRAME_TID_MASK (0x07 << MEDIA_FRAME_TID_SHIFT)
+// Remote audio source of a frame, AUDIO_TRACK_*; sources are decoded
+// separately before they are mixed
+#define MEDIA_FRAME_TRACK_SHIFT 12
+#define MEDIA_FRAME_TRACK_MASK (0x0f << MEDIA_FRAME_TRACK_SHIFT)
+#define MEDIA_FRAME_TRACKS 16
+
+// Driver timestamps further behind than this are taken as bogus
+#define MEDIA_CAPTURE_MAX_AGE_US 1000000
+
+typedef struct {
+  uint32_t flags;  // MEDIA_FRAME_FLAG_*
+  uint32_t seq;    // per publisher, wraps
+  uint64_t pts_us; // capture time
+} media_frame_hdr_t;
+
+static inline int media_frame_tid(const media_frame_hdr_t *hdr) {
+  return (hdr->flags & MEDIA_FRAME_TID_MASK) >> MEDIA_FRAME_TID_SHIFT;
+}
+
+static inline int media_frame_track(const media_frame_hdr_t *hdr) {
+  return (hdr->flags & MEDIA_FRAME_TRACK_MASK) >> MEDIA_FRAME_TRACK_SHIFT;
+}
+
+/**
+ * The media clock: CLOCK_MONOTONIC in microseconds, which ALSA, V4L2,
+ * rockit and the GStreamer system clock all stamp with as well
+ */
+static inline uint64_t media_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Capture time for a frame the driver stamped at capture_us, falling back
+ * to now when the stamp is missing or not on the media clock
+ */
+static inline uint64_t media_capture_us(uint64_t capture_us, uint64_t now_us) {
+  if (capture_us == 0 || capture_us > now_us ||
+      now_us - capture_us > MEDIA_CAPTURE_MAX_AGE_US) {
+    return now_us;
+  }
+  return capture_us;
+}
+
+#endif // MEDIA_H_
@@ -1,9 +1,11 @@
 #include "meet.h" // Renamed from livekit.h
 #include "peer.h" // From webrtc.c
 #include "audio.h"
+#include "media.h"
 #include "utils.h"
 #include "utlist.h"
 #include "video.h"       // From webrtc.c
+#include "video_bus.h"
 #include <cjson/cJSON.h> // From webrtc.c
 #include <libwebsockets.h>
 #include <livekit_rtc.pb-c.h>
@@ -17,6 +19,10 @@
 
 #define kVideoBus "inproc://video_bus"
 #define kAudioBus "inproc://audio_bus" // New audio bus
+// Frames this far behind capture are late: droppable video frames and any
+// audio are skipped
+#define kMeetVideoLateUs 100000
+#define kMeetAudioLateUs 200000
 
 typedef struct WriteableBuffer {
   uint8_t *data;
@@ -44,6 +50,9 @@ static bool g_audio_subscriber_running_ = false;
 
 static nng_socket g_webrtc_video_pub_sock_ = { .id = -1 };
 static nng_socket g_webrtc_audio_pub_sock_ = { .id = -1 };
+static uint32_t g_webrtc_video_seq_ = 0;
+static int g_video_camera_ = 0;
+static uint32_t g_webrtc_audio_seq_ = 0;
 
 static const char *
 ResponseMessageToString(Livekit__SignalResponse__MessageCase message_case) {
@@ -99,9 +108,15 @@ static void MeetRequestAddAudioTrack(struct lws *wsi) {
 static void MeetRequestAddVideoTrack(struct lws *wsi) {
   Livekit__SignalRequest r = LIVEKIT__SIGNAL_REQUEST__INIT;
   Livekit__AddTrackRequest a = LIVEKIT__ADD_TRACK_REQUEST__INIT;
+  char name[16];
 
-  a.cid = (char *)"camera";
-  a.name = (char *)"camera";
+  if (g_video_camera_ == 0) {
+    snprintf(name, sizeof(name), "camera");
+  } else {
+    snprintf(name, sizeof(name), "camera%d", g_video_camera_);
+  }
+  a.cid = name;
+  a.name = name;
   a.type = LIVEKIT__TRACK_TYPE__VIDEO;
   a.source = LIVEKIT__TRACK_SOURCE__CAMERA;
 
@@ -327,6 +342,9 @@ int AppMeetMain(void *arg) {
     return 1;
   }
   memcpy(meet_args, arg, sizeof(MeetArgs));
+  if (meet_args->camera >= 0 && meet_args->camera < VIDEO_MAX_CAMERAS) {
+    g_video_camera_ = meet_args->camera;
+  }
   int ret = MeetConnect(meet_args->url, meet_args->token);
   free(meet_args); // Free the allocated MeetArgs
   return ret;
@@ -452,6 +470,16 @@ static void *MeetWebrtcDataHandlerThread(void *userdata) {
   uint64_t next_video_retry_ms = 0;
   uint64_t next_audio_retry_ms = 0;
   const uint64_t retry_interval_ms = 200;
+  // Frames are only forwarded once the peer has seen a keyframe
+  bool publisher_connected = false;
+  bool video_synced = false;
+  char video_topic[VIDEO_TOPIC_MAX];
+  char keyframe_topic[VIDEO_TOPIC_MAX];
+
+  video_camera_topic(video_topic, sizeof(video_topic), TOPIC_VIDEO_COMPRESSED,
+                     g_video_camera_);
+  video_camera_topic(keyframe_topic, sizeof(keyframe_topic),
+                     TOPIC_VIDEO_KEYFRAME, g_video_camera_);
   // video sub
   if ((rv = nng_sub0_open(&video_sock)) != 0) {
     LOGE("MeetWebrtcDataHandlerThread: nng_sub0_open video: %s",
@@ -459,8 +487,7 @@ static void *MeetWebrtcDataHandlerThread(void *userdata) {
     return NULL;
   }
   nng_socket_set(video_sock, NNG_OPT_SUB_SUBSCRIBE, "", 0);
-  if ((rv = nng_dialer_create(&video_dialer, video_sock,
-                              TOPIC_VIDEO_COMPRESSED)) != 0) {
+  if ((rv = nng_dialer_create(&video_dialer, video_sock, video_topic)) != 0) {
     LOGE("MeetWebrtcDataHandlerThread: nng_dialer_create video: %s",
          nng_strerror(rv));
     nng_close(video_sock);
@@ -511,12 +538,49 @@ static void *MeetWebrtcDataHandlerThread(void *userdata) {
       }
     }
 
+    bool connected = peer_connection_get_state(g_publisher_peer_connection_) ==
+                     PEER_CONNECTION_CONNECTED;
+    if (connected && !publisher_connected) {
+      // Show the cached keyframe right away; the live frames after it
+      // reference ones the viewer never got, so forwarding resumes with the
+      // fresh IDR the encoder is asked for here
+      nng_msg *msg = NULL;
+      video_synced = false;
+      if (video_bus_request_keyframe(keyframe_topic, &msg, 100, true) == 0) {
+        peer_connection_send_video(
+            g_publisher_peer_connection_,
+            (uint8_t *)nng_msg_body(msg) + sizeof(media_frame_hdr_t),
+            nng_msg_len(msg) - sizeof(media_frame_hdr_t));
+        nng_msg_free(msg);
+        LOGI("MeetWebrtcDataHandlerThread: sent cached keyframe");
+      }
+    } else if (!connected) {
+      video_synced = false;
+    }
+    publisher_connected = connected;
+
     uint8_t *buf = NULL;
     size_t sz;
     int rv = nng_recv(video_sock, &buf, &sz,
                       NNG_FLAG_ALLOC | NNG_FLAG_NONBLOCK);
     if (rv == 0) {
-      peer_connection_send_video(g_publisher_peer_connection_, buf, sz);
+      if (sz > sizeof(media_frame_hdr_t)) {
+        media_frame_hdr_t hdr;
+        memcpy(&hdr, buf, sizeof(hdr));
+        if (hdr.flags & MEDIA_FRAME_FLAG_KEY) {
+          video_synced = connected;
+        }
+        // Upper temporal layers and non-reference frames cost no keyframe
+        // when dropped, so shed them instead of falling further behind
+        bool droppable = media_frame_tid(&hdr) > 0 ||
+                         (hdr.flags & MEDIA_FRAME_FLAG_DISCARDABLE);
+        if (droppable && media_now_us() - hdr.pts_us > kMeetVideoLateUs) {
+          LOGD("MeetWebrtcDataHandlerThread: dropped late frame %u", hdr.seq);
+        } else if (video_synced) {
+          peer_connection_send_video(g_publisher_peer_connection_,
+                                     buf + sizeof(hdr), sz - sizeof(hdr));
+        }
+      }
       nng_free(buf, sz);
     }
 
@@ -524,7 +588,18 @@ static void *MeetWebrtcDataHandlerThread(void *userdata) {
     sz = 0;
     rv = nng_recv(audio_sock, &buf, &sz, NNG_FLAG_ALLOC | NNG_FLAG_NONBLOCK);
     if (rv == 0) {
-      peer_connection_send_audio(g_publisher_peer_connection_, buf, sz);
+      if (sz > sizeof(media_frame_hdr_t)) {
+        media_frame_hdr_t hdr;
+        memcpy(&hdr, buf, sizeof(hdr));
+        // Audio that fell this far behind would only pull the far end's
+        // playout away from the video, which drops its late frames too
+        if (media_now_us() - hdr.pts_us > kMeetAudioLateUs) {
+          LOGD("MeetWebrtcDataHandlerThread: dropped late audio %u", hdr.seq);
+        } else {
+          peer_connection_send_audio(g_publisher_peer_connection_,
+                                     buf + sizeof(hdr), sz - sizeof(hdr));
+        }
+      }
       nng_free(buf, sz);
     }
     usleep(1000);
@@ -551,18 +626,39 @@ static void MeetWebrtcSubscriberThread(void *userdata) {
   }
 }
 
+// libpeer hands us depayloaded frames without their RTP header, so the
+// sequence number is the arrival order and the timestamp the arrival time
+static void MeetWebrtcForwardTrack(nng_socket sock, uint32_t *seq,
+                                   uint32_t flags, uint8_t *data,
+                                   size_t size) {
+  nng_msg *msg;
+  if (nng_socket_id(sock) == -1 ||
+      nng_msg_alloc(&msg, sizeof(media_frame_hdr_t) + size) != 0) {
+    return;
+  }
+  media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+  hdr->flags = flags;
+  hdr->seq = (*seq)++;
+  hdr->pts_us = media_now_us();
+  memcpy(hdr + 1, data, size);
+  if (nng_sendmsg(sock, msg, NNG_FLAG_NONBLOCK) != 0) {
+    nng_msg_free(msg);
+  }
+}
+
 static void OnVideoTrack(uint8_t *data, size_t size, void *userdata) {
   (void)userdata;
-  if (nng_socket_id(g_webrtc_video_pub_sock_) != -1) {
-    nng_send(g_webrtc_video_pub_sock_, data, size, NNG_FLAG_NONBLOCK);
-  }
+  MeetWebrtcForwardTrack(g_webrtc_video_pub_sock_, &g_webrtc_video_seq_, 0,
+                         data, size);
 }
 
+// libpeer hands over depayloaded audio with no SSRC or track sid, so every
+// participant ends up in the one AUDIO_TRACK_CALL stream
 static void OnAudioTrack(uint8_t *data, size_t size, void *userdata) {
   (void)userdata;
-  if (nng_socket_id(g_webrtc_audio_pub_sock_) != -1) {
-    nng_send(g_webrtc_audio_pub_sock_, data, size, NNG_FLAG_NONBLOCK);
-  }
+  MeetWebrtcForwardTrack(g_webrtc_audio_pub_sock_, &g_webrtc_audio_seq_,
+                         (uint32_t)AUDIO_TRACK_CALL << MEDIA_FRAME_TRACK_SHIFT,
+                         data, size);
 }
 
 void MeetWebrtcSendVideoData(uint8_t *data, size_t size) {
@@ -603,6 +699,8 @@ void MeetWebrtcCreatePeerConnections() {
     g_webrtc_audio_pub_sock_.id = -1;
   }
 
+  // Published video is H.264 only: libpeer has no H.265 payloader, so HEVC
+  // publishing needs one before a codec choice can be offered
   PeerConfiguration publisher_config = {
       .ice_servers =
           {
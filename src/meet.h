@@ -7,6 +7,7 @@
 typedef struct {
   const char *url;
   const char *token;
+  int camera; // the one camera published, libpeer has a single video track
 } MeetArgs;
 
 #define kLivekitVideoWidth 640
@@ -0,0 +1,126 @@
+#include "osd.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+
+#define OSD_GLYPH_W 5
+#define OSD_GLYPH_H 7
+// One column of spacing per glyph, one pixel of outline around the text
+#define OSD_CELL_W (OSD_GLYPH_W + 1)
+#define OSD_GRID_H (OSD_GLYPH_H + 2)
+
+#define OSD_COLOR_TEXT 0xffff    // opaque white
+#define OSD_COLOR_OUTLINE 0x8000 // opaque black
+
+// Rows top to bottom, bit 4 is the leftmost pixel; lower case letters use
+// the upper case glyphs and anything missing renders blank
+static const uint8_t kOsdFont[64][OSD_GLYPH_H] = {
+    ['#' - ' '] = {0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a},
+    ['+' - ' '] = {0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00},
+    ['-' - ' '] = {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00},
+    ['.' - ' '] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c},
+    ['/' - ' '] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},
+    ['0' - ' '] = {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e},
+    ['1' - ' '] = {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e},
+    ['2' - ' '] = {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f},
+    ['3' - ' '] = {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e},
+    ['4' - ' '] = {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02},
+    ['5' - ' '] = {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e},
+    ['6' - ' '] = {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e},
+    ['7' - ' '] = {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    ['8' - ' '] = {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e},
+    ['9' - ' '] = {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c},
+    [':' - ' '] = {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00},
+    ['?' - ' '] = {0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04},
+    ['A' - ' '] = {0x0e, 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11},
+    ['B' - ' '] = {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e},
+    ['C' - ' '] = {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e},
+    ['D' - ' '] = {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c},
+    ['E' - ' '] = {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f},
+    ['F' - ' '] = {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10},
+    ['G' - ' '] = {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f},
+    ['H' - ' '] = {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11},
+    ['I' - ' '] = {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e},
+    ['J' - ' '] = {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c},
+    ['K' - ' '] = {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},
+    ['L' - ' '] = {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f},
+    ['M' - ' '] = {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11},
+    ['N' - ' '] = {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+    ['O' - ' '] = {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},
+    ['P' - ' '] = {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10},
+    ['Q' - ' '] = {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d},
+    ['R' - ' '] = {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11},
+    ['S' - ' '] = {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e},
+    ['T' - ' '] = {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    ['U' - ' '] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},
+    ['V' - ' '] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04},
+    ['W' - ' '] = {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a},
+    ['X' - ' '] = {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11},
+    ['Y' - ' '] = {0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04},
+    ['Z' - ' '] = {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f},
+    ['_' - ' '] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f},
+};
+
+void osd_text_size(const char *text, int scale, int *width, int *height) {
+  int len = (int)strnlen(text, OSD_TEXT_MAX);
+  *width = (len * OSD_CELL_W + 1) * scale;
+  *height = OSD_GRID_H * scale;
+}
+
+// Whether the glyph pixel at (x, y) of the unscaled text grid is set
+static int osd_glyph_pixel(const char *text, int len, int x, int y) {
+  x--;
+  y--;
+  if (x < 0 || y < 0 || y >= OSD_GLYPH_H || x >= len * OSD_CELL_W) {
+    return 0;
+  }
+  int col = x % OSD_CELL_W;
+  int c = toupper((unsigned char)text[x / OSD_CELL_W]);
+  if (col >= OSD_GLYPH_W || c < ' ' || c - ' ' >= 64) {
+    return 0;
+  }
+  return (kOsdFont[c - ' '][y] >> (OSD_GLYPH_W - 1 - col)) & 1;
+}
+
+void osd_render(const char *text, int scale, uint16_t *pixels, int width,
+                int height) {
+  int len = (int)strnlen(text, OSD_TEXT_MAX);
+  int grid_w = len * OSD_CELL_W + 1;
+
+  memset(pixels, 0, (size_t)width * height * sizeof(*pixels));
+  for (int gy = 0; gy < OSD_GRID_H; gy++) {
+    for (int gx = 0; gx < grid_w; gx++) {
+      uint16_t color = 0;
+      if (osd_glyph_pixel(text, len, gx, gy)) {
+        color = OSD_COLOR_TEXT;
+      } else {
+        for (int dy = -1; dy <= 1 && !color; dy++) {
+          for (int dx = -1; dx <= 1 && !color; dx++) {
+            if (osd_glyph_pixel(text, len, gx + dx, gy + dy)) {
+              color = OSD_COLOR_OUTLINE;
+            }
+          }
+        }
+      }
+      if (!color) {
+        continue;
+      }
+      for (int y = gy * scale; y < (gy + 1) * scale && y < height; y++) {
+        for (int x = gx * scale; x < (gx + 1) * scale && x < width; x++) {
+          pixels[y * width + x] = color;
+        }
+      }
+    }
+  }
+}
+
+void osd_format_time(char *buf, size_t size, const char *format) {
+  time_t now = time(NULL);
+  struct tm tm;
+
+  localtime_r(&now, &tm);
+  if (strftime(buf, size, format, &tm) == 0) {
+    buf[0] = '\0';
+  }
+}
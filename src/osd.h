@@ -0,0 +1,42 @@
+#ifndef OSD_H_
+#define OSD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * osd - on screen display text rendered into ARGB1555 bitmaps for the
+ * encoder's overlay regions; a built-in 5x7 font, white on a black outline
+ */
+#define OSD_DEFAULT_TIME_FORMAT "%Y-%m-%d %H:%M:%S"
+#define OSD_DEFAULT_SCALE 2
+#define OSD_TEXT_MAX 64
+
+// [osd] section of lamb.ini
+typedef struct {
+  int enabled;
+  const char *label;       // device ID line, NULL or empty for none
+  const char *time_format; // strftime() format, empty for no clock
+  int x;                   // top left corner on the main stream
+  int y;
+  int scale; // font pixels per glyph pixel
+} OsdConfig;
+
+/**
+ * Size in pixels of text rendered at scale
+ */
+void osd_text_size(const char *text, int scale, int *width, int *height);
+
+/**
+ * Render text into a width x height ARGB1555 bitmap, clipping at its edges
+ * Pixels outside the glyphs and their outline are transparent
+ */
+void osd_render(const char *text, int scale, uint16_t *pixels, int width,
+                int height);
+
+/**
+ * Local wall clock time with format
+ */
+void osd_format_time(char *buf, size_t size, const char *format);
+
+#endif // OSD_H_
@@ -0,0 +1,380 @@
+#include "preroll.h"
+#include "audio.h"
+#include "utils.h"
+#include "video.h"
+
+#include <nng/protocol/pubsub0/sub.h>
+#include <nng/protocol/reqrep0/rep.h>
+#include <nng/protocol/reqrep0/req.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int preroll_init(preroll_t *ring, size_t budget_bytes, uint64_t max_age_us) {
+  memset(ring, 0, sizeof(*ring));
+  ring->data = (uint8_t *)malloc(budget_bytes);
+  if (!ring->data) {
+    return -1;
+  }
+  ring->capacity = budget_bytes;
+  ring->max_age_us = max_age_us;
+  pthread_mutex_init(&ring->lock, NULL);
+  return 0;
+}
+
+void preroll_destroy(preroll_t *ring) {
+  free(ring->data);
+  ring->data = NULL;
+  pthread_mutex_destroy(&ring->lock);
+}
+
+static preroll_entry_t *preroll_entry(preroll_t *ring, uint64_t id) {
+  return &ring->entries[(ring->first + (id - ring->first_id)) %
+                        PREROLL_MAX_FRAMES];
+}
+
+static void preroll_evict(preroll_t *ring) {
+  if (ring->key_count > 0 && ring->keys[ring->key_first] == ring->first_id) {
+    ring->key_first = (ring->key_first + 1) % PREROLL_MAX_FRAMES;
+    ring->key_count--;
+  }
+  ring->first = (ring->first + 1) % PREROLL_MAX_FRAMES;
+  ring->first_id++;
+  ring->count--;
+  if (ring->count == 0) {
+    ring->head = 0;
+  }
+}
+
+// Frames are stored contiguously; one that does not fit before the end of
+// the buffer starts over at offset 0
+static bool preroll_fits(const preroll_t *ring, size_t size, size_t *at) {
+  if (ring->count == 0) {
+    *at = 0;
+    return true;
+  }
+  size_t tail = ring->entries[ring->first].offset;
+  if (ring->head > tail) {
+    if (ring->capacity - ring->head >= size) {
+      *at = ring->head;
+      return true;
+    }
+    if (tail >= size) {
+      *at = 0;
+      return true;
+    }
+    return false;
+  }
+  if (tail - ring->head >= size) {
+    *at = ring->head;
+    return true;
+  }
+  return false;
+}
+
+void preroll_push(preroll_t *ring, int stream, const media_frame_hdr_t *hdr,
+                  const void *data, size_t size) {
+  size_t at = 0;
+
+  if (size == 0 || size > ring->capacity) {
+    return;
+  }
+
+  pthread_mutex_lock(&ring->lock);
+  while (ring->count > 0 &&
+         ring->entries[ring->first].hdr.pts_us + ring->max_age_us <
+             hdr->pts_us) {
+    preroll_evict(ring);
+  }
+  while (ring->count == PREROLL_MAX_FRAMES || !preroll_fits(ring, size, &at)) {
+    preroll_evict(ring);
+  }
+
+  uint64_t id = ring->first_id + ring->count;
+  preroll_entry_t *entry =
+      &ring->entries[(ring->first + ring->count) % PREROLL_MAX_FRAMES];
+  entry->stream = stream;
+  entry->hdr = *hdr;
+  entry->offset = at;
+  entry->size = size;
+  memcpy(ring->data + at, data, size);
+  ring->head = at + size;
+  ring->count++;
+
+  if (stream == PREROLL_VIDEO && (hdr->flags & MEDIA_FRAME_FLAG_KEY)) {
+    ring->keys[(ring->key_first + ring->key_count) % PREROLL_MAX_FRAMES] = id;
+    ring->key_count++;
+  }
+  pthread_mutex_unlock(&ring->lock);
+}
+
+int preroll_query(preroll_t *ring, uint64_t from_us, uint64_t to_us,
+                  nng_msg **out) {
+  uint64_t start_id = 0;
+  uint64_t end_id;
+  size_t total = 0;
+  bool found = false;
+
+  pthread_mutex_lock(&ring->lock);
+  for (int i = ring->key_count - 1; i >= 0; i--) {
+    uint64_t id = ring->keys[(ring->key_first + i) % PREROLL_MAX_FRAMES];
+    start_id = id;
+    if (from_us == 0 || preroll_entry(ring, id)->hdr.pts_us <= from_us) {
+      found = true;
+      break;
+    }
+  }
+  // A range older than what is held starts at the oldest keyframe
+  if (!found && ring->key_count == 0) {
+    pthread_mutex_unlock(&ring->lock);
+    return -1;
+  }
+
+  end_id = ring->first_id + ring->count;
+  for (uint64_t id = start_id; id < end_id; id++) {
+    preroll_entry_t *entry = preroll_entry(ring, id);
+    if (to_us == 0 || entry->hdr.pts_us <= to_us) {
+      total += sizeof(preroll_frame_t) + entry->size;
+    }
+  }
+  if (nng_msg_alloc(out, total) != 0) {
+    pthread_mutex_unlock(&ring->lock);
+    return -1;
+  }
+
+  uint8_t *p = (uint8_t *)nng_msg_body(*out);
+  for (uint64_t id = start_id; id < end_id; id++) {
+    preroll_entry_t *entry = preroll_entry(ring, id);
+    if (to_us != 0 && entry->hdr.pts_us > to_us) {
+      continue;
+    }
+    preroll_frame_t frame = {
+        .stream = entry->stream,
+        .size = (uint32_t)entry->size,
+        .hdr = entry->hdr,
+    };
+    memcpy(p, &frame, sizeof(frame));
+    memcpy(p + sizeof(frame), ring->data + entry->offset, entry->size);
+    p += sizeof(frame) + entry->size;
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return 0;
+}
+
+int preroll_request(const char *topic, uint64_t from_us, uint64_t to_us,
+                    nng_msg **out, int timeout_ms) {
+  preroll_query_t query = {.from_us = from_us, .to_us = to_us};
+  nng_socket sock;
+  int rv;
+
+  if (nng_req0_open(&sock) != 0) {
+    return -1;
+  }
+  nng_socket_set_ms(sock, NNG_OPT_SENDTIMEO, timeout_ms);
+  nng_socket_set_ms(sock, NNG_OPT_RECVTIMEO, timeout_ms);
+  if (nng_dial(sock, topic, NULL, 0) != 0) {
+    nng_close(sock);
+    return -1;
+  }
+
+  *out = NULL;
+  rv = nng_send(sock, &query, sizeof(query), 0);
+  if (rv == 0) {
+    rv = nng_recvmsg(sock, out, 0);
+  }
+  nng_close(sock);
+
+  if (rv != 0) {
+    return -1;
+  }
+  if (nng_msg_len(*out) == 0) {
+    nng_msg_free(*out);
+    *out = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int preroll_next(nng_msg *msg, size_t *offset, preroll_frame_t *frame,
+                 const uint8_t **data) {
+  size_t len = nng_msg_len(msg);
+  const uint8_t *body = (const uint8_t *)nng_msg_body(msg);
+
+  if (*offset + sizeof(*frame) > len) {
+    return -1;
+  }
+  memcpy(frame, body + *offset, sizeof(*frame));
+  if (frame->size > len - *offset - sizeof(*frame)) {
+    return -1;
+  }
+  *data = body + *offset + sizeof(*frame);
+  *offset += sizeof(*frame) + frame->size;
+  return 0;
+}
+
+static PrerollConfig g_config = {
+    .seconds = PREROLL_DEFAULT_SECONDS,
+    .budget_kb = PREROLL_DEFAULT_BUDGET_KB,
+};
+static preroll_t g_ring;
+static nng_socket g_rep_sock = {.id = -1};
+static volatile bool g_running = false;
+
+void app_preroll_set_config(const PrerollConfig *config) {
+  g_config = *config;
+  if (g_config.seconds <= 0) {
+    g_config.seconds = PREROLL_DEFAULT_SECONDS;
+  }
+  if (g_config.budget_kb <= 0) {
+    g_config.budget_kb = PREROLL_DEFAULT_BUDGET_KB;
+  }
+}
+
+static void *preroll_service_thread(void *arg) {
+  (void)arg;
+
+  while (1) {
+    nng_msg *req;
+    nng_msg *rep = NULL;
+    preroll_query_t query = {0};
+    int rv = nng_recvmsg(g_rep_sock, &req, 0);
+    if (rv == NNG_ECLOSED) {
+      break;
+    } else if (rv != 0) {
+      continue;
+    }
+    if (nng_msg_len(req) >= sizeof(query)) {
+      memcpy(&query, nng_msg_body(req), sizeof(query));
+    }
+    nng_msg_free(req);
+
+    // An empty reply means there is no keyframe yet
+    if (preroll_query(&g_ring, query.from_us, query.to_us, &rep) != 0 &&
+        nng_msg_alloc(&rep, 0) != 0) {
+      continue;
+    }
+    if (nng_sendmsg(g_rep_sock, rep, 0) != 0) {
+      nng_msg_free(rep);
+    }
+  }
+  return NULL;
+}
+
+static int preroll_dial(nng_socket *sock, const char *topic) {
+  int rv;
+
+  if ((rv = nng_sub0_open(sock)) != 0) {
+    LOGE("preroll: nng_sub0_open: %s", nng_strerror(rv));
+    return -1;
+  }
+  nng_socket_set(*sock, NNG_OPT_SUB_SUBSCRIBE, "", 0);
+  if ((rv = nng_dial(*sock, topic, NULL, NNG_FLAG_NONBLOCK)) != 0) {
+    LOGE("preroll: nng_dial %s: %s", topic, nng_strerror(rv));
+    nng_close(*sock);
+    return -1;
+  }
+  return 0;
+}
+
+int app_preroll_main(void *arg) {
+  (void)arg;
+
+  char video_topic[VIDEO_TOPIC_MAX];
+  char rep_topic[VIDEO_TOPIC_MAX];
+  nng_socket video_sock;
+  nng_socket audio_sock;
+  int video_fd;
+  int audio_fd;
+  pthread_t service;
+  int rv;
+
+  if (preroll_init(&g_ring, (size_t)g_config.budget_kb * 1024,
+                   (uint64_t)g_config.seconds * 1000000) != 0) {
+    LOGE("preroll: out of memory");
+    return -1;
+  }
+
+  video_camera_topic(video_topic, sizeof(video_topic), TOPIC_VIDEO_COMPRESSED,
+                     g_config.camera);
+  if (preroll_dial(&video_sock, video_topic) != 0) {
+    preroll_destroy(&g_ring);
+    return -1;
+  }
+  if (preroll_dial(&audio_sock, TOPIC_AUDIO_COMPRESSED) != 0) {
+    nng_close(video_sock);
+    preroll_destroy(&g_ring);
+    return -1;
+  }
+  video_camera_topic(rep_topic, sizeof(rep_topic), TOPIC_MEDIA_PREROLL,
+                     g_config.camera);
+  if ((rv = nng_rep0_open(&g_rep_sock)) != 0 ||
+      (rv = nng_listen(g_rep_sock, rep_topic, NULL, 0)) != 0) {
+    LOGE("preroll: %s: %s", rep_topic, nng_strerror(rv));
+    if (nng_socket_id(g_rep_sock) != -1) {
+      nng_close(g_rep_sock);
+      g_rep_sock.id = -1;
+    }
+    nng_close(audio_sock);
+    nng_close(video_sock);
+    preroll_destroy(&g_ring);
+    return -1;
+  }
+  if (nng_socket_get_int(video_sock, NNG_OPT_RECVFD, &video_fd) != 0 ||
+      nng_socket_get_int(audio_sock, NNG_OPT_RECVFD, &audio_fd) != 0 ||
+      pthread_create(&service, NULL, preroll_service_thread, NULL) != 0) {
+    LOGE("preroll: failed to start");
+    nng_close(g_rep_sock);
+    g_rep_sock.id = -1;
+    nng_close(audio_sock);
+    nng_close(video_sock);
+    preroll_destroy(&g_ring);
+    return -1;
+  }
+
+  LOGI("preroll: keeping %d s / %d KB of %s", g_config.seconds,
+       g_config.budget_kb, video_topic);
+
+  g_running = true;
+  while (g_running) {
+    struct pollfd fds[2] = {
+        {.fd = video_fd, .events = POLLIN},
+        {.fd = audio_fd, .events = POLLIN},
+    };
+    if (poll(fds, 2, 100) <= 0) {
+      continue;
+    }
+
+    nng_msg *msg;
+    while (nng_recvmsg(video_sock, &msg, NNG_FLAG_NONBLOCK) == 0) {
+      media_frame_hdr_t hdr;
+      if (nng_msg_len(msg) > sizeof(hdr)) {
+        memcpy(&hdr, nng_msg_body(msg), sizeof(hdr));
+        preroll_push(&g_ring, PREROLL_VIDEO, &hdr,
+                     (uint8_t *)nng_msg_body(msg) + sizeof(hdr),
+                     nng_msg_len(msg) - sizeof(hdr));
+      }
+      nng_msg_free(msg);
+    }
+    while (nng_recvmsg(audio_sock, &msg, NNG_FLAG_NONBLOCK) == 0) {
+      media_frame_hdr_t hdr;
+      if (nng_msg_len(msg) > sizeof(hdr)) {
+        memcpy(&hdr, nng_msg_body(msg), sizeof(hdr));
+        preroll_push(&g_ring, PREROLL_AUDIO, &hdr,
+                     (uint8_t *)nng_msg_body(msg) + sizeof(hdr),
+                     nng_msg_len(msg) - sizeof(hdr));
+      }
+      nng_msg_free(msg);
+    }
+  }
+
+  nng_close(g_rep_sock);
+  pthread_join(service, NULL);
+  g_rep_sock.id = -1;
+  nng_close(audio_sock);
+  nng_close(video_sock);
+  preroll_destroy(&g_ring);
+  return 0;
+}
+
+void app_preroll_quit(void) { g_running = false; }
@@ -0,0 +1,113 @@
+#ifndef PREROLL_H_
+#define PREROLL_H_
+
+#include "media.h"
+#include <nng/nng.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * preroll - the last few seconds of encoded camera and microphone frames
+ * kept in a fixed size byte ring with a keyframe index; readers ask for a
+ * time range and get the frames from the keyframe that precedes it
+ */
+
+// request/reply: preroll_query_t in, preroll_frame_t records out; one
+// service per camera, see video_camera_topic()
+#define TOPIC_MEDIA_PREROLL "inproc://media.preroll"
+
+#define PREROLL_DEFAULT_SECONDS 10
+#define PREROLL_DEFAULT_BUDGET_KB (8 * 1024)
+#define PREROLL_MAX_FRAMES 4096
+
+enum {
+  PREROLL_VIDEO = 0,
+  PREROLL_AUDIO = 1,
+};
+
+// [preroll] section of lamb.ini
+typedef struct {
+  int enabled;
+  int camera;
+  int seconds;   // frames older than this are dropped
+  int budget_kb; // and the oldest go first once this is used up
+} PrerollConfig;
+
+/**
+ * from_us == 0 starts at the most recent keyframe, to_us == 0 means now
+ */
+typedef struct {
+  uint64_t from_us;
+  uint64_t to_us;
+} preroll_query_t;
+
+// Reply record, followed by size bytes of H.264 or Opus
+typedef struct {
+  uint32_t stream; // PREROLL_VIDEO or PREROLL_AUDIO
+  uint32_t size;
+  media_frame_hdr_t hdr;
+} preroll_frame_t;
+
+typedef struct {
+  uint32_t stream;
+  media_frame_hdr_t hdr;
+  size_t offset; // into data
+  size_t size;
+} preroll_entry_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  uint8_t *data;
+  size_t capacity;
+  size_t head; // next write offset
+  uint64_t max_age_us;
+
+  preroll_entry_t entries[PREROLL_MAX_FRAMES]; // ring of frames, oldest first
+  uint64_t first_id; // id of entries[first]
+  int first;
+  int count;
+
+  uint64_t keys[PREROLL_MAX_FRAMES]; // ids of video keyframes, oldest first
+  int key_first;
+  int key_count;
+} preroll_t;
+
+int preroll_init(preroll_t *ring, size_t budget_bytes, uint64_t max_age_us);
+void preroll_destroy(preroll_t *ring);
+
+/**
+ * Copy one frame in, evicting the oldest as needed
+ */
+void preroll_push(preroll_t *ring, int stream, const media_frame_hdr_t *hdr,
+                  const void *data, size_t size);
+
+/**
+ * Collect the frames of both streams from the last keyframe at or before
+ * from_us up to to_us into a newly allocated message of preroll_frame_t
+ * records
+ * Returns 0 if success, -1 if there is no keyframe to start from
+ */
+int preroll_query(preroll_t *ring, uint64_t from_us, uint64_t to_us,
+                  nng_msg **out);
+
+/**
+ * Ask the service on topic; see preroll_query()
+ */
+int preroll_request(const char *topic, uint64_t from_us, uint64_t to_us,
+                    nng_msg **out, int timeout_ms);
+
+/**
+ * Walk a reply: copy the record at *offset into *frame, point *data at its
+ * payload inside msg and advance *offset
+ * Returns 0 if success, -1 at the end
+ */
+int preroll_next(nng_msg *msg, size_t *offset, preroll_frame_t *frame,
+                 const uint8_t **data);
+
+void app_preroll_set_config(const PrerollConfig *config);
+int app_preroll_main(void *arg);
+void app_preroll_quit(void);
+
+#endif // PREROLL_H_
@@ -0,0 +1,459 @@
+#define _GNU_SOURCE // sync_file_range
+#include "recorder.h"
+#include "audio.h"
+#include "media.h"
+#include "preroll.h"
+#include "ts_mux.h"
+#include "utils.h"
+#include "video.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <nng/nng.h>
+#include <nng/protocol/pubsub0/sub.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Files are written in page aligned blocks of whole TS packets, ~1 MiB
+// each; 1024 packets of 188 bytes are exactly 47 pages of 4 KiB
+#define RECORDER_BLOCK_SIZE (5 * 1024 * TS_PACKET_SIZE)
+#define RECORDER_BLOCK_ALIGN 4096
+// Blocks in flight; once storage is this far behind, media is dropped
+#define RECORDER_BLOCKS 8
+#define RECORDER_PATH_MAX 256
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  char path[RECORDER_PATH_MAX]; // if set, the block starts this new file
+} rec_block_t;
+
+typedef struct {
+  rec_block_t blocks[RECORDER_BLOCKS];
+  utils_queue_t free_q; // empty blocks for the muxer
+  utils_queue_t full_q; // blocks waiting for the writer
+  pthread_mutex_t lock; // only guards the condition below
+  pthread_cond_t cond;
+  bool writer_stop;
+  pthread_t writer;
+
+  ts_mux_t mux;
+  rec_block_t *cur;
+  char next_path[RECORDER_PATH_MAX];
+  bool synced;   // the first segment has started
+  bool dropping; // out of blocks, skip media until the next keyframe
+  bool primed;   // started from the pre-roll ring, up to primed_seq
+  uint32_t primed_seq;
+  uint64_t base_us;
+  uint64_t seg_start_us;
+  uint64_t seg_bytes;
+  uint32_t drops;
+} recorder_t;
+
+static RecorderConfig g_config = {
+    .dir = RECORDER_DEFAULT_DIR,
+    .segment_s = RECORDER_DEFAULT_SEGMENT_S,
+    .segment_mb = RECORDER_DEFAULT_SEGMENT_MB,
+};
+static volatile bool g_running = false;
+
+void app_recorder_set_config(const RecorderConfig *config) {
+  g_config = *config;
+  if (!g_config.dir || g_config.dir[0] == '\0') {
+    g_config.dir = RECORDER_DEFAULT_DIR;
+  }
+  if (g_config.segment_s <= 0) {
+    g_config.segment_s = RECORDER_DEFAULT_SEGMENT_S;
+  }
+  if (g_config.segment_mb <= 0) {
+    g_config.segment_mb = RECORDER_DEFAULT_SEGMENT_MB;
+  }
+}
+
+static int write_all(int fd, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Owns the files: opening, writing and closing never happen on the
+// thread that drains the bus
+static void *recorder_writer_thread(void *arg) {
+  recorder_t *rec = (recorder_t *)arg;
+  int fd = -1;
+  off_t pos = 0;
+
+  while (1) {
+    void *item = NULL;
+    pthread_mutex_lock(&rec->lock);
+    while (utils_queue_pop(&rec->full_q, &item) != 0 && !rec->writer_stop) {
+      pthread_cond_wait(&rec->cond, &rec->lock);
+    }
+    pthread_mutex_unlock(&rec->lock);
+    if (!item) {
+      break;
+    }
+
+    rec_block_t *block = (rec_block_t *)item;
+    if (block->path[0] != '\0') {
+      if (fd >= 0) {
+        close(fd);
+      }
+      fd = open(block->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0) {
+        LOGE("recorder: %s: %s", block->path, strerror(errno));
+      } else {
+        LOGI("recorder: new segment %s", block->path);
+      }
+      pos = 0;
+    }
+
+    if (fd >= 0) {
+      if (write_all(fd, block->data, block->len) == 0) {
+        // Start writeback now instead of letting dirty pages pile up into
+        // one long flush
+        sync_file_range(fd, pos, block->len, SYNC_FILE_RANGE_WRITE);
+        pos += block->len;
+      } else {
+        LOGE("recorder: write failed: %s", strerror(errno));
+        close(fd);
+        fd = -1;
+      }
+    }
+
+    block->len = 0;
+    block->path[0] = '\0';
+    utils_queue_push(&rec->free_q, block);
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  return NULL;
+}
+
+static void recorder_submit(recorder_t *rec) {
+  if (!rec->cur) {
+    return;
+  }
+  // Cannot fail, the queue holds every block
+  utils_queue_push(&rec->full_q, rec->cur);
+  rec->cur = NULL;
+  pthread_mutex_lock(&rec->lock);
+  pthread_cond_signal(&rec->cond);
+  pthread_mutex_unlock(&rec->lock);
+}
+
+static void recorder_on_packet(void *opaque, const uint8_t *pkt) {
+  recorder_t *rec = (recorder_t *)opaque;
+
+  if (rec->dropping) {
+    return;
+  }
+  if (!rec->cur) {
+    void *item;
+    if (utils_queue_pop(&rec->free_q, &item) != 0) {
+      rec->dropping = true;
+      rec->drops++;
+      LOGW("recorder: storage is behind, dropping until the next keyframe");
+      return;
+    }
+    rec->cur = (rec_block_t *)item;
+    if (rec->next_path[0] != '\0') {
+      memcpy(rec->cur->path, rec->next_path, sizeof(rec->next_path));
+      rec->next_path[0] = '\0';
+    }
+  }
+
+  memcpy(rec->cur->data + rec->cur->len, pkt, TS_PACKET_SIZE);
+  rec->cur->len += TS_PACKET_SIZE;
+  rec->seg_bytes += TS_PACKET_SIZE;
+  if (rec->cur->len == RECORDER_BLOCK_SIZE) {
+    recorder_submit(rec);
+  }
+}
+
+static void recorder_new_segment(recorder_t *rec, uint64_t pts_us) {
+  char stamp[32];
+  time_t now = time(NULL);
+  struct tm tm;
+
+  localtime_r(&now, &tm);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+  // The partial block belongs to the previous file
+  recorder_submit(rec);
+  snprintf(rec->next_path, sizeof(rec->next_path), "%s/cam%d-%s.ts",
+           g_config.dir, g_config.camera, stamp);
+  rec->seg_start_us = pts_us;
+  rec->seg_bytes = 0;
+}
+
+static bool recorder_segment_full(const recorder_t *rec, uint64_t pts_us) {
+  return rec->seg_bytes >= (uint64_t)g_config.segment_mb * 1024 * 1024 ||
+         pts_us - rec->seg_start_us >= (uint64_t)g_config.segment_s * 1000000;
+}
+
+// Media time relative to the first keyframe, one second in so that audio
+// captured just before it still has a valid timestamp
+static int64_t recorder_pts(const recorder_t *rec, uint64_t pts_us) {
+  return ((int64_t)(pts_us - rec->base_us) + 1000000) * TS_CLOCK_HZ / 1000000;
+}
+
+static void recorder_write_video(recorder_t *rec, const media_frame_hdr_t *hdr,
+                                 const uint8_t *au, size_t size) {
+  bool key = hdr->flags & MEDIA_FRAME_FLAG_KEY;
+
+  if (!rec->synced || rec->dropping) {
+    if (!key) {
+      return;
+    }
+    if (!rec->synced) {
+      rec->base_us = hdr->pts_us;
+      recorder_new_segment(rec, hdr->pts_us);
+      rec->synced = true;
+    }
+    rec->dropping = false;
+  } else if (key && recorder_segment_full(rec, hdr->pts_us)) {
+    recorder_new_segment(rec, hdr->pts_us);
+  }
+
+  if (key) {
+    ts_mux_write_tables(&rec->mux);
+  }
+  ts_mux_write_video(&rec->mux, au, size, recorder_pts(rec, hdr->pts_us), key);
+}
+
+static void recorder_write_audio(recorder_t *rec, const uint8_t *packet,
+                                 size_t size, uint64_t pts_us) {
+  if (!rec->synced || rec->dropping || size == 0) {
+    return;
+  }
+  int64_t pts = recorder_pts(rec, pts_us);
+  if (pts < 0) {
+    return;
+  }
+  ts_mux_write_audio(&rec->mux, packet, size, pts);
+}
+
+static void recorder_on_video(recorder_t *rec, nng_msg *msg) {
+  media_frame_hdr_t hdr;
+  size_t len = nng_msg_len(msg);
+
+  if (len <= sizeof(hdr)) {
+    return;
+  }
+  memcpy(&hdr, nng_msg_body(msg), sizeof(hdr));
+  if (rec->primed) {
+    // Already written from the pre-roll ring, unless the publisher restarted
+    int32_t ahead = (int32_t)(hdr.seq - rec->primed_seq);
+    if (ahead <= 0 && ahead > -PREROLL_MAX_FRAMES) {
+      return;
+    }
+    rec->primed = false;
+  }
+  recorder_write_video(rec, &hdr, (uint8_t *)nng_msg_body(msg) + sizeof(hdr),
+                       len - sizeof(hdr));
+}
+
+static void recorder_on_audio(recorder_t *rec, nng_msg *msg) {
+  media_frame_hdr_t hdr;
+  size_t len = nng_msg_len(msg);
+
+  // Until the live video catches up, queued audio repeats the pre-roll
+  if (rec->primed || len <= sizeof(hdr)) {
+    return;
+  }
+  memcpy(&hdr, nng_msg_body(msg), sizeof(hdr));
+  recorder_write_audio(rec, (uint8_t *)nng_msg_body(msg) + sizeof(hdr),
+                       len - sizeof(hdr), hdr.pts_us);
+}
+
+// With a pre-roll ring running for the camera, start from its latest
+// keyframe rather than waiting for the next one on the bus
+static void recorder_prime(recorder_t *rec, const char *topic) {
+  nng_msg *msg;
+  preroll_frame_t frame;
+  const uint8_t *data;
+  size_t offset = 0;
+
+  if (preroll_request(topic, 0, 0, &msg, 100) != 0) {
+    return;
+  }
+  while (preroll_next(msg, &offset, &frame, &data) == 0) {
+    if (frame.stream == PREROLL_VIDEO) {
+      recorder_write_video(rec, &frame.hdr, data, frame.size);
+      rec->primed_seq = frame.hdr.seq;
+      rec->primed = rec->synced;
+    } else {
+      recorder_write_audio(rec, data, frame.size, frame.hdr.pts_us);
+    }
+  }
+  nng_msg_free(msg);
+  if (rec->primed) {
+    LOGI("recorder: started from the pre-roll ring");
+  }
+}
+
+static void recorder_free(recorder_t *rec) {
+  for (int i = 0; i < RECORDER_BLOCKS; i++) {
+    free(rec->blocks[i].data);
+  }
+  utils_queue_destroy(&rec->free_q);
+  utils_queue_destroy(&rec->full_q);
+  pthread_mutex_destroy(&rec->lock);
+  pthread_cond_destroy(&rec->cond);
+  free(rec);
+}
+
+static recorder_t *recorder_new(void) {
+  recorder_t *rec = (recorder_t *)calloc(1, sizeof(recorder_t));
+  if (!rec) {
+    return NULL;
+  }
+  pthread_mutex_init(&rec->lock, NULL);
+  pthread_cond_init(&rec->cond, NULL);
+  // utils_queue keeps one slot free
+  if (utils_queue_init(&rec->free_q, RECORDER_BLOCKS + 1) != 0 ||
+      utils_queue_init(&rec->full_q, RECORDER_BLOCKS + 1) != 0) {
+    recorder_free(rec);
+    return NULL;
+  }
+  for (int i = 0; i < RECORDER_BLOCKS; i++) {
+    if (posix_memalign((void **)&rec->blocks[i].data, RECORDER_BLOCK_ALIGN,
+                       RECORDER_BLOCK_SIZE) != 0) {
+      rec->blocks[i].data = NULL;
+      recorder_free(rec);
+      return NULL;
+    }
+    utils_queue_push(&rec->free_q, &rec->blocks[i]);
+  }
+  ts_mux_init(&rec->mux, DEFAULT_CHANNELS, recorder_on_packet, rec);
+  return rec;
+}
+
+static int recorder_dial(nng_socket *sock, const char *topic) {
+  int rv;
+
+  if ((rv = nng_sub0_open(sock)) != 0) {
+    LOGE("recorder: nng_sub0_open: %s", nng_strerror(rv));
+    return -1;
+  }
+  nng_socket_set(*sock, NNG_OPT_SUB_SUBSCRIBE, "", 0);
+  if ((rv = nng_dial(*sock, topic, NULL, NNG_FLAG_NONBLOCK)) != 0) {
+    LOGE("recorder: nng_dial %s: %s", topic, nng_strerror(rv));
+    nng_close(*sock);
+    return -1;
+  }
+  return 0;
+}
+
+int app_recorder_main(void *arg) {
+  (void)arg;
+
+  char video_topic[VIDEO_TOPIC_MAX];
+  char preroll_topic[VIDEO_TOPIC_MAX];
+  nng_socket video_sock;
+  nng_socket audio_sock;
+  int video_fd;
+  int audio_fd;
+  recorder_t *rec;
+
+  if (mkdir(g_config.dir, 0755) != 0 && errno != EEXIST) {
+    LOGE("recorder: mkdir %s: %s", g_config.dir, strerror(errno));
+    return -1;
+  }
+
+  rec = recorder_new();
+  if (!rec) {
+    LOGE("recorder: out of memory");
+    return -1;
+  }
+
+  video_camera_topic(video_topic, sizeof(video_topic), TOPIC_VIDEO_COMPRESSED,
+                     g_config.camera);
+  if (recorder_dial(&video_sock, video_topic) != 0) {
+    recorder_free(rec);
+    return -1;
+  }
+  if (recorder_dial(&audio_sock, TOPIC_AUDIO_COMPRESSED) != 0) {
+    nng_close(video_sock);
+    recorder_free(rec);
+    return -1;
+  }
+  if (nng_socket_get_int(video_sock, NNG_OPT_RECVFD, &video_fd) != 0 ||
+      nng_socket_get_int(audio_sock, NNG_OPT_RECVFD, &audio_fd) != 0 ||
+      pthread_create(&rec->writer, NULL, recorder_writer_thread, rec) != 0) {
+    LOGE("recorder: failed to start");
+    nng_close(audio_sock);
+    nng_close(video_sock);
+    recorder_free(rec);
+    return -1;
+  }
+
+  LOGI("recorder: %s to %s, %d s / %d MB segments", video_topic,
+       g_config.dir, g_config.segment_s, g_config.segment_mb);
+  video_camera_topic(preroll_topic, sizeof(preroll_topic), TOPIC_MEDIA_PREROLL,
+                     g_config.camera);
+  recorder_prime(rec, preroll_topic);
+
+  g_running = true;
+  while (g_running) {
+    struct pollfd fds[2] = {
+        {.fd = video_fd, .events = POLLIN},
+        {.fd = audio_fd, .events = POLLIN},
+    };
+    if (poll(fds, 2, 100) <= 0) {
+      continue;
+    }
+
+    // Alternate between the topics to keep the mux roughly in time order
+    bool more = true;
+    while (more) {
+      nng_msg *msg;
+      more = false;
+      if (nng_recvmsg(video_sock, &msg, NNG_FLAG_NONBLOCK) == 0) {
+        recorder_on_video(rec, msg);
+        nng_msg_free(msg);
+        more = true;
+      }
+      if (nng_recvmsg(audio_sock, &msg, NNG_FLAG_NONBLOCK) == 0) {
+        recorder_on_audio(rec, msg);
+        nng_msg_free(msg);
+        more = true;
+      }
+    }
+  }
+
+  recorder_submit(rec);
+  pthread_mutex_lock(&rec->lock);
+  rec->writer_stop = true;
+  pthread_cond_signal(&rec->cond);
+  pthread_mutex_unlock(&rec->lock);
+  pthread_join(rec->writer, NULL);
+
+  LOGI("recorder: stopped, %u drop(s)", rec->drops);
+  nng_close(audio_sock);
+  nng_close(video_sock);
+  recorder_free(rec);
+  return 0;
+}
+
+void app_recorder_quit(void) { g_running = false; }
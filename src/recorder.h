@@ -0,0 +1,25 @@
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+/*
+ * recorder - segmented MPEG-TS recording of the compressed camera and
+ * microphone streams, no re-encoding; segments start on a keyframe
+ */
+#define RECORDER_DEFAULT_DIR "recordings"
+#define RECORDER_DEFAULT_SEGMENT_S 300
+#define RECORDER_DEFAULT_SEGMENT_MB 256
+
+// [recorder] section of lamb.ini
+typedef struct {
+  int enabled;
+  const char *dir;
+  int camera;
+  int segment_s;  // rotate after this much media time
+  int segment_mb; // or after this many bytes, whichever comes first
+} RecorderConfig;
+
+void app_recorder_set_config(const RecorderConfig *config);
+int app_recorder_main(void *arg);
+void app_recorder_quit(void);
+
+#endif // RECORDER_H_
@@ -8,9 +8,13 @@
 #include <sys/poll.h>
 #include <time.h>
 #include <unistd.h>
+#include "media.h"
+#include "osd.h"
+#include "snapshot.h"
+#include "video.h"
+#include "video_bus.h"
 #include <nng/nng.h>
 #include <nng/protocol/pubsub0/pub.h>
-#include "video.h"
 #include "rk_debug.h"
 #include "rk_defines.h"
 #include "rk_mpi_adec.h"
@@ -35,19 +39,20 @@
 #include <rk_aiq_user_api2_imgproc.h>
 #include <rk_aiq_user_api2_sysctl.h>
 
-pthread_t main_thread;
-void (*media_on_video_frame)(uint8_t *data, int size) = NULL;
-void (*media_on_audio_frame)(uint8_t *data, int size) = NULL;
-static int media_quit_flag = 0;
+static volatile int media_quit_flag = 0;
 static pthread_mutex_t media_mutex = PTHREAD_MUTEX_INITIALIZER;
-MPP_CHN_S stSrcChn, stDestChn;
-
-static void *GetMediaBuffer0(void *arg) {
-}
 
+#define VENC_LIVE_GOP 60
 
-static RK_S32 g_s32FrameCnt = -1;
-static bool quit = false;
+static VideoConfig g_config = {
+    .fps = VIDEO_DEFAULT_FPS,
+    .bitrate_kbps = VIDEO_DEFAULT_BITRATE_KBPS,
+    .motion = 0,
+    .motion_idle_s = VIDEO_DEFAULT_MOTION_IDLE_S,
+    .static_fps = VIDEO_DEFAULT_STATIC_FPS,
+    .static_kbps = VIDEO_DEFAULT_STATIC_KBPS,
+    .temporal_layers = 1,
+};
 
 #define MAX_AIQ_CTX 8
 static rk_aiq_sys_ctx_t *g_aiq_ctx[MAX_AIQ_CTX];
@@ -180,7 +185,7 @@ RK_S32 SIMPLE_COMM_ISP_Stop(RK_S32 CamId) {
 }
 
 static RK_S32 test_venc_init(int chnId, int width, int height,
-                             RK_CODEC_ID_E enType) {
+                             RK_CODEC_ID_E enType, int bitrate_kbps) {
   printf("========%s========\n", __func__);
   VENC_RECV_PIC_PARAM_S stRecvParam;
   VENC_CHN_ATTR_S stAttr;
@@ -188,15 +193,16 @@ static RK_S32 test_venc_init(int chnId, int width, int height,
 
   if (enType == RK_VIDEO_ID_AVC) {
     stAttr.stRcAttr.enRcMode = VENC_RC_MODE_H264CBR;
-    stAttr.stRcAttr.stH264Cbr.u32BitRate = 10 * 1024;
-    stAttr.stRcAttr.stH264Cbr.u32Gop = 60;
+    stAttr.stRcAttr.stH264Cbr.u32BitRate = bitrate_kbps;
+    stAttr.stRcAttr.stH264Cbr.u32Gop = VENC_LIVE_GOP;
   } else if (enType == RK_VIDEO_ID_HEVC) {
     stAttr.stRcAttr.enRcMode = VENC_RC_MODE_H265CBR;
-    stAttr.stRcAttr.stH265Cbr.u32BitRate = 10 * 1024;
-    stAttr.stRcAttr.stH265Cbr.u32Gop = 60;
+    stAttr.stRcAttr.stH265Cbr.u32BitRate = bitrate_kbps;
+    stAttr.stRcAttr.stH265Cbr.u32Gop = VENC_LIVE_GOP;
   } else if (enType == RK_VIDEO_ID_MJPEG) {
-    stAttr.stRcAttr.enRcMode = VENC_RC_MODE_MJPEGCBR;
-    stAttr.stRcAttr.stMjpegCbr.u32BitRate = 10 * 1024;
+    // Stills are encoded one at a time, a rate target means nothing here
+    stAttr.stRcAttr.enRcMode = VENC_RC_MODE_MJPEGFIXQP;
+    stAttr.stRcAttr.stMjpegFixQp.u32Qfactor = 85;
   }
 
   stAttr.stVencAttr.enType = enType;
@@ -211,23 +217,33 @@ static RK_S32 test_venc_init(int chnId, int width, int height,
   stAttr.stVencAttr.u32BufSize = width * height * 3 / 2;
   stAttr.stVencAttr.enMirror = MIRROR_NONE;
 
-  RK_MPI_VENC_CreateChn(chnId, &stAttr);
+  RK_S32 s32Ret = RK_MPI_VENC_CreateChn(chnId, &stAttr);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_VENC_CreateChn %d fail %x", chnId, s32Ret);
+    return s32Ret;
+  }
 
-  // stRecvParam.s32RecvPicNum = 100;		//recv 100 slice
-  // RK_MPI_VENC_StartRecvFrame(chnId, &stRecvParam);
+  // JPEG channels stay idle and are started one picture at a time
+  if (enType == RK_VIDEO_ID_MJPEG) {
+    return 0;
+  }
 
   memset(&stRecvParam, 0, sizeof(VENC_RECV_PIC_PARAM_S));
   stRecvParam.s32RecvPicNum = -1;
-  RK_MPI_VENC_StartRecvFrame(chnId, &stRecvParam);
+  s32Ret = RK_MPI_VENC_StartRecvFrame(chnId, &stRecvParam);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_VENC_StartRecvFrame %d fail %x", chnId, s32Ret);
+    RK_MPI_VENC_DestroyChn(chnId);
+    return s32Ret;
+  }
 
   return 0;
 }
 
 // demo板dev默认都是0，根据不同的channel 来选择不同的vi节点
-int vi_dev_init() {
+int vi_dev_init(int devId) {
   printf("%s\n", __func__);
   int ret = 0;
-  int devId = 0;
   int pipeId = devId;
 
   VI_DEV_ATTR_S stDevAttr;
@@ -270,7 +286,7 @@ int vi_dev_init() {
   return 0;
 }
 
-int vi_chn_init(int channelId, int width, int height) {
+int vi_chn_init(int pipeId, int channelId, int width, int height) {
   int ret;
   int buf_cnt = 2;
   // VI init
@@ -285,8 +301,8 @@ int vi_chn_init(int channelId, int width, int height) {
   vi_chn_attr.enCompressMode = COMPRESS_MODE_NONE; // COMPRESS_AFBC_16x16;
   vi_chn_attr.u32Depth = 0; // 0, get fail, 1 - u32BufCount, can get, if bind to
                             // other device, must be < u32BufCount
-  ret = RK_MPI_VI_SetChnAttr(0, channelId, &vi_chn_attr);
-  ret |= RK_MPI_VI_EnableChn(0, channelId);
+  ret = RK_MPI_VI_SetChnAttr(pipeId, channelId, &vi_chn_attr);
+  ret |= RK_MPI_VI_EnableChn(pipeId, channelId);
   if (ret) {
     printf("ERROR: create VI error! ret=%d\n", ret);
     return ret;
@@ -295,103 +311,751 @@ int vi_chn_init(int channelId, int width, int height) {
   return ret;
 }
 
-int app_video_main(void) {
-  RK_MPI_SYS_Init();
-  pthread_mutex_lock(&media_mutex);
-  RK_S32 s32Ret = RK_FAILURE;
-  RK_U32 u32Width = 1280;
-  RK_U32 u32Height = 720;
-  RK_CODEC_ID_E enCodecType = RK_VIDEO_ID_AVC;
-  RK_CHAR *pCodecName = "H264";
-  RK_S32 s32chnlId = 0;
-  int c;
-  int ret = -1;
-
-  printf("#CodecName:%s\n", pCodecName);
-  printf("#Resolution: %dx%d\n", u32Width, u32Height);
-  printf("#CameraIdx: %d\n\n", s32chnlId);
-
-		SIMPLE_COMM_ISP_Init(0, RK_AIQ_WORKING_MODE_NORMAL, 0, "/etc/iqfiles/");
-		SIMPLE_COMM_ISP_Run(0);
-
-  vi_dev_init();
-  vi_chn_init(s32chnlId, u32Width, u32Height);
-
-  // venc  init
-  test_venc_init(0, u32Width, u32Height,
-                 enCodecType); // RK_VIDEO_ID_AVC RK_VIDEO_ID_HEVC
-
-  // bind vi to venc
-  stSrcChn.enModId = RK_ID_VI;
-  stSrcChn.s32DevId = 0;
-  stSrcChn.s32ChnId = s32chnlId;
-
-  stDestChn.enModId = RK_ID_VENC;
-  stDestChn.s32DevId = 0;
-  stDestChn.s32ChnId = 0;
-  printf("====RK_MPI_SYS_Bind vi0 to venc0====\n");
-  s32Ret = RK_MPI_SYS_Bind(&stSrcChn, &stDestChn);
+// VENC channels: main streams first, then sub streams
+#define VENC_CHN_MAIN(cam) (cam)
+#define VENC_CHN_SUB(cam) (VIDEO_MAX_CAMERAS + (cam))
+#define VENC_CHN_SNAP(cam) (2 * VIDEO_MAX_CAMERAS + (cam))
+#define OSD_RGN_TIME(cam) (2 * (cam))
+#define OSD_RGN_LABEL(cam) (2 * (cam) + 1)
+// Time strings like %B vary in width, leave room for a few more glyphs
+#define OSD_TIME_SLACK 4
+
+// One overlay region, composited by the encoder on every frame
+typedef struct {
+  RGN_HANDLE handle;
+  bool created;
+  int width;
+  int height;
+  uint16_t *pixels; // ARGB1555
+  char text[OSD_TEXT_MAX];
+} rk_osd_region_t;
+
+// One VI channel -> VENC channel -> video_bus path
+typedef struct {
+  int width;
+  int height;
+  int bitrate_kbps;
+  MPP_CHN_S vi;
+  MPP_CHN_S venc;
+  video_bus_t bus;
+  bool bus_open;
+  pthread_t tid;
+  bool running;
+  bool started;
+} rk_stream_t;
+
+typedef struct {
+  int id;
+  rk_stream_t main;
+  rk_stream_t sub; // optional low resolution stream from VI channel 1
+  MPP_CHN_S ivs;
+  pthread_t motion_tid;
+  bool motion_running;
+  MPP_CHN_S snap; // MJPEG channel on the main VI output
+  bool snap_bound;
+  snapshot_service_t snapshot;
+  rk_osd_region_t osd_time;
+  rk_osd_region_t osd_label;
+  pthread_t osd_tid;
+  bool osd_running;
+  bool started;
+} rk_camera_t;
+
+static rk_camera_t g_cameras[VIDEO_MAX_CAMERAS];
+
+// Motion detection on the VI output, results are polled by motion_thread
+static RK_S32 ivs_init(int chnId, int width, int height) {
+  IVS_CHN_ATTR_S stAttr;
+  IVS_MD_ATTR_S stMdAttr;
+  RK_S32 s32Ret;
+
+  memset(&stAttr, 0, sizeof(stAttr));
+  stAttr.enMode = IVS_MODE_MD;
+  stAttr.u32PicWidth = width;
+  stAttr.u32PicHeight = height;
+  stAttr.enPixelFormat = RK_FMT_YUV420SP;
+  stAttr.s32Gop = VENC_LIVE_GOP;
+  stAttr.bMDEnable = RK_TRUE;
+  stAttr.s32MDInterval = 5;
+  stAttr.bMDNightMode = RK_TRUE;
+  stAttr.u32MDSensibility = 3;
+  s32Ret = RK_MPI_IVS_CreateChn(chnId, &stAttr);
   if (s32Ret != RK_SUCCESS) {
-    LOGE("bind 0 ch venc failed");
+    LOGE("RK_MPI_IVS_CreateChn fail %x", s32Ret);
+    return s32Ret;
   }
-  media_quit_flag = 0;
 
-  void *pData = RK_NULL;
+  memset(&stMdAttr, 0, sizeof(stMdAttr));
+  RK_MPI_IVS_GetMdAttr(chnId, &stMdAttr);
+  stMdAttr.s32ThreshSad = 40;
+  stMdAttr.s32ThreshMove = 2;
+  stMdAttr.s32SwitchSad = 0;
+  s32Ret = RK_MPI_IVS_SetMdAttr(chnId, &stMdAttr);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_IVS_SetMdAttr fail %x", s32Ret);
+  }
+  return s32Ret;
+}
+
+// Static scenes are encoded as low frame rate VBR with a long GOP; motion
+// restores the live CBR settings and forces an IDR so viewers catch up
+static void venc_set_static(rk_camera_t *cam, bool is_static) {
+  int chnId = cam->main.venc.s32ChnId;
+  VENC_CHN_ATTR_S stAttr;
+  RK_U32 u32Fps = g_config.fps > 0 ? g_config.fps : VIDEO_DEFAULT_FPS;
+  RK_U32 u32StaticFps =
+      g_config.static_fps > 0 && g_config.static_fps < (int)u32Fps
+          ? g_config.static_fps
+          : u32Fps;
+  RK_S32 s32Ret = RK_MPI_VENC_GetChnAttr(chnId, &stAttr);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_VENC_GetChnAttr fail %x", s32Ret);
+    return;
+  }
 
-  VENC_STREAM_S stFrame;
-  stFrame.pstPack = malloc(sizeof(VENC_PACK_S));
+  RK_CODEC_ID_E enType = stAttr.stVencAttr.enType;
+  memset(&stAttr.stRcAttr, 0, sizeof(stAttr.stRcAttr));
+  if (is_static && enType == RK_VIDEO_ID_AVC) {
+    stAttr.stRcAttr.enRcMode = VENC_RC_MODE_H264VBR;
+    stAttr.stRcAttr.stH264Vbr.u32Gop = u32StaticFps * 10;
+    stAttr.stRcAttr.stH264Vbr.u32SrcFrameRateNum = u32Fps;
+    stAttr.stRcAttr.stH264Vbr.u32SrcFrameRateDen = 1;
+    stAttr.stRcAttr.stH264Vbr.fr32DstFrameRateNum = u32StaticFps;
+    stAttr.stRcAttr.stH264Vbr.fr32DstFrameRateDen = 1;
+    stAttr.stRcAttr.stH264Vbr.u32BitRate = g_config.static_kbps / 2;
+    stAttr.stRcAttr.stH264Vbr.u32MaxBitRate = g_config.static_kbps;
+    stAttr.stRcAttr.stH264Vbr.u32MinBitRate = g_config.static_kbps / 4;
+  } else if (is_static && enType == RK_VIDEO_ID_HEVC) {
+    stAttr.stRcAttr.enRcMode = VENC_RC_MODE_H265VBR;
+    stAttr.stRcAttr.stH265Vbr.u32Gop = u32StaticFps * 10;
+    stAttr.stRcAttr.stH265Vbr.u32SrcFrameRateNum = u32Fps;
+    stAttr.stRcAttr.stH265Vbr.u32SrcFrameRateDen = 1;
+    stAttr.stRcAttr.stH265Vbr.fr32DstFrameRateNum = u32StaticFps;
+    stAttr.stRcAttr.stH265Vbr.fr32DstFrameRateDen = 1;
+    stAttr.stRcAttr.stH265Vbr.u32BitRate = g_config.static_kbps / 2;
+    stAttr.stRcAttr.stH265Vbr.u32MaxBitRate = g_config.static_kbps;
+    stAttr.stRcAttr.stH265Vbr.u32MinBitRate = g_config.static_kbps / 4;
+  } else if (enType == RK_VIDEO_ID_AVC) {
+    stAttr.stRcAttr.enRcMode = VENC_RC_MODE_H264CBR;
+    stAttr.stRcAttr.stH264Cbr.u32Gop = VENC_LIVE_GOP;
+    stAttr.stRcAttr.stH264Cbr.u32SrcFrameRateNum = u32Fps;
+    stAttr.stRcAttr.stH264Cbr.u32SrcFrameRateDen = 1;
+    stAttr.stRcAttr.stH264Cbr.fr32DstFrameRateNum = u32Fps;
+    stAttr.stRcAttr.stH264Cbr.fr32DstFrameRateDen = 1;
+    stAttr.stRcAttr.stH264Cbr.u32BitRate = cam->main.bitrate_kbps;
+  } else if (enType == RK_VIDEO_ID_HEVC) {
+    stAttr.stRcAttr.enRcMode = VENC_RC_MODE_H265CBR;
+    stAttr.stRcAttr.stH265Cbr.u32Gop = VENC_LIVE_GOP;
+    stAttr.stRcAttr.stH265Cbr.u32SrcFrameRateNum = u32Fps;
+    stAttr.stRcAttr.stH265Cbr.u32SrcFrameRateDen = 1;
+    stAttr.stRcAttr.stH265Cbr.fr32DstFrameRateNum = u32Fps;
+    stAttr.stRcAttr.stH265Cbr.fr32DstFrameRateDen = 1;
+    stAttr.stRcAttr.stH265Cbr.u32BitRate = cam->main.bitrate_kbps;
+  } else {
+    return;
+  }
+
+  s32Ret = RK_MPI_VENC_SetChnAttr(chnId, &stAttr);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_VENC_SetChnAttr fail %x", s32Ret);
+    return;
+  }
+  if (!is_static) {
+    RK_MPI_VENC_RequestIDR(chnId, RK_TRUE);
+  }
+  LOGI("camera %d: %s", cam->id, is_static ? "static scene" : "motion");
+}
 
+static void *motion_thread(void *arg) {
+  rk_camera_t *cam = (rk_camera_t *)arg;
+  int ivsChn = cam->ivs.s32ChnId;
+  uint64_t idle_us = (uint64_t)g_config.motion_idle_s * 1000000;
+  uint64_t last_motion_us = media_now_us();
+  bool is_static = false;
+  char topic[VIDEO_TOPIC_MAX];
   nng_socket sock;
-  nng_pub0_open(&sock);
-  // listen on 
-  nng_listen(sock, TOPIC_VIDEO_COMPRESSED, NULL, 0);
+
+  video_camera_topic(topic, sizeof(topic), TOPIC_VIDEO_MOTION, cam->id);
+  if (nng_pub0_open(&sock) != 0) {
+    sock.id = -1;
+  } else if (nng_listen(sock, topic, NULL, 0) != 0) {
+    nng_close(sock);
+    sock.id = -1;
+  }
 
   while (!media_quit_flag) {
-    s32Ret = RK_MPI_VENC_GetStream(0, &stFrame, -1);
-    if (s32Ret == RK_SUCCESS) {
-      pData = RK_MPI_MB_Handle2VirAddr(stFrame.pstPack->pMbBlk);
-      // fwrite(pData, 1, stFrame.pstPack->u32Len, venc0_file);
-      //LOGI("get stream success, size:%d", stFrame.pstPack->u32Len);
-      // publish to nng
-      nng_send(sock, pData, stFrame.pstPack->u32Len, NNG_FLAG_NONBLOCK);
-      s32Ret = RK_MPI_VENC_ReleaseStream(0, &stFrame);
-      if (s32Ret != RK_SUCCESS) {
-        LOGE("RK_MPI_VENC_ReleaseStream fail %x", s32Ret);
+    IVS_RESULT_INFO_S stResults;
+    memset(&stResults, 0, sizeof(stResults));
+    if (RK_MPI_IVS_GetResults(ivsChn, &stResults, 1000) != RK_SUCCESS) {
+      continue;
+    }
+    RK_U32 u32Area = stResults.s32ResultNum > 0
+                         ? stResults.pstResults->stMdInfo.u32Square
+                         : 0;
+    RK_MPI_IVS_ReleaseResults(ivsChn, &stResults);
+
+    uint64_t now = media_now_us();
+    bool changed = false;
+    if (u32Area > 0) {
+      last_motion_us = now;
+      if (is_static) {
+        is_static = false;
+        changed = true;
       }
-    } else {
-      LOGE("RK_MPI_VI_GetChnFrame fail %x", s32Ret);
+    } else if (!is_static && now - last_motion_us >= idle_us) {
+      is_static = true;
+      changed = true;
+    }
+    if (!changed) {
+      continue;
     }
 
-    usleep(10 * 1000);
+    venc_set_static(cam, is_static);
+    if (nng_socket_id(sock) != -1) {
+      VideoMotionEvent ev = {
+          .pts_us = now,
+          .active = !is_static,
+          .area = u32Area,
+      };
+      nng_send(sock, &ev, sizeof(ev), NNG_FLAG_NONBLOCK);
+    }
   }
 
-  free(stFrame.pstPack);
-  s32Ret = RK_MPI_SYS_UnBind(&stSrcChn, &stDestChn);
+  if (is_static) {
+    venc_set_static(cam, false);
+  }
+  if (nng_socket_id(sock) != -1) {
+    nng_close(sock);
+  }
+  return NULL;
+}
+
+static void *stream_thread(void *arg) {
+  rk_stream_t *stream = (rk_stream_t *)arg;
+  int chnId = stream->venc.s32ChnId;
+  VENC_STREAM_S stFrame;
+  VENC_PACK_S stPack;
+  RK_S32 s32Ret;
+
+  stFrame.pstPack = &stPack;
+  while (!media_quit_flag) {
+    s32Ret = RK_MPI_VENC_GetStream(chnId, &stFrame, 1000);
+    if (s32Ret != RK_SUCCESS) {
+      continue;
+    }
+    void *pData = RK_MPI_MB_Handle2VirAddr(stFrame.pstPack->pMbBlk);
+    // The pack carries the VI capture time, which is on the media clock
+    uint64_t pts_us = media_capture_us(stFrame.pstPack->u64PTS, media_now_us());
+    video_bus_publish(&stream->bus, pData, stFrame.pstPack->u32Len, pts_us);
+    s32Ret = RK_MPI_VENC_ReleaseStream(chnId, &stFrame);
+    if (s32Ret != RK_SUCCESS) {
+      LOGE("RK_MPI_VENC_ReleaseStream fail %x", s32Ret);
+    }
+  }
+  return NULL;
+}
+
+// Every other frame is a base frame referencing the previous base frame, the
+// one in between references it and is not referenced itself, so it can be
+// dropped downstream. u32Enhance only adds more non-reference frames, which
+// is still two levels, so a deeper hierarchy is not available
+// Returns the number of layers in effect
+static int venc_set_temporal_layers(int chnId, int layers) {
+  VENC_REF_PARAM_S stRefParam;
+  RK_S32 s32Ret;
+
+  if (layers <= 1) {
+    return 1;
+  }
+  if (layers > VIDEO_BUS_MAX_TEMPORAL_LAYERS) {
+    LOGW("temporal_layers %d not supported, using %d", layers,
+         VIDEO_BUS_MAX_TEMPORAL_LAYERS);
+    layers = VIDEO_BUS_MAX_TEMPORAL_LAYERS;
+  }
+  memset(&stRefParam, 0, sizeof(stRefParam));
+  stRefParam.u32Base = 1;
+  stRefParam.u32Enhance = layers - 1;
+  stRefParam.bEnablePred = RK_TRUE;
+  s32Ret = RK_MPI_VENC_SetRefParam(chnId, &stRefParam);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_VENC_SetRefParam fail %x", s32Ret);
+    return 1;
+  }
+  // Restart the pattern so it lines up with the frame count on the bus
+  RK_MPI_VENC_RequestIDR(chnId, RK_TRUE);
+  return layers;
+}
+
+// Keyframe topic requests for a new GOP, e.g. from a publisher that just
+// connected
+static void stream_request_idr(void *arg) {
+  rk_stream_t *stream = (rk_stream_t *)arg;
+  RK_MPI_VENC_RequestIDR(stream->venc.s32ChnId, RK_TRUE);
+}
+
+// Enable VI channel viChn of the camera and encode it on vencChn
+static int stream_start(rk_stream_t *stream, int camId, int viChn,
+                        int vencChn, const char *topic,
+                        const char *keyframe_topic) {
+  char name[VIDEO_TOPIC_MAX];
+  char keyframe_name[VIDEO_TOPIC_MAX];
+  RK_S32 s32Ret;
+
+  if (vi_chn_init(camId, viChn, stream->width, stream->height)) {
+    LOGE("camera %d: vi chn %d init failed", camId, viChn);
+    return -1;
+  }
+  stream->vi.enModId = RK_ID_VI;
+  stream->vi.s32DevId = camId;
+  stream->vi.s32ChnId = viChn;
+  stream->venc.enModId = RK_ID_VENC;
+  stream->venc.s32DevId = 0;
+  stream->venc.s32ChnId = vencChn;
+
+  LOGI("camera %d: vi chn %d %dx%d -> venc %d H264 %d kbps", camId, viChn,
+       stream->width, stream->height, vencChn, stream->bitrate_kbps);
+  if (test_venc_init(vencChn, stream->width, stream->height, RK_VIDEO_ID_AVC,
+                     stream->bitrate_kbps) != RK_SUCCESS) {
+    LOGE("camera %d: venc %d init failed", camId, vencChn);
+    goto err_vi;
+  }
+  int layers = venc_set_temporal_layers(vencChn, g_config.temporal_layers);
+  s32Ret = RK_MPI_SYS_Bind(&stream->vi, &stream->venc);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("camera %d: bind vi to venc %d failed %x", camId, vencChn, s32Ret);
+    goto err_venc;
+  }
+
+  video_camera_topic(name, sizeof(name), topic, camId);
+  video_camera_topic(keyframe_name, sizeof(keyframe_name), keyframe_topic,
+                     camId);
+  if (video_bus_open(&stream->bus, name, keyframe_name) != 0) {
+    LOGE("camera %d: cannot publish on %s", camId, name);
+    goto err_bind;
+  }
+  video_bus_set_temporal_layers(&stream->bus, layers);
+  video_bus_set_idr_handler(&stream->bus, stream_request_idr, stream);
+  stream->bus_open = true;
+  if (pthread_create(&stream->tid, NULL, stream_thread, stream) != 0) {
+    LOGE("camera %d: cannot start venc %d thread", camId, vencChn);
+    video_bus_close(&stream->bus);
+    stream->bus_open = false;
+    goto err_bind;
+  }
+  stream->running = true;
+  stream->started = true;
+  return 0;
+
+err_bind:
+  RK_MPI_SYS_UnBind(&stream->vi, &stream->venc);
+err_venc:
+  RK_MPI_VENC_StopRecvFrame(vencChn);
+  RK_MPI_VENC_DestroyChn(vencChn);
+err_vi:
+  RK_MPI_VI_DisableChn(camId, viChn);
+  return -1;
+}
+
+static void stream_join(rk_stream_t *stream) {
+  if (stream->running) {
+    pthread_join(stream->tid, NULL);
+    stream->running = false;
+  }
+}
+
+static void stream_stop(rk_stream_t *stream) {
+  RK_S32 s32Ret;
+
+  if (!stream->started) {
+    return;
+  }
+  stream_join(stream);
+  if (stream->bus_open) {
+    video_bus_close(&stream->bus);
+    stream->bus_open = false;
+  }
+
+  s32Ret = RK_MPI_SYS_UnBind(&stream->vi, &stream->venc);
   if (s32Ret != RK_SUCCESS) {
     LOGE("RK_MPI_SYS_UnBind fail %x", s32Ret);
   }
+  s32Ret = RK_MPI_VI_DisableChn(stream->vi.s32DevId, stream->vi.s32ChnId);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_VI_DisableChn fail %x", s32Ret);
+  }
+
+  s32Ret = RK_MPI_VENC_StopRecvFrame(stream->venc.s32ChnId);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_VENC_StopRecvFrame fail %x", s32Ret);
+  }
+  s32Ret = RK_MPI_VENC_DestroyChn(stream->venc.s32ChnId);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("RK_MPI_VENC_DestroyChn fail %x", s32Ret);
+  }
+  stream->started = false;
+}
+
+// Encode the next VI frame as JPEG; the H.264 channels share the VI output
+// and are not affected
+static int snapshot_capture(void *ctx, nng_msg **jpeg, int timeout_ms) {
+  rk_camera_t *cam = (rk_camera_t *)ctx;
+  int chnId = cam->snap.s32ChnId;
+  VENC_RECV_PIC_PARAM_S stRecvParam;
+  VENC_STREAM_S stFrame;
+  VENC_PACK_S stPack;
+  RK_S32 s32Ret;
+  int rv = -1;
+
+  memset(&stRecvParam, 0, sizeof(stRecvParam));
+  stRecvParam.s32RecvPicNum = 1;
+  s32Ret = RK_MPI_VENC_StartRecvFrame(chnId, &stRecvParam);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("camera %d: snapshot start failed %x", cam->id, s32Ret);
+    return -1;
+  }
+
+  stFrame.pstPack = &stPack;
+  s32Ret = RK_MPI_VENC_GetStream(chnId, &stFrame, timeout_ms);
+  if (s32Ret == RK_SUCCESS) {
+    void *pData = RK_MPI_MB_Handle2VirAddr(stFrame.pstPack->pMbBlk);
+    if (nng_msg_alloc(jpeg, stFrame.pstPack->u32Len) == 0) {
+      memcpy(nng_msg_body(*jpeg), pData, stFrame.pstPack->u32Len);
+      rv = 0;
+    }
+    RK_MPI_VENC_ReleaseStream(chnId, &stFrame);
+  } else {
+    LOGW("camera %d: no snapshot within %d ms", cam->id, timeout_ms);
+  }
+  RK_MPI_VENC_StopRecvFrame(chnId);
+  return rv;
+}
+
+static void snapshot_start(rk_camera_t *cam) {
+  char topic[VIDEO_TOPIC_MAX];
+  int fps = g_config.fps > 0 ? g_config.fps : VIDEO_DEFAULT_FPS;
+  RK_S32 s32Ret;
+
+  cam->snap.enModId = RK_ID_VENC;
+  cam->snap.s32DevId = 0;
+  cam->snap.s32ChnId = VENC_CHN_SNAP(cam->id);
+  if (test_venc_init(cam->snap.s32ChnId, cam->main.width, cam->main.height,
+                     RK_VIDEO_ID_MJPEG, 0) != RK_SUCCESS) {
+    LOGE("camera %d: jpeg venc init failed", cam->id);
+    return;
+  }
+  s32Ret = RK_MPI_SYS_Bind(&cam->main.vi, &cam->snap);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("camera %d: bind vi to jpeg venc failed %x", cam->id, s32Ret);
+    RK_MPI_VENC_DestroyChn(cam->snap.s32ChnId);
+    return;
+  }
+  cam->snap_bound = true;
+
+  // Allow two frame intervals: one to wait for the frame, one to encode it
+  video_camera_topic(topic, sizeof(topic), TOPIC_VIDEO_SNAPSHOT, cam->id);
+  snapshot_service_open(&cam->snapshot, topic, snapshot_capture, cam,
+                        2 * 1000 / fps + 1);
+}
+
+static void snapshot_stop(rk_camera_t *cam) {
+  snapshot_service_close(&cam->snapshot);
+  if (cam->snap_bound) {
+    RK_MPI_SYS_UnBind(&cam->main.vi, &cam->snap);
+    RK_MPI_VENC_DestroyChn(cam->snap.s32ChnId);
+    cam->snap_bound = false;
+  }
+}
 
-  s32Ret = RK_MPI_VI_DisableChn(0, 0);
-  LOGE("RK_MPI_VI_DisableChn %x", s32Ret);
+// Redraw the region bitmap, only when the text changed
+static void osd_region_set_text(rk_osd_region_t *rgn, const char *text) {
+  BITMAP_S stBitmap;
+  RK_S32 s32Ret;
 
-  s32Ret = RK_MPI_VENC_StopRecvFrame(0);
+  if (!rgn->created || strcmp(rgn->text, text) == 0) {
+    return;
+  }
+  snprintf(rgn->text, sizeof(rgn->text), "%s", text);
+  osd_render(rgn->text, g_config.osd.scale, rgn->pixels, rgn->width,
+             rgn->height);
+
+  memset(&stBitmap, 0, sizeof(stBitmap));
+  stBitmap.enPixelFormat = RK_FMT_ARGB1555;
+  stBitmap.u32Width = rgn->width;
+  stBitmap.u32Height = rgn->height;
+  stBitmap.pData = rgn->pixels;
+  s32Ret = RK_MPI_RGN_SetBitMap(rgn->handle, &stBitmap);
   if (s32Ret != RK_SUCCESS) {
-    pthread_mutex_unlock(&media_mutex);
-    return s32Ret;
+    LOGE("RK_MPI_RGN_SetBitMap fail %x", s32Ret);
   }
+}
+
+// Overlay sized for chars glyphs at (x, y) on the main and snapshot
+// channels, which share the main VI resolution
+static int osd_region_create(rk_camera_t *cam, rk_osd_region_t *rgn,
+                             RGN_HANDLE handle, int chars, int x, int y) {
+  RGN_ATTR_S stRgnAttr;
+  RGN_CHN_ATTR_S stChnAttr;
+  char sizing[OSD_TEXT_MAX];
+  RK_S32 s32Ret;
+
+  memset(rgn, 0, sizeof(*rgn));
+  rgn->handle = handle;
+  if (chars >= (int)sizeof(sizing)) {
+    chars = sizeof(sizing) - 1;
+  }
+  memset(sizing, ' ', chars);
+  sizing[chars] = '\0';
+  osd_text_size(sizing, g_config.osd.scale, &rgn->width, &rgn->height);
+  // The encoder wants 16 pixel aligned widths and positions
+  rgn->width = (rgn->width + 15) & ~15;
+  rgn->height = (rgn->height + 1) & ~1;
+  rgn->pixels = (uint16_t *)calloc(rgn->width * rgn->height, 2);
+  if (!rgn->pixels) {
+    return -1;
+  }
+
+  memset(&stRgnAttr, 0, sizeof(stRgnAttr));
+  stRgnAttr.enType = OVERLAY_RGN;
+  stRgnAttr.unAttr.stOverlay.enPixelFmt = RK_FMT_ARGB1555;
+  stRgnAttr.unAttr.stOverlay.stSize.u32Width = rgn->width;
+  stRgnAttr.unAttr.stOverlay.stSize.u32Height = rgn->height;
+  stRgnAttr.unAttr.stOverlay.u32CanvasNum = 2;
+  s32Ret = RK_MPI_RGN_Create(handle, &stRgnAttr);
+  if (s32Ret != RK_SUCCESS) {
+    LOGE("camera %d: RK_MPI_RGN_Create %d fail %x", cam->id, handle, s32Ret);
+    free(rgn->pixels);
+    rgn->pixels = NULL;
+    return -1;
+  }
+  rgn->created = true;
 
-  s32Ret = RK_MPI_VENC_DestroyChn(0);
+  memset(&stChnAttr, 0, sizeof(stChnAttr));
+  stChnAttr.bShow = RK_TRUE;
+  stChnAttr.enType = OVERLAY_RGN;
+  stChnAttr.unChnAttr.stOverlayChn.stPoint.s32X = x & ~15;
+  stChnAttr.unChnAttr.stOverlayChn.stPoint.s32Y = y & ~1;
+  stChnAttr.unChnAttr.stOverlayChn.u32BgAlpha = 0;
+  stChnAttr.unChnAttr.stOverlayChn.u32FgAlpha = 255;
+  stChnAttr.unChnAttr.stOverlayChn.u32Layer = handle % 2;
+  s32Ret = RK_MPI_RGN_AttachToChn(handle, &cam->main.venc, &stChnAttr);
   if (s32Ret != RK_SUCCESS) {
-    LOGE("RK_MPI_VDEC_DestroyChn fail %x", s32Ret);
+    LOGE("camera %d: RK_MPI_RGN_AttachToChn fail %x", cam->id, s32Ret);
+  }
+  if (cam->snap_bound) {
+    RK_MPI_RGN_AttachToChn(handle, &cam->snap, &stChnAttr);
+  }
+  return 0;
+}
+
+static void osd_region_destroy(rk_camera_t *cam, rk_osd_region_t *rgn) {
+  if (!rgn->created) {
+    return;
+  }
+  RK_MPI_RGN_DetachFromChn(rgn->handle, &cam->main.venc);
+  if (cam->snap_bound) {
+    RK_MPI_RGN_DetachFromChn(rgn->handle, &cam->snap);
+  }
+  RK_MPI_RGN_Destroy(rgn->handle);
+  free(rgn->pixels);
+  memset(rgn, 0, sizeof(*rgn));
+}
+
+// The clock is the only text that changes; it is redrawn once a second and
+// the encoder blends the bitmap into every frame on its own
+static void *osd_thread(void *arg) {
+  rk_camera_t *cam = (rk_camera_t *)arg;
+  const char *format = g_config.osd.time_format ? g_config.osd.time_format
+                                                : OSD_DEFAULT_TIME_FORMAT;
+  char text[OSD_TEXT_MAX];
+
+  while (!media_quit_flag) {
+    osd_format_time(text, sizeof(text), format);
+    osd_region_set_text(&cam->osd_time, text);
+    usleep(100 * 1000);
+  }
+  return NULL;
+}
+
+static void osd_start(rk_camera_t *cam) {
+  const OsdConfig *osd = &g_config.osd;
+  const char *format =
+      osd->time_format ? osd->time_format : OSD_DEFAULT_TIME_FORMAT;
+  int y = osd->y;
+  char text[OSD_TEXT_MAX];
+
+  if (!osd->enabled) {
+    return;
+  }
+  if (osd->scale <= 0) {
+    g_config.osd.scale = OSD_DEFAULT_SCALE;
   }
 
-  s32Ret = RK_MPI_VI_DisableDev(0);
+  if (format[0] != '\0') {
+    osd_format_time(text, sizeof(text), format);
+    if (osd_region_create(cam, &cam->osd_time, OSD_RGN_TIME(cam->id),
+                          strlen(text) + OSD_TIME_SLACK, osd->x, y) == 0) {
+      osd_region_set_text(&cam->osd_time, text);
+      y += cam->osd_time.height + 2 * osd->scale;
+      if (pthread_create(&cam->osd_tid, NULL, osd_thread, cam) == 0) {
+        cam->osd_running = true;
+      }
+    }
+  }
+  if (osd->label && osd->label[0] != '\0' &&
+      osd_region_create(cam, &cam->osd_label, OSD_RGN_LABEL(cam->id),
+                        strlen(osd->label), osd->x, y) == 0) {
+    osd_region_set_text(&cam->osd_label, osd->label);
+  }
+}
+
+static void osd_stop(rk_camera_t *cam) {
+  if (cam->osd_running) {
+    pthread_join(cam->osd_tid, NULL);
+    cam->osd_running = false;
+  }
+  osd_region_destroy(cam, &cam->osd_time);
+  osd_region_destroy(cam, &cam->osd_label);
+}
+
+// ISP, VI, VENC (and IVS) for one sensor; camera N uses VI dev/pipe N and
+// IVS channel N, and publishes on its own topics
+static int camera_start(rk_camera_t *cam, int id,
+                        const VideoCameraConfig *cfg, bool multi_cam) {
+  RK_S32 s32Ret;
+
+  memset(cam, 0, sizeof(*cam));
+  cam->id = id;
+  cam->main.width = cfg->width > 0 ? cfg->width : VIDEO_DEFAULT_WIDTH;
+  cam->main.height = cfg->height > 0 ? cfg->height : VIDEO_DEFAULT_HEIGHT;
+  cam->main.bitrate_kbps =
+      cfg->bitrate_kbps > 0 ? cfg->bitrate_kbps : g_config.bitrate_kbps;
+
+  SIMPLE_COMM_ISP_Init(id, RK_AIQ_WORKING_MODE_NORMAL,
+                       multi_cam ? RK_TRUE : RK_FALSE, "/etc/iqfiles/");
+  SIMPLE_COMM_ISP_Run(id);
+
+  if (vi_dev_init(id) < 0 ||
+      stream_start(&cam->main, id, 0, VENC_CHN_MAIN(id),
+                   TOPIC_VIDEO_COMPRESSED, TOPIC_VIDEO_KEYFRAME) < 0) {
+    LOGE("camera %d: vi init failed", id);
+    SIMPLE_COMM_ISP_Stop(id);
+    return -1;
+  }
+  cam->started = true;
+  snapshot_start(cam);
+  osd_start(cam);
+
+  if (g_config.sub_width > 0) {
+    // The ISP scales VI channel 1 itself, no software resize involved
+    cam->sub.width = g_config.sub_width;
+    cam->sub.height = g_config.sub_height > 0
+                          ? g_config.sub_height
+                          : g_config.sub_width * cam->main.height /
+                                cam->main.width;
+    cam->sub.height &= ~1;
+    cam->sub.bitrate_kbps = g_config.sub_bitrate_kbps > 0
+                                ? g_config.sub_bitrate_kbps
+                                : VIDEO_DEFAULT_SUB_BITRATE_KBPS;
+    stream_start(&cam->sub, id, 1, VENC_CHN_SUB(id),
+                 TOPIC_VIDEO_COMPRESSED_SUB, TOPIC_VIDEO_KEYFRAME_SUB);
+  }
+
+  cam->ivs.enModId = RK_ID_IVS;
+  cam->ivs.s32DevId = 0;
+  cam->ivs.s32ChnId = id;
+  if (g_config.motion && ivs_init(cam->ivs.s32ChnId, cam->main.width,
+                                  cam->main.height) == RK_SUCCESS) {
+    s32Ret = RK_MPI_SYS_Bind(&cam->main.vi, &cam->ivs);
+    if (s32Ret != RK_SUCCESS) {
+      LOGE("camera %d: bind vi to ivs failed %x", id, s32Ret);
+      RK_MPI_IVS_DestroyChn(cam->ivs.s32ChnId);
+    } else if (pthread_create(&cam->motion_tid, NULL, motion_thread, cam) !=
+               0) {
+      RK_MPI_SYS_UnBind(&cam->main.vi, &cam->ivs);
+      RK_MPI_IVS_DestroyChn(cam->ivs.s32ChnId);
+    } else {
+      cam->motion_running = true;
+    }
+  }
+  return 0;
+}
+
+static void camera_stop(rk_camera_t *cam) {
+  RK_S32 s32Ret;
+
+  if (!cam->started) {
+    return;
+  }
+  if (cam->motion_running) {
+    pthread_join(cam->motion_tid, NULL);
+    RK_MPI_SYS_UnBind(&cam->main.vi, &cam->ivs);
+    RK_MPI_IVS_DestroyChn(cam->ivs.s32ChnId);
+    cam->motion_running = false;
+  }
+  osd_stop(cam);
+  snapshot_stop(cam);
+  stream_stop(&cam->sub);
+  stream_stop(&cam->main);
+
+  s32Ret = RK_MPI_VI_DisableDev(cam->id);
   LOGE("RK_MPI_VI_DisableDev %x", s32Ret);
-  s32Ret = 0;
-  LOGE("test running exit:%d", s32Ret);
+}
+
+// The rockit graph is fixed, there are no pipelines to configure
+void app_video_set_pipelines(const char *cam_pipeline,
+                             const char *dis_pipeline) {
+  (void)cam_pipeline;
+  (void)dis_pipeline;
+}
+
+void app_video_set_config(const VideoConfig *config) { g_config = *config; }
+
+int app_video_main(void *arg) {
+  (void)arg;
+  VideoCameraConfig cameras[VIDEO_MAX_CAMERAS];
+  int count = 0;
+  int started = 0;
+
+  memcpy(cameras, g_config.cameras, sizeof(cameras));
+  for (int i = 0; i < VIDEO_MAX_CAMERAS; i++) {
+    count += cameras[i].enabled ? 1 : 0;
+  }
+  if (count == 0) {
+    // No [cameraN] sections, run the single default sensor
+    cameras[0].enabled = 1;
+    count = 1;
+  }
+
+  RK_MPI_SYS_Init();
+  pthread_mutex_lock(&media_mutex);
+  media_quit_flag = 0;
+
+  for (int i = 0; i < VIDEO_MAX_CAMERAS; i++) {
+    if (cameras[i].enabled &&
+        camera_start(&g_cameras[i], i, &cameras[i], count > 1) == 0) {
+      started++;
+    }
+  }
+
+  // Stream threads exit once app_video_quit() raises media_quit_flag
+  for (int i = 0; i < VIDEO_MAX_CAMERAS; i++) {
+    stream_join(&g_cameras[i].main);
+    stream_join(&g_cameras[i].sub);
+  }
+
+  for (int i = 0; i < VIDEO_MAX_CAMERAS; i++) {
+    camera_stop(&g_cameras[i]);
+  }
+  LOGI("video exit, %d camera(s)", started);
   pthread_mutex_unlock(&media_mutex);
- RK_MPI_SYS_Exit(); 
-  SIMPLE_COMM_ISP_Stop(0);
+  RK_MPI_SYS_Exit();
+  for (int i = 0; i < VIDEO_MAX_CAMERAS; i++) {
+    if (g_cameras[i].started) {
+      SIMPLE_COMM_ISP_Stop(g_cameras[i].id);
+      g_cameras[i].started = false;
+    }
+  }
+  return started > 0 ? 0 : -1;
 }
 
 void app_video_quit(void) {
@@ -0,0 +1,102 @@
+#include "snapshot.h"
+#include "utils.h"
+
+#include <nng/protocol/reqrep0/rep.h>
+#include <nng/protocol/reqrep0/req.h>
+#include <stdio.h>
+#include <string.h>
+
+static void *snapshot_service_thread(void *arg) {
+  snapshot_service_t *svc = (snapshot_service_t *)arg;
+
+  while (1) {
+    nng_msg *req;
+    nng_msg *rep = NULL;
+    int rv = nng_recvmsg(svc->rep, &req, 0);
+    if (rv == NNG_ECLOSED) {
+      break;
+    } else if (rv != 0) {
+      continue;
+    }
+    nng_msg_free(req);
+
+    // An empty reply tells the client the capture failed
+    if (svc->capture(svc->ctx, &rep, svc->timeout_ms) != 0 &&
+        nng_msg_alloc(&rep, 0) != 0) {
+      continue;
+    }
+    if (nng_sendmsg(svc->rep, rep, 0) != 0) {
+      nng_msg_free(rep);
+    }
+  }
+  return NULL;
+}
+
+int snapshot_service_open(snapshot_service_t *svc, const char *topic,
+                          snapshot_capture_fn capture, void *ctx,
+                          int timeout_ms) {
+  int rv;
+
+  memset(svc, 0, sizeof(*svc));
+  svc->capture = capture;
+  svc->ctx = ctx;
+  svc->timeout_ms = timeout_ms;
+
+  if ((rv = nng_rep0_open(&svc->rep)) != 0) {
+    LOGE("snapshot_service_open: nng_rep0_open: %s", nng_strerror(rv));
+    return -1;
+  }
+  if ((rv = nng_listen(svc->rep, topic, NULL, 0)) != 0) {
+    LOGE("snapshot_service_open: %s: %s", topic, nng_strerror(rv));
+    nng_close(svc->rep);
+    return -1;
+  }
+  if (pthread_create(&svc->tid, NULL, snapshot_service_thread, svc) != 0) {
+    LOGE("snapshot_service_open: failed to create thread");
+    nng_close(svc->rep);
+    return -1;
+  }
+  svc->running = true;
+  return 0;
+}
+
+void snapshot_service_close(snapshot_service_t *svc) {
+  if (!svc->running) {
+    return;
+  }
+  nng_close(svc->rep);
+  pthread_join(svc->tid, NULL);
+  svc->running = false;
+}
+
+int snapshot_request(const char *topic, nng_msg **jpeg, int timeout_ms) {
+  nng_socket sock;
+  int rv;
+
+  if ((rv = nng_req0_open(&sock)) != 0) {
+    return -1;
+  }
+  nng_socket_set_ms(sock, NNG_OPT_SENDTIMEO, timeout_ms);
+  nng_socket_set_ms(sock, NNG_OPT_RECVTIMEO, timeout_ms);
+  if ((rv = nng_dial(sock, topic, NULL, 0)) != 0) {
+    nng_close(sock);
+    return -1;
+  }
+
+  *jpeg = NULL;
+  rv = nng_send(sock, "", 0, 0);
+  if (rv == 0) {
+    rv = nng_recvmsg(sock, jpeg, 0);
+  }
+  nng_close(sock);
+
+  if (rv != 0) {
+    return -1;
+  }
+  if (nng_msg_len(*jpeg) == 0) {
+    nng_msg_free(*jpeg);
+    *jpeg = NULL;
+    return -1;
+  }
+  return 0;
+}
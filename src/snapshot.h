@@ -0,0 +1,46 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <nng/nng.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+/*
+ * snapshot - JPEG still image request/reply service
+ * a request carries no payload, the reply is a JPEG picture or empty if
+ * none could be captured
+ */
+
+/**
+ * Capture one JPEG picture into a newly allocated *jpeg
+ * Returns 0 if success, -1 on error
+ */
+typedef int (*snapshot_capture_fn)(void *ctx, nng_msg **jpeg, int timeout_ms);
+
+typedef struct {
+  nng_socket rep;
+  pthread_t tid;
+  bool running;
+  snapshot_capture_fn capture;
+  void *ctx;
+  int timeout_ms;
+} snapshot_service_t;
+
+/**
+ * Serve capture() on topic from a dedicated thread
+ * Returns 0 if success, -1 on error
+ */
+int snapshot_service_open(snapshot_service_t *svc, const char *topic,
+                          snapshot_capture_fn capture, void *ctx,
+                          int timeout_ms);
+
+void snapshot_service_close(snapshot_service_t *svc);
+
+/**
+ * Ask the service on topic for a picture
+ * On success *jpeg holds the JPEG data, the caller frees it
+ * Returns 0 if success, -1 if none is available within timeout_ms
+ */
+int snapshot_request(const char *topic, nng_msg **jpeg, int timeout_ms);
+
+#endif // SNAPSHOT_H_
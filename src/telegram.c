@@ -1,5 +1,7 @@
 #include "telegram.h"
+#include "snapshot.h"
 #include "utils.h"
+#include "video.h"
 #include <cjson/cJSON.h>
 #include <curl/curl.h>
 #include <nng/nng.h>
@@ -15,6 +17,12 @@ static nng_socket
     g_nng_sock; // Global NNG socket to allow closing from app_telegram_quit
 
 #define TIMEOUT 10
+// The camera answers within two frame intervals; a static scene drops the
+// encoder to static_fps (5 by default), so allow a few of those
+#define SNAPSHOT_TIMEOUT_MS 1000
+// parse_snap_command() results other than a camera index
+#define SNAP_NOT_COMMAND -1
+#define SNAP_BAD_CAMERA -2
 
 struct buffer {
   char *data;
@@ -57,6 +65,75 @@ void send_message(CURL *curl, long long chat_id, const char *text,
   curl_free(escaped);
 }
 
+static void send_photo(CURL *curl, long long chat_id, const void *jpeg,
+                       size_t size, const char *bot_token) {
+  char url[256];
+  char id[32];
+  curl_mime *mime = curl_mime_init(curl);
+  curl_mimepart *part;
+
+  snprintf(url, sizeof(url), "https://api.telegram.org/bot%s/sendPhoto",
+           bot_token);
+  snprintf(id, sizeof(id), "%lld", chat_id);
+
+  part = curl_mime_addpart(mime);
+  curl_mime_name(part, "chat_id");
+  curl_mime_data(part, id, CURL_ZERO_TERMINATED);
+  part = curl_mime_addpart(mime);
+  curl_mime_name(part, "photo");
+  curl_mime_filename(part, "snapshot.jpg");
+  curl_mime_type(part, "image/jpeg");
+  curl_mime_data(part, jpeg, size);
+
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+  curl_easy_perform(curl);
+  curl_easy_setopt(curl, CURLOPT_MIMEPOST, NULL);
+  curl_mime_free(mime);
+}
+
+// "/snap [camera]", returns the camera index, SNAP_NOT_COMMAND for other
+// text or SNAP_BAD_CAMERA if the argument is not a camera index
+static int parse_snap_command(const char *text) {
+  if (strncmp(text, "/snap", 5) != 0 || (text[5] != '\0' && text[5] != ' ')) {
+    return SNAP_NOT_COMMAND;
+  }
+  const char *arg = text + 5;
+  while (*arg == ' ') {
+    arg++;
+  }
+  if (*arg == '\0') {
+    return 0;
+  }
+  char *end;
+  long camera = strtol(arg, &end, 10);
+  while (*end == ' ') {
+    end++;
+  }
+  if (end == arg || *end != '\0' || camera < 0 ||
+      camera >= VIDEO_MAX_CAMERAS) {
+    return SNAP_BAD_CAMERA;
+  }
+  return (int)camera;
+}
+
+static void send_snapshot(CURL *curl, long long chat_id, int camera,
+                          const char *bot_token) {
+  char topic[VIDEO_TOPIC_MAX];
+  nng_msg *jpeg;
+
+  video_camera_topic(topic, sizeof(topic), TOPIC_VIDEO_SNAPSHOT, camera);
+  if (snapshot_request(topic, &jpeg, SNAPSHOT_TIMEOUT_MS) != 0) {
+    LOGW("snapshot of camera %d unavailable", camera);
+    send_message(curl, chat_id, "Snapshot unavailable", bot_token);
+    return;
+  }
+  send_photo(curl, chat_id, nng_msg_body(jpeg), nng_msg_len(jpeg), bot_token);
+  nng_msg_free(jpeg);
+}
+
 int app_telegram_main(void *arg) {
   const char *bot_token = (const char *)arg;
   CURL *curl;
@@ -83,6 +160,8 @@ int app_telegram_main(void *arg) {
              bot_token, TIMEOUT, last_update_id + 1);
 
     curl_easy_setopt(curl, CURLOPT_URL, url);
+    // Replies leave the handle in POST mode
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, TIMEOUT + 5);
@@ -142,8 +221,18 @@ int app_telegram_main(void *arg) {
       }
       LOGI("cmd: %s", text->valuestring);
       nng_send(g_nng_sock, text->valuestring, strlen(text->valuestring), 0);
+      int snap_camera = parse_snap_command(text->valuestring);
       cJSON_Delete(root);
-      send_message(curl, chat_id_value, "Message received!", bot_token);
+      if (snap_camera >= 0) {
+        send_snapshot(curl, chat_id_value, snap_camera, bot_token);
+      } else if (snap_camera == SNAP_BAD_CAMERA) {
+        char reply[64];
+        snprintf(reply, sizeof(reply), "Usage: /snap [camera], 0 to %d",
+                 VIDEO_MAX_CAMERAS - 1);
+        send_message(curl, chat_id_value, reply, bot_token);
+      } else {
+        send_message(curl, chat_id_value, "Message received!", bot_token);
+      }
     } while (0);
 
     free(buf.data);
@@ -1,169 +1,61 @@
+#include "h264_file.h"
+#include "media.h"
 #include "utils.h"
 #include "video.h"
-#include <nng/nng.h>
-#include <nng/protocol/pubsub0/pub.h>
+#include "video_bus.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-#include <unistd.h>
-#define FPS 30
 
-static int g_video_size = 0;
-static uint8_t *g_video_buf = NULL;
-static uint8_t *g_pps_buf = NULL;
-static uint8_t *g_sps_buf = NULL;
-static const uint32_t nalu_start_4bytecode = 0x01000000;
-static const uint32_t nalu_start_3bytecode = 0x010000;
+static const char DEFAULT_VIDEO_FILE[] = "test.264";
 
-typedef enum H264_NALU_TYPE {
-  NALU_TYPE_SPS = 7,
-  NALU_TYPE_PPS = 8,
-  NALU_TYPE_IDR = 5,
-  NALU_TYPE_NON_IDR = 1,
-} H264_NALU_TYPE;
+static char *g_video_file = NULL;
+static VideoConfig g_config = {
+    .fps = VIDEO_DEFAULT_FPS,
+    .loop = 1,
+};
+static volatile bool g_running = false;
 
-int video_init() {
-  FILE *video_fp = NULL;
-  char videofile[] = "test.264";
-
-  video_fp = fopen(videofile, "rb");
-
-  if (video_fp == NULL) {
-    printf("open file %s failed\n", videofile);
-    return -1;
+// The file source has no pipelines; the camera entry names the input file.
+void app_video_set_pipelines(const char *cam_pipeline,
+                             const char *dis_pipeline) {
+  (void)dis_pipeline;
+  if (cam_pipeline && cam_pipeline[0] != '\0') {
+    free(g_video_file);
+    g_video_file = strdup(cam_pipeline);
   }
-
-  fseek(video_fp, 0, SEEK_END);
-  g_video_size = ftell(video_fp);
-  fseek(video_fp, 0, SEEK_SET);
-  g_video_buf = (uint8_t *)calloc(1, g_video_size);
-  fread(g_video_buf, g_video_size, 1, video_fp);
-  fclose(video_fp);
-  return 0;
 }
 
-uint8_t *video_h264_find_nalu(uint8_t *buf_start, uint8_t *buf_end) {
-  uint8_t *p = buf_start;
-
-  while ((p + 3) < buf_end) {
-    if (memcmp(p, &nalu_start_4bytecode, 4) == 0) {
-      return p;
-    } else if (memcmp(p, &nalu_start_3bytecode, 3) == 0) {
-      return p;
-    }
-    p++;
-  }
-
-  return buf_end;
-}
-
-uint8_t *video_get_video_frame(int *size) {
-  uint8_t *buf = NULL;
-  static int pps_size = 0;
-  static int sps_size = 0;
-  uint8_t *buf_end = g_video_buf + g_video_size;
-
-  static uint8_t *pstart = NULL;
-  static uint8_t *pend = NULL;
-  size_t nalu_size;
-
-  if (!pstart)
-    pstart = g_video_buf;
-
-  pend = video_h264_find_nalu(pstart + 2, buf_end);
-
-  if (pend == buf_end) {
-    pstart = NULL;
-    return NULL;
-  }
-
-  nalu_size = pend - pstart;
-  int start_code_offset = memcmp(pstart, &nalu_start_3bytecode, 3) == 0 ? 3 : 4;
-  H264_NALU_TYPE nalu_type = (H264_NALU_TYPE)(pstart[start_code_offset] & 0x1f);
-  switch (nalu_type) {
-  case NALU_TYPE_SPS:
-    sps_size = nalu_size;
-    if (g_sps_buf != NULL) {
-      free(g_sps_buf);
-      g_sps_buf = NULL;
-    }
-    g_sps_buf = (uint8_t *)calloc(1, sps_size);
-    memcpy(g_sps_buf, pstart, sps_size);
-    break;
-  case NALU_TYPE_PPS:
-    pps_size = nalu_size;
-    if (g_pps_buf != NULL) {
-      free(g_pps_buf);
-      g_pps_buf = NULL;
-    }
-    g_pps_buf = (uint8_t *)calloc(1, pps_size);
-    memcpy(g_pps_buf, pstart, pps_size);
-
-    break;
-  case NALU_TYPE_IDR:
-    *size = sps_size + pps_size + nalu_size;
-    buf = (uint8_t *)calloc(1, *size);
-    memcpy(buf, g_sps_buf, sps_size);
-    memcpy(buf + sps_size, g_pps_buf, pps_size);
-    memcpy(buf + sps_size + pps_size, pstart, nalu_size);
+void app_video_set_config(const VideoConfig *config) { g_config = *config; }
 
-    break;
-  case NALU_TYPE_NON_IDR:
-  default:
-    *size = nalu_size;
-    buf = (uint8_t *)calloc(1, *size);
-    memcpy(buf, pstart, nalu_size);
-
-    break;
-  }
-
-  pstart = pend;
-
-  return buf;
-}
-
-void video_deinit() {
-  if (g_sps_buf != NULL) {
-    free(g_sps_buf);
-    g_sps_buf = NULL;
-  }
+int app_video_main(void *arg) {
+  (void)arg;
 
-  if (g_pps_buf != NULL) {
-    free(g_pps_buf);
-    g_pps_buf = NULL;
-  }
+  h264_file_t file;
+  h264_au_t au;
+  video_bus_t bus;
 
-  if (g_video_buf != NULL) {
-    free(g_video_buf);
-    g_video_buf = NULL;
+  if (h264_file_open(&file, g_video_file ? g_video_file : DEFAULT_VIDEO_FILE,
+                     g_config.fps, g_config.loop) < 0) {
+    return -1;
   }
-}
 
-int app_video_main(void *arg) {
-  (void)arg;
-  if (video_init() < 0) {
+  if (video_bus_open(&bus, TOPIC_VIDEO_COMPRESSED, TOPIC_VIDEO_KEYFRAME) < 0) {
+    h264_file_close(&file);
     return -1;
   }
 
-  int frame_size = 0;
-  uint8_t *frame_buf = NULL;
-
-  nng_socket sock;
-  nng_pub0_open(&sock);
-  nng_listen(sock, TOPIC_VIDEO_COMPRESSED, NULL, 0);
-  while (1) {
-
-    if ((frame_buf = video_get_video_frame(&frame_size)) != NULL) {
-      nng_send(sock, frame_buf, frame_size, 0);
-      free(frame_buf);
-    }
-    usleep(1000000 / FPS);
+  g_running = true;
+  while (g_running && h264_file_next(&file, &au) == 0) {
+    h264_file_pace(&file);
+    video_bus_publish(&bus, au.data, au.size, media_now_us());
   }
 
-  video_deinit();
+  video_bus_close(&bus);
+  h264_file_close(&file);
   return 0;
 }
 
-void app_video_quit() {}
+void app_video_quit() { g_running = false; }
@@ -0,0 +1,248 @@
+#include "ts_mux.h"
+
+#include <string.h>
+
+#define TS_PID_PAT 0x0000
+#define TS_PID_PMT 0x1000
+#define TS_PID_VIDEO 0x0100
+#define TS_PID_AUDIO 0x0101
+
+#define TS_STREAM_TYPE_H264 0x1b
+#define TS_STREAM_TYPE_PRIVATE 0x06 // Opus, identified by its descriptors
+
+#define TS_PES_VIDEO 0xe0
+#define TS_PES_PRIVATE_1 0xbd
+
+#define TS_PTS_MASK 0x1ffffffffULL
+// The PCR runs this far behind the video PTS to leave decoders some slack
+#define TS_PCR_LEAD (TS_CLOCK_HZ / 10)
+
+void ts_mux_init(ts_mux_t *mux, int audio_channels, ts_mux_write_fn write,
+                 void *opaque) {
+  memset(mux, 0, sizeof(*mux));
+  mux->write = write;
+  mux->opaque = opaque;
+  mux->audio_channels = audio_channels;
+}
+
+// MPEG-2 CRC-32 used by PSI sections: polynomial 0x04c11db7, not reflected
+static uint32_t ts_crc32(const uint8_t *data, size_t len) {
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint32_t)data[i] << 24;
+    for (int b = 0; b < 8; b++) {
+      crc = crc & 0x80000000 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Wrap one PSI section (without its CRC) into a single packet
+static void ts_write_section(ts_mux_t *mux, int pid, uint8_t *cc,
+                             const uint8_t *section, size_t len) {
+  uint8_t pkt[TS_PACKET_SIZE];
+  uint32_t crc = ts_crc32(section, len);
+
+  memset(pkt, 0xff, sizeof(pkt));
+  pkt[0] = 0x47;
+  pkt[1] = 0x40 | (pid >> 8);
+  pkt[2] = pid & 0xff;
+  pkt[3] = 0x10 | (*cc & 0x0f);
+  *cc = (*cc + 1) & 0x0f;
+  pkt[4] = 0; // pointer_field
+  memcpy(pkt + 5, section, len);
+  pkt[5 + len] = crc >> 24;
+  pkt[6 + len] = crc >> 16;
+  pkt[7 + len] = crc >> 8;
+  pkt[8 + len] = crc;
+  mux->write(mux->opaque, pkt);
+}
+
+void ts_mux_write_tables(ts_mux_t *mux) {
+  uint8_t pat[] = {
+      0x00,                                      // table_id
+      0xb0, 13,                                  // section_length
+      0x00, 0x01,                                // transport_stream_id
+      0xc1, 0x00, 0x00,                          // version 0, current
+      0x00, 0x01,                                // program_number
+      0xe0 | (TS_PID_PMT >> 8), TS_PID_PMT & 0xff // program_map_PID
+  };
+  ts_write_section(mux, TS_PID_PAT, &mux->cc_pat, pat, sizeof(pat));
+
+  uint8_t pmt[64];
+  size_t n = 0;
+  pmt[n++] = 0x02; // table_id
+  n += 2;          // section_length, filled in below
+  pmt[n++] = 0x00;
+  pmt[n++] = 0x01; // program_number
+  pmt[n++] = 0xc1;
+  pmt[n++] = 0x00;
+  pmt[n++] = 0x00;
+  pmt[n++] = 0xe0 | (TS_PID_VIDEO >> 8); // PCR_PID
+  pmt[n++] = TS_PID_VIDEO & 0xff;
+  pmt[n++] = 0xf0; // program_info_length
+  pmt[n++] = 0x00;
+
+  pmt[n++] = TS_STREAM_TYPE_H264;
+  pmt[n++] = 0xe0 | (TS_PID_VIDEO >> 8);
+  pmt[n++] = TS_PID_VIDEO & 0xff;
+  pmt[n++] = 0xf0;
+  pmt[n++] = 0x00;
+
+  // ETSI TS 102 366 style signalling used by ffmpeg and GStreamer for Opus
+  pmt[n++] = TS_STREAM_TYPE_PRIVATE;
+  pmt[n++] = 0xe0 | (TS_PID_AUDIO >> 8);
+  pmt[n++] = TS_PID_AUDIO & 0xff;
+  pmt[n++] = 0xf0;
+  pmt[n++] = 10;   // ES_info_length
+  pmt[n++] = 0x05; // registration_descriptor
+  pmt[n++] = 4;
+  memcpy(pmt + n, "Opus", 4);
+  n += 4;
+  pmt[n++] = 0x7f; // extension_descriptor
+  pmt[n++] = 2;
+  pmt[n++] = 0x80;                 // Opus audio descriptor
+  pmt[n++] = mux->audio_channels; // channel_config_code, mapping family 0
+
+  size_t section_length = n - 3 + 4; // after the length field, CRC included
+  pmt[1] = 0xb0 | (section_length >> 8);
+  pmt[2] = section_length & 0xff;
+  ts_write_section(mux, TS_PID_PMT, &mux->cc_pmt, pmt, n);
+}
+
+static size_t ts_write_pts(uint8_t *p, uint64_t pts) {
+  pts &= TS_PTS_MASK;
+  p[0] = 0x21 | ((pts >> 29) & 0x0e);
+  p[1] = pts >> 22;
+  p[2] = 0x01 | ((pts >> 14) & 0xfe);
+  p[3] = pts >> 7;
+  p[4] = 0x01 | ((pts << 1) & 0xfe);
+  return 5;
+}
+
+// PES header with a PTS; length 0 means unbounded, allowed for video only
+static size_t ts_pes_header(uint8_t *p, uint8_t stream_id, size_t payload,
+                            uint64_t pts) {
+  size_t len = payload + 3 + 5;
+  if (len > 0xffff) {
+    len = 0;
+  }
+  p[0] = 0x00;
+  p[1] = 0x00;
+  p[2] = 0x01;
+  p[3] = stream_id;
+  p[4] = len >> 8;
+  p[5] = len & 0xff;
+  p[6] = 0x84; // data_alignment_indicator
+  p[7] = 0x80; // PTS only, the encoders emit no B frames
+  p[8] = 5;
+  return 9 + ts_write_pts(p + 9, pts);
+}
+
+// Split head + body into packets of one PID; the first packet may carry a
+// PCR and the random access flag, the last is padded by adaptation stuffing
+static void ts_packetize(ts_mux_t *mux, int pid, uint8_t *cc,
+                         const uint8_t *head, size_t head_len,
+                         const uint8_t *body, size_t body_len, bool with_pcr,
+                         uint64_t pcr, bool random_access) {
+  size_t total = head_len + body_len;
+  size_t off = 0;
+  bool first = true;
+
+  while (off < total) {
+    uint8_t pkt[TS_PACKET_SIZE];
+    uint8_t af_flags = 0;
+    size_t af_len = 0; // adaptation field size including its length byte
+
+    if (first && random_access) {
+      af_flags |= 0x40;
+    }
+    if (first && with_pcr) {
+      af_flags |= 0x10;
+    }
+    if (af_flags) {
+      af_len = 2 + (af_flags & 0x10 ? 6 : 0);
+    }
+
+    size_t room = TS_PACKET_SIZE - 4 - af_len;
+    size_t n = total - off < room ? total - off : room;
+    af_len = TS_PACKET_SIZE - 4 - n;
+
+    pkt[0] = 0x47;
+    pkt[1] = (first ? 0x40 : 0x00) | (pid >> 8);
+    pkt[2] = pid & 0xff;
+    pkt[3] = (af_len ? 0x30 : 0x10) | (*cc & 0x0f);
+    *cc = (*cc + 1) & 0x0f;
+
+    uint8_t *p = pkt + 4;
+    if (af_len > 0) {
+      uint8_t *af_end = p + af_len;
+      *p++ = af_len - 1;
+      if (af_len > 1) {
+        *p++ = af_flags;
+        if (af_flags & 0x10) {
+          uint64_t base = pcr & TS_PTS_MASK;
+          *p++ = base >> 25;
+          *p++ = base >> 17;
+          *p++ = base >> 9;
+          *p++ = base >> 1;
+          *p++ = ((base & 1) << 7) | 0x7e;
+          *p++ = 0x00;
+        }
+        memset(p, 0xff, af_end - p);
+        p = af_end;
+      }
+    }
+
+    // Copy n bytes of head + body starting at off
+    size_t left = n;
+    if (off < head_len) {
+      size_t k = head_len - off < left ? head_len - off : left;
+      memcpy(p, head + off, k);
+      p += k;
+      left -= k;
+    }
+    if (left > 0) {
+      memcpy(p, body + (off + n - left - head_len), left);
+    }
+
+    mux->write(mux->opaque, pkt);
+    off += n;
+    first = false;
+  }
+}
+
+void ts_mux_write_video(ts_mux_t *mux, const uint8_t *au, size_t size,
+                        uint64_t pts, bool key) {
+  uint8_t head[16];
+  size_t head_len = ts_pes_header(head, TS_PES_VIDEO, size, pts);
+  uint64_t pcr = (pts - TS_PCR_LEAD) & TS_PTS_MASK;
+
+  ts_packetize(mux, TS_PID_VIDEO, &mux->cc_video, head, head_len, au, size,
+               true, pcr, key);
+}
+
+void ts_mux_write_audio(ts_mux_t *mux, const uint8_t *packet, size_t size,
+                        uint64_t pts) {
+  // PES header, then the Opus control header: prefix, no trims, au_size
+  uint8_t head[16 + 2 + 64];
+  size_t ctrl = 2 + size / 255 + 1;
+  size_t head_len;
+
+  if (size / 255 + 1 > 64) {
+    return;
+  }
+  head_len = ts_pes_header(head, TS_PES_PRIVATE_1, ctrl + size, pts);
+  head[head_len++] = 0x7f;
+  head[head_len++] = 0xe0;
+  for (size_t left = size; ; left -= 255) {
+    if (left < 255) {
+      head[head_len++] = left;
+      break;
+    }
+    head[head_len++] = 0xff;
+  }
+
+  ts_packetize(mux, TS_PID_AUDIO, &mux->cc_audio, head, head_len, packet,
+               size, false, 0, true);
+}
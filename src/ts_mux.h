@@ -0,0 +1,52 @@
+#ifndef TS_MUX_H_
+#define TS_MUX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * ts_mux - MPEG-TS muxer for one H.264 and one Opus elementary stream
+ * packets are handed out one by one, nothing is buffered; timestamps are
+ * in 90 kHz units and wrap at 33 bits
+ */
+#define TS_PACKET_SIZE 188
+#define TS_CLOCK_HZ 90000
+
+/**
+ * Receives every TS_PACKET_SIZE byte packet in stream order
+ */
+typedef void (*ts_mux_write_fn)(void *opaque, const uint8_t *pkt);
+
+typedef struct {
+  ts_mux_write_fn write;
+  void *opaque;
+  int audio_channels;
+  uint8_t cc_pat;
+  uint8_t cc_pmt;
+  uint8_t cc_video;
+  uint8_t cc_audio;
+} ts_mux_t;
+
+void ts_mux_init(ts_mux_t *mux, int audio_channels, ts_mux_write_fn write,
+                 void *opaque);
+
+/**
+ * Emit PAT and PMT; call at the start of a file and before keyframes so a
+ * reader can start anywhere
+ */
+void ts_mux_write_tables(ts_mux_t *mux);
+
+/**
+ * Emit one Annex-B access unit; the PCR travels with video
+ */
+void ts_mux_write_video(ts_mux_t *mux, const uint8_t *au, size_t size,
+                        uint64_t pts, bool key);
+
+/**
+ * Emit one Opus packet
+ */
+void ts_mux_write_audio(ts_mux_t *mux, const uint8_t *packet, size_t size,
+                        uint64_t pts);
+
+#endif // TS_MUX_H_
@@ -1,16 +1,84 @@
 #ifndef VIDEO_H_
 #define VIDEO_H_
+#include "osd.h"
+#include <stdint.h>
 #include <stdio.h>
 
 #define TOPIC_VIDEO_COMPRESSED "inproc://video.compressed"
+// low resolution copy for thumbnails, recording and LAN preview
+#define TOPIC_VIDEO_COMPRESSED_SUB "inproc://video.compressed.sub"
 #define TOPIC_VIDEO_RAW "inproc://video.raw"
 #define TOPIC_VIDEO_WEBRTC "inproc://video.webrtc"
+// request/reply: latest SPS + PPS + IDR for subscribers joining mid-GOP
+#define TOPIC_VIDEO_KEYFRAME "inproc://video.keyframe"
+#define TOPIC_VIDEO_KEYFRAME_SUB "inproc://video.keyframe.sub"
+// VideoMotionEvent on every static/motion transition
+#define TOPIC_VIDEO_MOTION "inproc://video.motion"
+// request/reply: one JPEG still of the camera, empty reply if none
+#define TOPIC_VIDEO_SNAPSHOT "inproc://video.snapshot"
+
+#define VIDEO_MAX_CAMERAS 8
+#define VIDEO_TOPIC_MAX 64
+
+#define VIDEO_DEFAULT_WIDTH 1280
+#define VIDEO_DEFAULT_HEIGHT 720
+#define VIDEO_DEFAULT_FPS 30
+#define VIDEO_DEFAULT_BITRATE_KBPS (10 * 1024)
+#define VIDEO_DEFAULT_MOTION_IDLE_S 10
+#define VIDEO_DEFAULT_STATIC_FPS 5
+#define VIDEO_DEFAULT_STATIC_KBPS 512
+#define VIDEO_DEFAULT_SUB_BITRATE_KBPS 512
+
+// One [cameraN] section of lamb.ini
+typedef struct {
+  int enabled;
+  int width;
+  int height;
+  int bitrate_kbps; // 0 uses VideoConfig.bitrate_kbps
+} VideoCameraConfig;
+
+typedef struct {
+  int fps;           // source frame rate, <= 0 lets file sources run unpaced
+  int loop;          // restart file sources at end of file
+  int bitrate_kbps;  // encoder CBR target
+  int motion;        // drop to static_fps/static_kbps while nothing moves
+  int motion_idle_s; // seconds without motion before the scene is static
+  int static_fps;    // encoder frame rate while static
+  int static_kbps;   // VBR ceiling while static
+  int sub_width;     // sub stream size, 0 disables it
+  int sub_height;    // 0 keeps the main stream aspect ratio
+  int sub_bitrate_kbps;
+  int temporal_layers; // 2 alternates base and droppable frames, 1 disables
+  OsdConfig osd;       // burnt into the main stream and snapshots
+  VideoCameraConfig cameras[VIDEO_MAX_CAMERAS]; // none enabled: camera 0
+} VideoConfig;
+
+typedef struct {
+  uint64_t pts_us;
+  int active;    // 1 when motion resumes, 0 when the scene turned static
+  uint32_t area; // moving area reported by the detector
+} VideoMotionEvent;
+
+/**
+ * Per-camera topic name: camera 0 uses base as is so single camera setups
+ * keep the well known topics, camera N gets base + ".N"
+ */
+static inline void video_camera_topic(char *buf, size_t size, const char *base,
+                                      int camera) {
+  if (camera == 0) {
+    snprintf(buf, size, "%s", base);
+  } else {
+    snprintf(buf, size, "%s.%d", base, camera);
+  }
+}
 
 int app_video_main(void *arg);
 
 void app_video_set_pipelines(const char *cam_pipeline,
                              const char *dis_pipeline);
 
+void app_video_set_config(const VideoConfig *config);
+
 void app_video_quit();
 
 #endif // VIDEO_H_
@@ -0,0 +1,232 @@
+#include "video_bus.h"
+#include "media.h"
+#include "utils.h"
+
+#include <nng/protocol/pubsub0/pub.h>
+#include <nng/protocol/reqrep0/rep.h>
+#include <nng/protocol/reqrep0/req.h>
+#include <stdio.h>
+#include <string.h>
+
+static void *video_bus_keyframe_thread(void *arg) {
+  video_bus_t *bus = (video_bus_t *)arg;
+
+  while (1) {
+    nng_msg *req;
+    nng_msg *rep;
+    int rv = nng_recvmsg(bus->rep, &req, 0);
+    if (rv == NNG_ECLOSED) {
+      break;
+    } else if (rv != 0) {
+      continue;
+    }
+    // A non-zero byte asks for a new GOP as well
+    bool new_idr =
+        nng_msg_len(req) > 0 && ((const uint8_t *)nng_msg_body(req))[0];
+    nng_msg_free(req);
+    // Under the lock so clearing the handler waits out a call in progress
+    pthread_mutex_lock(&bus->mtx);
+    if (new_idr && bus->idr_fn) {
+      bus->idr_fn(bus->idr_arg);
+    }
+    pthread_mutex_unlock(&bus->mtx);
+
+    // An empty reply means no keyframe has been produced yet
+    pthread_mutex_lock(&bus->mtx);
+    size_t size = bus->cache.keyframe_size;
+    if (nng_msg_alloc(&rep, size ? sizeof(media_frame_hdr_t) + size : 0) !=
+        0) {
+      pthread_mutex_unlock(&bus->mtx);
+      continue;
+    }
+    if (size) {
+      media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(rep);
+      hdr->flags = MEDIA_FRAME_FLAG_KEY;
+      hdr->seq = bus->seq;
+      hdr->pts_us = bus->keyframe_pts_us;
+      memcpy(hdr + 1, bus->cache.keyframe, size);
+    }
+    pthread_mutex_unlock(&bus->mtx);
+
+    if (nng_sendmsg(bus->rep, rep, 0) != 0) {
+      nng_msg_free(rep);
+    }
+  }
+  return NULL;
+}
+
+int video_bus_open(video_bus_t *bus, const char *topic,
+                   const char *keyframe_topic) {
+  int rv;
+
+  memset(bus, 0, sizeof(*bus));
+  bus->pub.id = -1;
+  bus->rep.id = -1;
+  bus->temporal_layers = 1;
+  pthread_mutex_init(&bus->mtx, NULL);
+  h264_param_cache_init(&bus->cache);
+
+  if ((rv = nng_pub0_open(&bus->pub)) != 0 ||
+      (rv = nng_listen(bus->pub, topic, NULL, 0)) != 0) {
+    LOGE("video_bus_open: %s: %s", topic, nng_strerror(rv));
+    video_bus_close(bus);
+    return -1;
+  }
+
+  if (!keyframe_topic) {
+    return 0;
+  }
+  if ((rv = nng_rep0_open(&bus->rep)) != 0 ||
+      (rv = nng_listen(bus->rep, keyframe_topic, NULL, 0)) != 0) {
+    LOGE("video_bus_open: %s: %s", keyframe_topic, nng_strerror(rv));
+    video_bus_close(bus);
+    return -1;
+  }
+  if (pthread_create(&bus->rep_tid, NULL, video_bus_keyframe_thread, bus) !=
+      0) {
+    LOGE("video_bus_open: failed to create keyframe thread");
+    video_bus_close(bus);
+    return -1;
+  }
+  bus->rep_running = true;
+  return 0;
+}
+
+void video_bus_set_idr_handler(video_bus_t *bus, video_bus_idr_fn fn,
+                               void *arg) {
+  pthread_mutex_lock(&bus->mtx);
+  bus->idr_fn = fn;
+  bus->idr_arg = arg;
+  pthread_mutex_unlock(&bus->mtx);
+}
+
+void video_bus_set_temporal_layers(video_bus_t *bus, int layers) {
+  if (layers < 1) {
+    layers = 1;
+  } else if (layers > VIDEO_BUS_MAX_TEMPORAL_LAYERS) {
+    layers = VIDEO_BUS_MAX_TEMPORAL_LAYERS;
+  }
+  pthread_mutex_lock(&bus->mtx);
+  bus->temporal_layers = layers;
+  pthread_mutex_unlock(&bus->mtx);
+}
+
+// Temporal layer of the frame just parsed, counting from the last IDR
+static int video_bus_temporal_id(video_bus_t *bus, int flags) {
+  if (flags & H264_AU_FLAG_IDR) {
+    bus->since_idr = 0;
+  }
+  int tid = bus->since_idr++ % bus->temporal_layers;
+
+  // Enhancement frames are never referenced; if one is, the encoder ignored
+  // the reference structure and no frame can be dropped safely
+  if (tid > 0 && !(flags & H264_AU_FLAG_NONREF)) {
+    LOGW("video_bus: stream is not temporally layered, using one layer");
+    bus->temporal_layers = 1;
+    tid = 0;
+  }
+  return tid;
+}
+
+int video_bus_publish(video_bus_t *bus, const uint8_t *au, size_t size,
+                      uint64_t pts_us) {
+  nng_msg *msg;
+  size_t sps_size = 0;
+  size_t pps_size = 0;
+  int rv;
+
+  pthread_mutex_lock(&bus->mtx);
+  int flags = h264_param_cache_update(&bus->cache, au, size);
+  if (flags & H264_AU_FLAG_IDR) {
+    // Encoders that only emit parameter sets once rely on us to repeat them
+    sps_size = flags & H264_AU_FLAG_SPS ? 0 : bus->cache.sps_size;
+    pps_size = flags & H264_AU_FLAG_PPS ? 0 : bus->cache.pps_size;
+  }
+
+  if ((rv = nng_msg_alloc(&msg, sizeof(media_frame_hdr_t) + sps_size +
+                                    pps_size + size)) != 0) {
+    pthread_mutex_unlock(&bus->mtx);
+    LOGE("video_bus_publish: nng_msg_alloc error: %s", nng_strerror(rv));
+    return rv;
+  }
+
+  media_frame_hdr_t *hdr = (media_frame_hdr_t *)nng_msg_body(msg);
+  uint8_t *p = (uint8_t *)(hdr + 1);
+  memcpy(p, bus->cache.sps, sps_size);
+  memcpy(p + sps_size, bus->cache.pps, pps_size);
+  memcpy(p + sps_size + pps_size, au, size);
+
+  hdr->flags = video_bus_temporal_id(bus, flags) << MEDIA_FRAME_TID_SHIFT;
+  if (flags & H264_AU_FLAG_NONREF) {
+    hdr->flags |= MEDIA_FRAME_FLAG_DISCARDABLE;
+  }
+  hdr->seq = bus->seq++;
+  hdr->pts_us = pts_us;
+  if ((flags & H264_AU_FLAG_IDR) && bus->cache.sps_size &&
+      bus->cache.pps_size) {
+    hdr->flags |= MEDIA_FRAME_FLAG_KEY;
+    if (nng_socket_id(bus->rep) != -1 &&
+        h264_param_cache_set_keyframe(&bus->cache, p,
+                                      sps_size + pps_size + size) == 0) {
+      bus->keyframe_pts_us = pts_us;
+    }
+  }
+  pthread_mutex_unlock(&bus->mtx);
+
+  if ((rv = nng_sendmsg(bus->pub, msg, 0)) != 0) {
+    LOGE("video_bus_publish: nng_sendmsg error: %s", nng_strerror(rv));
+    nng_msg_free(msg);
+  }
+  return rv;
+}
+
+void video_bus_close(video_bus_t *bus) {
+  if (nng_socket_id(bus->rep) != -1) {
+    nng_close(bus->rep);
+    bus->rep.id = -1;
+  }
+  if (bus->rep_running) {
+    pthread_join(bus->rep_tid, NULL);
+    bus->rep_running = false;
+  }
+  if (nng_socket_id(bus->pub) != -1) {
+    nng_close(bus->pub);
+    bus->pub.id = -1;
+  }
+  h264_param_cache_destroy(&bus->cache);
+  pthread_mutex_destroy(&bus->mtx);
+}
+
+int video_bus_request_keyframe(const char *keyframe_topic, nng_msg **msg,
+                               int timeout_ms, bool new_idr) {
+  uint8_t req = new_idr;
+  nng_socket sock;
+  int rv;
+
+  if ((rv = nng_req0_open(&sock)) != 0) {
+    return -1;
+  }
+  nng_socket_set_ms(sock, NNG_OPT_SENDTIMEO, timeout_ms);
+  nng_socket_set_ms(sock, NNG_OPT_RECVTIMEO, timeout_ms);
+  if ((rv = nng_dial(sock, keyframe_topic, NULL, 0)) != 0) {
+    nng_close(sock);
+    return -1;
+  }
+
+  *msg = NULL;
+  rv = nng_send(sock, &req, sizeof(req), 0);
+  if (rv == 0) {
+    rv = nng_recvmsg(sock, msg, 0);
+  }
+  nng_close(sock);
+
+  if (rv != 0) {
+    return -1;
+  }
+  if (nng_msg_len(*msg) <= sizeof(media_frame_hdr_t)) {
+    nng_msg_free(*msg);
+    *msg = NULL;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef VIDEO_BUS_H_
+#define VIDEO_BUS_H_
+
+#include "h264.h"
+#include <nng/nng.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * video_bus - H.264 publisher for a compressed video topic
+ * frames go out with a media_frame_hdr_t, IDRs missing parameter sets get
+ * the cached SPS/PPS prepended, and the latest keyframe is served on a
+ * request/reply topic so late joiners can start decoding immediately
+ */
+// A base layer plus non-reference frames is all the tagging can describe
+#define VIDEO_BUS_MAX_TEMPORAL_LAYERS 2
+
+// Asks the encoder to make the next frame an IDR
+typedef void (*video_bus_idr_fn)(void *arg);
+
+typedef struct {
+  nng_socket pub;
+  nng_socket rep;
+  pthread_t rep_tid;
+  bool rep_running;
+  pthread_mutex_t mtx;
+  h264_param_cache_t cache;
+  uint64_t keyframe_pts_us;
+  uint32_t seq;
+  int temporal_layers; // encoder reference pattern, 1 when flat
+  uint32_t since_idr;  // frames since the last IDR
+  video_bus_idr_fn idr_fn;
+  void *idr_arg;
+} video_bus_t;
+
+/**
+ * Listen on topic and serve keyframes on keyframe_topic (may be NULL)
+ * Returns 0 if success, -1 on error
+ */
+int video_bus_open(video_bus_t *bus, const char *topic,
+                   const char *keyframe_topic);
+
+/**
+ * Publish one access unit, thread safe
+ * Returns 0 if success, an nng error otherwise
+ */
+int video_bus_publish(video_bus_t *bus, const uint8_t *au, size_t size,
+                      uint64_t pts_us);
+
+/**
+ * Declare that the encoder alternates base frames with enhancement frames
+ * that nothing references, tagged with temporal layer 1; layers is clamped
+ * to VIDEO_BUS_MAX_TEMPORAL_LAYERS. The bus falls back to a single layer if
+ * an enhancement frame turns out to be a reference
+ */
+void video_bus_set_temporal_layers(video_bus_t *bus, int layers);
+
+/**
+ * Serve requests for a fresh IDR on the keyframe topic with fn; without it
+ * they only get the cached keyframe. fn runs on the bus's keyframe thread
+ * and is done once this returns, so NULL detaches it safely
+ */
+void video_bus_set_idr_handler(video_bus_t *bus, video_bus_idr_fn fn,
+                               void *arg);
+
+void video_bus_close(video_bus_t *bus);
+
+/**
+ * Fetch the latest keyframe from the publisher serving keyframe_topic, and
+ * with new_idr also have its encoder start a new GOP; the frames after the
+ * cached keyframe reference ones the caller never got, so it has to wait
+ * for that IDR before sending them on
+ * On success *msg holds a media_frame_hdr_t followed by SPS + PPS + IDR
+ * Returns 0 if success, -1 if none is available within timeout_ms
+ */
+int video_bus_request_keyframe(const char *keyframe_topic, nng_msg **msg,
+                               int timeout_ms, bool new_idr);
+
+#endif // VIDEO_BUS_H_